@@ -0,0 +1,511 @@
+
+// micro-benchmarks of index building blocks, on synthetic data.
+// every result is printed as one JSON object per line, so that runs can be compared by scripts:
+//   {"bench":"trie_traverse","charset":"cjk","size":1000000,"ops":1000000,"seconds":0.8,"nsPerOp":800}
+// except footprint, which reports bytes per item of each structure of index:
+//   {"bench":"footprint","part":"postings","size":1000000,"bytes":320000000,"bytesPerItem":320}
+// usage: taboo-bench [bench options] [-- taboo options], taboo options default to '-c etc/taboo.conf'.
+
+#include "predef.hpp"
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/chrono.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+#include <boost/program_options.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include "Config.hpp"
+#include "Aside.hpp"
+#include "Item.hpp"
+#include "Trie.hpp"
+#include "Farm.hpp"
+#include "Shard.hpp"
+#include "Footprint.hpp"
+#include "Filter.hpp"
+#include "Query.hpp"
+#include "query/BasePredicter.hpp"
+
+namespace po = boost::program_options;
+
+namespace taboo {
+
+// exposes formReply() of predicters.
+class BenchPredicter:
+    public query::BasePredicter
+{
+public:
+    using query::BasePredicter::formReply;
+
+    virtual SharedReply process()
+    {
+        return SharedReply();
+    }
+};
+
+class Bench
+{
+private:
+    typedef boost::chrono::steady_clock Clock;
+    typedef std::vector<std::string> StringVector;
+
+    boost::random::mt19937 rand;
+
+    std::vector<std::size_t> keyNums;
+    std::size_t itemNum, queryNum, funnelSize, prefixNum;
+    std::string itemsFile;
+    StringVector cases;
+
+public:
+    Bench():
+        itemNum(0), queryNum(0), funnelSize(0), prefixNum(0)
+    {}
+
+    // parses options before '--', then initializes Config with those after it.
+    bool init(int argc, char* argv[])
+    {
+        int split = argc;
+        for (int i = 1; i < argc; ++i) {
+            if (std::string(argv[i]) == "--") {
+                split = i;
+                break;
+            }
+        }
+
+        std::string keys, items, queries, funnel, prefixes, what;
+        uint32_t seed;
+        po::options_description desc("taboo-bench options");
+        desc.add_options()
+            ("help,h", "show this help and exit.")
+            ("keys", po::value(&keys)->default_value("1M"),
+                "comma separated num of keys to build tries of, e.g. '1M,10M,50M', default is 1M.")
+            ("items", po::value(&items)->default_value("1M"),
+                "num of items for funnels, filters and replies, default is 1M.")
+            ("queries", po::value(&queries)->default_value("1M"),
+                "num of operations timed by lookup benchmarks, default is 1M.")
+            ("funnel-size", po::value(&funnel)->default_value("64"),
+                "avg num of items per funnel, default is 64.")
+            ("prefixes", po::value(&prefixes)->default_value("8"),
+                "num of prefixes each item is attached to by footprint, default is 8.")
+            ("items-file", po::value(&itemsFile)->default_value(""),
+                "file of real items, one JSON per line, loaded by footprint instead of synthetic ones.")
+            ("cases", po::value(&what)->default_value("trie,farm,filter,query,reply,footprint"),
+                "comma separated benchmarks to run, default is all of them.")
+            ("seed", po::value(&seed)->default_value(20170101),
+                "seed of data generators, default is 20170101.");
+        po::variables_map options;
+        po::store(po::command_line_parser(split, argv).options(desc).run(), options);
+        po::notify(options);
+        if (options.count("help")) {
+            std::cout << "usage: " << argv[0] << " [options] [-- taboo options]" << std::endl << desc;
+            return false;
+        }
+
+        StringVector parts;
+        boost::split(parts, keys, boost::is_any_of(","));
+        for (StringVector::const_iterator it = parts.begin(); it != parts.end(); ++it) {
+            keyNums.push_back(toSize(*it));
+        }
+        itemNum = toSize(items);
+        queryNum = toSize(queries);
+        funnelSize = std::max<std::size_t>(1, toSize(funnel));
+        prefixNum = std::max<std::size_t>(1, toSize(prefixes));
+        boost::split(cases, what, boost::is_any_of(","));
+        rand.seed(seed);
+
+        std::vector<char*> args(1, argv[0]);
+        static char defaultArgs[][32] = {"-c", "etc/taboo.conf"};
+        if (split + 1 < argc) {
+            args.insert(args.end(), argv + split + 1, argv + argc);
+        } else {
+            args.push_back(defaultArgs[0]);
+            args.push_back(defaultArgs[1]);
+        }
+        args.push_back(NULL);
+        return Config::initialize(args.size() - 1, &args[0]) && Aside::initialize();
+    }
+
+    void run()
+    {
+        for (StringVector::const_iterator it = cases.begin(); it != cases.end(); ++it) {
+            if (*it == "trie") {
+                for (std::size_t i = 0; i < keyNums.size(); ++i) {
+                    benchTrie(keyNums[i], false);
+                    benchTrie(keyNums[i], true);
+                }
+            } else if (*it == "farm") {
+                benchFarm();
+            } else if (*it == "filter") {
+                benchFilters();
+            } else if (*it == "query") {
+                benchQuery();
+            } else if (*it == "reply") {
+                benchReply();
+            } else if (*it == "footprint") {
+                benchFootprint();
+            } else {
+                std::cerr << "unknown case '" << *it << "'" << std::endl;
+            }
+        }
+    }
+
+private:
+    // counts funnels yielded, stops after @limit ones, the way a query is bounded by @max-iterations.
+    class CountCallback
+    {
+    public:
+        const std::size_t limit;
+        std::size_t num;
+
+        explicit CountCallback(std::size_t _limit):
+            limit(_limit), num(0)
+        {}
+
+        typedef id_t Hint;
+
+        bool operator()(id_t funnelId, Hint)
+        {
+            return ++num < limit;
+        }
+
+        void prefetch(id_t funnelId) const {}
+
+        Hint locate(id_t funnelId) const
+        {
+            return funnelId;
+        }
+    };
+
+    class AttachCallback
+    {
+    public:
+        void operator()(id_t funnelId) const {}
+    };
+
+    void benchTrie(std::size_t num, bool cjk)
+    {
+        const char* charset = cjk ? "cjk" : "ascii";
+        std::cerr << "generating " << num << " " << charset << " keys" << std::endl;
+        StringVector keys;
+        keys.reserve(num);
+        for (std::size_t i = 0; i < num; ++i) {
+            keys.push_back(cjk ? cjkKey() : asciiKey());
+        }
+
+        Trie trie;
+        KeyList one(1);
+        AttachCallback attachCb;
+        Clock::time_point start = Clock::now();
+        for (StringVector::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+            one.front() = *it;
+            trie.attach(one, attachCb);
+        }
+        report("trie_attach", charset, num, num, start);
+
+        StringVector prefixes;
+        prefixes.reserve(queryNum);
+        for (std::size_t i = 0; i < queryNum; ++i) {
+            const std::string& key = keys[uniform(keys.size())];
+            prefixes.push_back(prefixOf(key, cjk));
+        }
+        uint64_t yielded = 0;
+        start = Clock::now();
+        for (StringVector::const_iterator it = prefixes.begin(); it != prefixes.end(); ++it) {
+            CountCallback cb(Config::instance()->maxIterations);
+            trie.traverse(*it, cb);
+            yielded += cb.num;
+        }
+        report("trie_traverse", charset, num, queryNum, start, "funnels", yielded);
+    }
+
+    void benchFarm()
+    {
+        std::vector<SharedItem> items;
+        makeItems(items);
+        const std::size_t funnelNum = std::max<std::size_t>(1, itemNum / funnelSize);
+        ItemDict itemDict;
+        FunnelDict funnelDict;
+        Farm farm(itemDict, funnelDict);
+
+        std::vector<id_t> funnelIds(items.size());
+        for (std::size_t i = 0; i < funnelIds.size(); ++i) {
+            funnelIds[i] = uniform(funnelNum) + 1;
+        }
+        Clock::time_point start = Clock::now();
+        for (std::size_t i = 0; i < items.size(); ++i) {
+            farm.attach(funnelIds[i], items[i]);
+        }
+        report("farm_attach", "", funnelNum, items.size(), start);
+
+        uint64_t walked = 0;
+        start = Clock::now();
+        for (std::size_t i = 0; i < queryNum; ++i) {
+            const Funnel& funnel = farm.funnel(uniform(funnelNum) + 1);
+            for (Funnel::const_iterator it = funnel.begin(); it != funnel.end(); ++it) {
+                walked += farm.item(it->second)->id != 0;
+            }
+        }
+        report("farm_funnel", "", funnelNum, queryNum, start, "items", walked);
+    }
+
+    void benchFilters()
+    {
+        std::vector<SharedItem> items;
+        makeItems(items);
+        Dom conds;
+        conds.Parse("{\"attr\":\"account\",\"name\":\"name\",\"equal\":7,\"in\":[1,3,5,7,11,13],"
+            "\"min\":100,\"max\":500}");
+        const Value& account = conds["attr"];
+        const Value& name = conds["name"];
+        benchFilter("filter_empty", EmptyFilter::create(), items);
+        benchFilter("filter_equal", EqualFilter::create(account, conds["equal"]), items);
+        benchFilter("filter_unequal", UnequalFilter::create(account, conds["equal"]), items);
+        benchFilter("filter_in", InFilter::create(account, conds["in"]), items);
+        benchFilter("filter_range", RangeFilter::create(account, conds["min"], conds["max"]), items);
+        benchFilter("filter_equal_missing", EqualFilter::create(name, conds["equal"]), items);
+    }
+
+    void benchFilter(const char* bench, const SharedFilter& filter, const std::vector<SharedItem>& items)
+    {
+        uint64_t passed = 0;
+        Clock::time_point start = Clock::now();
+        for (std::size_t i = 0; i < queryNum; ++i) {
+            passed += filter->apply(items[i % items.size()]);
+        }
+        report(bench, "", items.size(), queryNum, start, "passed", passed);
+    }
+
+    void benchQuery()
+    {
+        static const char* const queries[] = {
+            "{\"prefix\":\"hjy\"}",
+            "{\"prefix\":\"hejinyu\",\"num\":20,\"filters\":{\"account\":7}}",
+            "{\"prefix\":\"何金\",\"num\":10,\"filters\":{\"account\":[1,3,5,7]},\"excludes\":[10086,10087],"
+                "\"fields\":[\"id\",\"name\"]}",
+        };
+        const std::size_t kinds = sizeof(queries) / sizeof(queries[0]);
+        std::vector<std::string> strs(queries, queries + kinds);
+        Query query;
+        FilterChain chain;
+        uint64_t ok = 0;
+        Clock::time_point start = Clock::now();
+        for (std::size_t i = 0; i < queryNum; ++i) {
+            ok += query.rebuild(strs[i % kinds]);
+        }
+        report("query_rebuild", "", kinds, queryNum, start, "ok", ok);
+
+        start = Clock::now();
+        for (std::size_t i = 0; i < queryNum; ++i) {
+            query.rebuild(strs[i % kinds]);
+            FilterChain::rebuild(chain, query);
+        }
+        report("query_rebuild_filters", "", kinds, queryNum, start);
+    }
+
+    void benchReply()
+    {
+        std::vector<SharedItem> items;
+        makeItems(items);
+        BenchPredicter predicter;
+        const std::size_t sizes[] = {1, 10, 50};
+        for (std::size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+            SharedItemList list;
+            for (std::size_t i = 0; i < sizes[s] && i < items.size(); ++i) {
+                list.push_back(items[uniform(items.size())]);
+            }
+            uint64_t bytes = 0;
+            Clock::time_point start = Clock::now();
+            for (std::size_t i = 0; i < queryNum; ++i) {
+                bytes += predicter.formReply(list, 0).length();
+            }
+            report("form_reply", "", list.size(), queryNum, start, "bytes", bytes);
+        }
+    }
+
+    // loads items into a shard the way Keeper does, then reports bytes per item of each structure,
+    // as one line per part, @size being the num of items.
+    void benchFootprint()
+    {
+        std::vector<SharedItem> items;
+        if (itemsFile.empty()) {
+            makeItems(items);
+        } else {
+            loadItems(items);
+        }
+        // keys are drawn from a pool, so that funnels hold @funnel-size items on average.
+        const std::size_t keyNum = std::max<std::size_t>(1, items.size() * prefixNum / funnelSize);
+        std::cerr << "generating " << keyNum << " keys" << std::endl;
+        StringVector keys;
+        keys.reserve(keyNum);
+        for (std::size_t i = 0; i < keyNum; ++i) {
+            keys.push_back(i % 3 ? asciiKey() : cjkKey());
+        }
+
+        ShardList shards(1, new Shard(0));
+        Shard& shard = *shards.front();
+        const Footprint before = Footprint::read(shards);
+        Clock::time_point start = Clock::now();
+        for (std::size_t i = 0; i < items.size(); ++i) {
+            KeyList itemKeys;
+            for (std::size_t j = 0; j < prefixNum; ++j) {
+                itemKeys.push_back(keys[uniform(keys.size())]);
+            }
+            FarmCallback cb(shard.farm, items[i]);
+            shard.trie.attach(itemKeys, cb);
+            for (KeyList::const_iterator it = itemKeys.begin(); it != itemKeys.end(); ++it) {
+                shard.index(items[i]->id, *it);
+            }
+        }
+        shard.publish();
+        report("footprint_load", "", items.size(), items.size(), start, "keys", shard.trie.keys());
+        items.clear();  // so that shard holds the only references
+
+        const Footprint after = Footprint::read(shards);
+        const std::size_t num = std::max<std::size_t>(1, after.items);
+        for (int i = 0; i < Footprint::part_num; ++i) {
+            const uint64_t bytes = after.bytes[i] - before.bytes[i];
+            reportBytes(Footprint::nameOf(static_cast<Footprint::Part>(i)), after.items, bytes,
+                static_cast<double>(bytes) / num);
+        }
+        const uint64_t total = after.total() - before.total();
+        reportBytes("total", after.items, total, static_cast<double>(total) / num);
+        delete shards.front();
+    }
+
+    class FarmCallback
+    {
+    private:
+        Farm& farm;
+        const SharedItem& item;
+
+    public:
+        FarmCallback(Farm& _farm, const SharedItem& _item):
+            farm(_farm), item(_item)
+        {}
+
+        void operator()(id_t funnelId) const
+        {
+            farm.attach(funnelId, item);
+        }
+    };
+
+    void loadItems(std::vector<SharedItem>& items)
+    {
+        std::cerr << "loading items from " << itemsFile << std::endl;
+        std::ifstream in(itemsFile.c_str());
+        std::string line;
+        while (std::getline(in, line)) {
+            SharedItem item = makeItem(line.c_str());
+            if (item) {
+                items.push_back(item);
+            }
+        }
+    }
+
+    void makeItems(std::vector<SharedItem>& items)
+    {
+        std::cerr << "generating " << itemNum << " items" << std::endl;
+        const std::string& keyId = Config::instance()->keyId;
+        items.reserve(itemNum);
+        for (std::size_t i = 0; i < itemNum; ++i) {
+            std::ostringstream out;
+            out << "{\"" << keyId << "\":" << (i + 1)
+                << ",\"name\":\"" << (i % 3 ? asciiKey() : cjkKey())
+                << "\",\"account\":" << uniform(1000)
+                << ",\"score\":" << uniform(100000) << "}";
+            SharedItem item = makeItem(out.str().c_str());
+            if (item) {
+                items.push_back(item);
+            }
+        }
+    }
+
+    std::string asciiKey()
+    {
+        std::string key(3 + uniform(10), 'a');
+        for (std::string::iterator it = key.begin(); it != key.end(); ++it) {
+            *it = 'a' + uniform(26);
+        }
+        return key;
+    }
+
+    // CJK unified ideographs, 3 bytes each in UTF-8.
+    std::string cjkKey()
+    {
+        std::string key;
+        for (std::size_t i = 2 + uniform(5); i; --i) {
+            uint32_t code = 0x4e00 + uniform(0x9fa5 - 0x4e00);
+            key += static_cast<char>(0xe0 | (code >> 12));
+            key += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+            key += static_cast<char>(0x80 | (code & 0x3f));
+        }
+        return key;
+    }
+
+    // the first 1 to 3 characters of @key.
+    std::string prefixOf(const std::string& key, bool cjk)
+    {
+        std::size_t chars = 1 + uniform(3), width = cjk ? 3 : 1;
+        return key.substr(0, std::min(key.length(), chars * width));
+    }
+
+    std::size_t uniform(std::size_t num)
+    {
+        return boost::random::uniform_int_distribution<std::size_t>(0, num - 1)(rand);
+    }
+
+    static void report(const char* bench, const char* charset, std::size_t size, uint64_t ops,
+        Clock::time_point start, const char* extraName = NULL, uint64_t extra = 0)
+    {
+        double seconds = boost::chrono::duration<double>(Clock::now() - start).count();
+        std::cout << "{\"bench\":\"" << bench << "\"";
+        if (*charset) {
+            std::cout << ",\"charset\":\"" << charset << "\"";
+        }
+        std::cout << ",\"size\":" << size << ",\"ops\":" << ops << ",\"seconds\":" << seconds
+            << ",\"nsPerOp\":" << (ops ? seconds * 1e9 / ops : 0);
+        if (extraName) {
+            std::cout << ",\"" << extraName << "\":" << extra;
+        }
+        std::cout << "}" << std::endl;
+    }
+
+    static void reportBytes(const char* part, std::size_t items, uint64_t bytes, double perItem)
+    {
+        std::cout << "{\"bench\":\"footprint\",\"part\":\"" << part << "\",\"size\":" << items
+            << ",\"bytes\":" << bytes << ",\"bytesPerItem\":" << perItem << "}" << std::endl;
+    }
+
+    // a num with optional unit K, M or G.
+    static std::size_t toSize(const std::string& str)
+    {
+        std::string num = boost::trim_copy(str);
+        std::size_t unit = 1;
+        if (!num.empty()) {
+            switch (std::toupper(*num.rbegin())) {
+            case 'K': unit = 1 << 10; break;
+            case 'M': unit = 1 << 20; break;
+            case 'G': unit = 1 << 30; break;
+            }
+            if (unit > 1) {
+                num.resize(num.length() - 1);
+            }
+        }
+        return boost::lexical_cast<std::size_t>(num) * unit;
+    }
+};
+
+}
+
+int main(int argc, char* argv[])
+{
+    taboo::Bench bench;
+    if (bench.init(argc, argv)) {
+        bench.run();
+    }
+    return EXIT_SUCCESS;
+}
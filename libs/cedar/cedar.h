@@ -15,6 +15,14 @@
 
 #define STATIC_ASSERT(e, msg) typedef char msg[(e) ? 1 : -1]
 
+// allocation hooks, so that arrays may be placed by a custom allocator.
+#ifndef CEDAR_REALLOC
+#define CEDAR_REALLOC(p, size) std::realloc (p, size)
+#endif
+#ifndef CEDAR_FREE
+#define CEDAR_FREE(p) std::free (p)
+#endif
+
 namespace cedar {
   // typedefs
   typedef unsigned char  uchar;
@@ -267,10 +275,10 @@ namespace cedar {
       clear (false);
       size_ = (size_ - offset) / sizeof (node);
       if (std::fseek (fp, static_cast <long> (offset), SEEK_SET) != 0) return -1;
-      _array = static_cast <node*>  (std::malloc (sizeof (node)  * size_));
+      _array = static_cast <node*>  (CEDAR_REALLOC (0, sizeof (node)  * size_));
 #ifdef USE_FAST_LOAD
-      _ninfo = static_cast <ninfo*> (std::malloc (sizeof (ninfo) * size_));
-      _block = static_cast <block*> (std::malloc (sizeof (block) * size_));
+      _ninfo = static_cast <ninfo*> (CEDAR_REALLOC (0, sizeof (ninfo) * size_));
+      _block = static_cast <block*> (CEDAR_REALLOC (0, sizeof (block) * size_));
       if (! _array || ! _ninfo || ! _block)
 #else
         if (! _array)
@@ -311,9 +319,9 @@ namespace cedar {
     }
     const void* array () const { return _array; }
     void clear (const bool reuse = true) {
-      if (_array && ! _no_delete) std::free (_array); _array = 0;
-      if (_ninfo) std::free (_ninfo); _ninfo = 0;
-      if (_block) std::free (_block); _block = 0;
+      if (_array && ! _no_delete) CEDAR_FREE (_array); _array = 0;
+      if (_ninfo) CEDAR_FREE (_ninfo); _ninfo = 0;
+      if (_block) CEDAR_FREE (_block); _block = 0;
       _bheadF = _bheadC = _bheadO = _capacity = _size = 0; // *
       if (reuse) _initialize ();
       _no_delete = false;
@@ -381,9 +389,9 @@ namespace cedar {
     { std::fprintf (stderr, "cedar: %s [%d]: %s", fn, ln, msg); std::exit (1); }
     template <typename T>
     static void _realloc_array (T*& p, const int size_n, const int size_p = 0) {
-      void* tmp = std::realloc (p, sizeof (T) * static_cast <size_t> (size_n));
+      void* tmp = CEDAR_REALLOC (p, sizeof (T) * static_cast <size_t> (size_n));
       if (! tmp)
-        std::free (p), _err (__FILE__, __LINE__, "memory reallocation failed\n");
+        CEDAR_FREE (p), _err (__FILE__, __LINE__, "memory reallocation failed\n");
       p = static_cast <T*> (tmp);
       static const T T0 = T ();
       for (T* q (p + size_p), * const r (p + size_n); q != r; ++q) *q = T0;
@@ -0,0 +1,741 @@
+
+// load generator for a running taboo, queries over websocket (query port) or http (/query/predict of
+// manage port), optionally mixed with attaches to the manage port.
+// it's open-loop: requests are due at a fixed rate no matter how fast replies come, and latency is
+// measured from when a request was due, not when it could be sent, so a stalled server shows up
+// in latency instead of quietly lowering the load (no coordinated omission).
+// queries are replayed from a file (one query JSON per line, or a query capture log of taboo),
+// or synthesized: prefixes of keys whose popularity follows a Zipf distribution.
+// NOTE: attaches are not signed, the target should run with @check-signature off.
+
+#include "predef.hpp"
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/chrono.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/program_options.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+#include <boost/random/uniform_real_distribution.hpp>
+#include <boost/thread/thread.hpp>
+#include <websocketpp/config/asio_no_tls_client.hpp>
+#include <websocketpp/client.hpp>
+#include "Latency.hpp"
+
+namespace po = boost::program_options;
+namespace asio = boost::asio;
+
+namespace taboo {
+namespace loadgen {
+
+typedef boost::chrono::steady_clock Clock;
+typedef websocketpp::client<websocketpp::config::asio_client> WsClient;
+typedef boost::random::mt19937 RandGenerator;
+
+class Options
+{
+public:
+    std::string host, protocol, replayFile, filters;
+    uint16_t queryPort, managePort;
+    std::size_t connections, manageConnections, threads, keys, prefixMin, prefixMax, num;
+    double rate, duration, zipfExponent, attachRatio, drain;
+    uint32_t seed;
+    bool json;
+
+    bool parse(int argc, char* argv[])
+    {
+        po::options_description desc("taboo-loadgen options");
+        desc.add_options()
+            ("help,h", "show this help and exit.")
+            ("host", po::value(&host)->default_value("127.0.0.1"), "host of taboo, default is 127.0.0.1.")
+            ("query-port", po::value(&queryPort)->default_value(1080), "websocket port, default is 1080.")
+            ("manage-port", po::value(&managePort)->default_value(1079), "http port, default is 1079.")
+            ("protocol", po::value(&protocol)->default_value("ws"),
+                "'ws' queries the query port over websocket, 'http' queries /query/predict of "
+                "the manage port, default is 'ws'.")
+            ("connections", po::value(&connections)->default_value(64),
+                "num of query connections, default is 64.")
+            ("manage-connections", po::value(&manageConnections)->default_value(4),
+                "num of http connections for attaches, default is 4.")
+            ("threads", po::value(&threads)->default_value(2), "num of io threads, default is 2.")
+            ("rate", po::value(&rate)->default_value(1000), "requests per second in total, default is 1000.")
+            ("duration", po::value(&duration)->default_value(10), "seconds to send requests, default is 10.")
+            ("drain", po::value(&drain)->default_value(2),
+                "seconds to wait for replies after sending stopped, default is 2.")
+            ("replay", po::value(&replayFile)->default_value(""),
+                "file of queries to replay in turn, one JSON per line, or a query capture log of taboo, "
+                "default is none (synthesized).")
+            ("keys", po::value(&keys)->default_value(100000),
+                "num of distinct keys of synthesized queries, default is 100000.")
+            ("zipf", po::value(&zipfExponent)->default_value(1.0),
+                "exponent of Zipf distribution of key popularity, 0 is uniform, default is 1.0.")
+            ("prefix-min", po::value(&prefixMin)->default_value(2), "min length of prefixes, default is 2.")
+            ("prefix-max", po::value(&prefixMax)->default_value(6), "max length of prefixes, default is 6.")
+            ("num", po::value(&num)->default_value(10), "num of items per query, default is 10.")
+            ("filters", po::value(&filters)->default_value(""),
+                "filters JSON added to synthesized queries, default is none.")
+            ("attach-ratio", po::value(&attachRatio)->default_value(0),
+                "fraction of requests being attaches to the manage port, default is 0.")
+            ("seed", po::value(&seed)->default_value(20170101), "seed of generators, default is 20170101.")
+            ("json", po::bool_switch(&json)->default_value(false),
+                "report as one JSON object instead of text, default is no.");
+        po::variables_map options;
+        po::store(po::parse_command_line(argc, argv, desc), options);
+        po::notify(options);
+        if (options.count("help")) {
+            std::cout << "usage: " << argv[0] << " [options]" << std::endl << desc;
+            return false;
+        }
+        if (protocol != "ws" && protocol != "http") {
+            std::cerr << "error: --protocol must be 'ws' or 'http'" << std::endl;
+            return false;
+        }
+        if (rate <= 0 || duration <= 0 || connections == 0 || threads == 0
+            || prefixMin == 0 || prefixMax < prefixMin) {
+            std::cerr << "error: bad --rate, --duration, --connections, --threads or --prefix-*" << std::endl;
+            return false;
+        }
+        threads = std::min(threads, connections);
+        return true;
+    }
+};
+
+// what to send, shared by workers, read only once built.
+class Workload
+{
+private:
+    const Options& options;
+    std::vector<std::string> replays;
+    std::vector<std::string> keys;
+    std::vector<double> cdf;    // of key ranks
+
+public:
+    explicit Workload(const Options& _options):
+        options(_options)
+    {}
+
+    bool build()
+    {
+        if (!options.replayFile.empty()) {
+            std::ifstream in(options.replayFile.c_str(), std::ios::binary);
+            char magic[4] = {};
+            in.read(magic, sizeof(magic));
+            if (in && std::memcmp(magic, "TBQC", sizeof(magic)) == 0) {
+                readCapture(in);
+            } else {
+                in.clear();
+                in.seekg(0);
+                std::string line;
+                while (std::getline(in, line)) {
+                    if (!line.empty()) {
+                        replays.push_back(line);
+                    }
+                }
+            }
+            if (replays.empty()) {
+                std::cerr << "error: no query in " << options.replayFile << std::endl;
+                return false;
+            }
+            return true;
+        }
+        RandGenerator rand(options.seed);
+        keys.reserve(options.keys);
+        cdf.reserve(options.keys);
+        double total = 0;
+        for (std::size_t i = 0; i < options.keys; ++i) {
+            std::string key(options.prefixMax, 'a');
+            for (std::string::iterator it = key.begin(); it != key.end(); ++it) {
+                *it = 'a' + boost::random::uniform_int_distribution<int>(0, 25)(rand);
+            }
+            keys.push_back(key);
+            total += 1 / std::pow(i + 1.0, options.zipfExponent);
+            cdf.push_back(total);
+        }
+        for (std::vector<double>::iterator it = cdf.begin(); it != cdf.end(); ++it) {
+            *it /= total;
+        }
+        return !keys.empty();
+    }
+
+    // @seq is the sequence of the request, so that replays go in turn across workers.
+    std::string query(uint64_t seq, RandGenerator& rand) const
+    {
+        if (!replays.empty()) {
+            return replays[seq % replays.size()];
+        }
+        const std::string& key = keys[rankOf(rand)];
+        std::size_t length = boost::random::uniform_int_distribution<std::size_t>(
+            options.prefixMin, options.prefixMax)(rand);
+        std::ostringstream out;
+        out << "{\"prefix\":\"" << key.substr(0, length) << "\",\"num\":" << options.num;
+        if (!options.filters.empty()) {
+            out << ",\"filters\":" << options.filters;
+        }
+        out << "}";
+        return out.str();
+    }
+
+    // an item attached to a popular key, ids are drawn from a range 10 times of keys.
+    std::string attach(RandGenerator& rand) const
+    {
+        std::size_t rank = keys.empty() ? 0 : rankOf(rand);
+        std::string key = keys.empty() ? "loadgen" : keys[rank];
+        uint32_t id = boost::random::uniform_int_distribution<uint32_t>(1, 10 * (options.keys + 1))(rand);
+        std::ostringstream out;
+        out << "/manage/attach?upsert=1&prefixes=" << urlEncode("[\"" + key.substr(0, options.prefixMax) + "\"]")
+            << "&item=" << urlEncode("{\"id\":" + boost::lexical_cast<std::string>(id)
+                + ",\"name\":\"" + key + "\",\"rank\":" + boost::lexical_cast<std::string>(rank) + "}");
+        return out.str();
+    }
+
+    static std::string urlEncode(const std::string& str)
+    {
+        static const char hex[] = "0123456789ABCDEF";
+        std::string res;
+        res.reserve(str.length() * 3);
+        for (std::string::const_iterator it = str.begin(); it != str.end(); ++it) {
+            unsigned char chr = *it;
+            if (std::isalnum(chr) || chr == '-' || chr == '_' || chr == '.' || chr == '~') {
+                res += chr;
+            } else {
+                res += '%';
+                res += hex[chr >> 4];
+                res += hex[chr & 15];
+            }
+        }
+        return res;
+    }
+
+private:
+    // a query capture log of taboo (@query-capture-log), see QueryCapture.hpp for its layout.
+    // filters are only kept as fingerprints, so captured queries are replayed without them.
+    void readCapture(std::istream& in)
+    {
+        uint32_t version = 0;
+        in.read(reinterpret_cast<char*>(&version), sizeof(version));
+        if (version != 1) {
+            std::cerr << "error: unknown version " << version << " of query capture" << std::endl;
+            return;
+        }
+        while (true) {
+            uint32_t numbers[4];    // time, micros, results, num
+            uint64_t filters;
+            uint8_t flags, length;
+            char prefix[256], fields[256];
+            in.read(reinterpret_cast<char*>(numbers), sizeof(numbers));
+            in.read(reinterpret_cast<char*>(&filters), sizeof(filters));
+            in.read(reinterpret_cast<char*>(&flags), sizeof(flags));
+            in.read(reinterpret_cast<char*>(&length), sizeof(length));
+            in.read(prefix, length);
+            std::string prefixStr(prefix, length);
+            in.read(reinterpret_cast<char*>(&length), sizeof(length));
+            in.read(fields, length);
+            std::string fieldsStr(fields, length);
+            if (!in) {
+                break;
+            }
+            std::ostringstream out;
+            out << "{\"prefix\":\"" << jsonEscape(prefixStr) << "\",\"num\":" << numbers[3];
+            if (fieldsStr != "*") {
+                out << ",\"fields\":[";
+                std::size_t begin = 0;
+                for (std::size_t end; (end = fieldsStr.find(',', begin)) != std::string::npos; begin = end + 1) {
+                    out << (begin ? ",\"" : "\"") << jsonEscape(fieldsStr.substr(begin, end - begin)) << "\"";
+                }
+                out << "]";
+            }
+            out << "}";
+            replays.push_back(out.str());
+        }
+    }
+
+    static std::string jsonEscape(const std::string& str)
+    {
+        std::string res;
+        res.reserve(str.length());
+        for (std::string::const_iterator it = str.begin(); it != str.end(); ++it) {
+            if (*it == '"' || *it == '\\') {
+                res += '\\';
+            }
+            res += *it;
+        }
+        return res;
+    }
+
+    std::size_t rankOf(RandGenerator& rand) const
+    {
+        double point = boost::random::uniform_real_distribution<double>(0, 1)(rand);
+        return std::min<std::size_t>(std::lower_bound(cdf.begin(), cdf.end(), point) - cdf.begin(),
+            cdf.size() - 1);
+    }
+};
+
+// of a worker, latencies in microseconds.
+class Stats
+{
+public:
+    Histogram queries, attaches;
+    uint64_t sent, failed;
+
+    Stats():
+        sent(0), failed(0)
+    {}
+
+    void merge(const Stats& other)
+    {
+        queries.merge(other.queries);
+        attaches.merge(other.attaches);
+        sent += other.sent;
+        failed += other.failed;
+    }
+};
+
+inline uint64_t microsSince(Clock::time_point since)
+{
+    return boost::chrono::duration_cast<boost::chrono::microseconds>(Clock::now() - since).count();
+}
+
+class Channel
+{
+protected:
+    Stats& stats;
+    Histogram& histogram;
+    std::deque<Clock::time_point> inflight;     // due times of requests sent, replied in order
+    bool broken;
+
+public:
+    Channel(Stats& _stats, Histogram& _histogram):
+        stats(_stats), histogram(_histogram), broken(false)
+    {}
+
+    virtual void send(const std::string& payload, Clock::time_point due) = 0;
+
+    std::size_t pending() const
+    {
+        return inflight.size();
+    }
+
+    virtual ~Channel() {}
+
+protected:
+    void replied()
+    {
+        if (!inflight.empty()) {
+            histogram.record(microsSince(inflight.front()));
+            inflight.pop_front();
+        }
+    }
+
+    void fail()
+    {
+        broken = true;
+        stats.failed += inflight.size();
+        inflight.clear();
+    }
+};
+
+// messages are pipelined, the server replies them in order.
+class WsChannel:
+    public Channel
+{
+private:
+    WsClient& client;
+    websocketpp::connection_hdl hdl;
+    bool opened;
+    std::deque<std::string> waiting;    // sent once opened
+
+public:
+    WsChannel(WsClient& _client, const std::string& uri, Stats& _stats):
+        Channel(_stats, _stats.queries), client(_client), opened(false)
+    {
+        websocketpp::lib::error_code ec;
+        WsClient::connection_ptr con = client.get_connection(uri, ec);
+        if (ec) {
+            broken = true;
+            return;
+        }
+        con->set_open_handler(boost::bind(&WsChannel::onOpen, this, _1));
+        con->set_message_handler(boost::bind(&WsChannel::onMessage, this, _1, _2));
+        con->set_fail_handler(boost::bind(&WsChannel::onFail, this, _1));
+        con->set_close_handler(boost::bind(&WsChannel::onFail, this, _1));
+        hdl = con->get_handle();
+        client.connect(con);
+    }
+
+    virtual void send(const std::string& payload, Clock::time_point due)
+    {
+        ++stats.sent;
+        if (broken) {
+            ++stats.failed;
+            return;
+        }
+        inflight.push_back(due);
+        if (!opened) {
+            waiting.push_back(payload);
+            return;
+        }
+        write(payload);
+    }
+
+private:
+    void write(const std::string& payload)
+    {
+        websocketpp::lib::error_code ec;
+        client.send(hdl, payload, websocketpp::frame::opcode::text, ec);
+        if (ec) {
+            fail();
+        }
+    }
+
+    void onOpen(websocketpp::connection_hdl)
+    {
+        opened = true;
+        for (; !waiting.empty() && !broken; waiting.pop_front()) {
+            write(waiting.front());
+        }
+    }
+
+    void onMessage(websocketpp::connection_hdl, WsClient::message_ptr)
+    {
+        replied();
+    }
+
+    void onFail(websocketpp::connection_hdl)
+    {
+        waiting.clear();
+        fail();
+    }
+};
+
+// http/1.1 keep-alive, one request on the wire at a time, the rest wait in queue (counted from due).
+class HttpChannel:
+    public Channel
+{
+private:
+    asio::ip::tcp::socket socket;
+    const std::string host;
+    std::deque<std::string> waiting;
+    std::string request;
+    asio::streambuf response;
+    bool connected, busy;
+
+public:
+    HttpChannel(asio::io_service& io, const asio::ip::tcp::endpoint& endpoint, const std::string& _host,
+        Stats& _stats, Histogram& _histogram):
+        Channel(_stats, _histogram), socket(io), host(_host), connected(false), busy(false)
+    {
+        socket.async_connect(endpoint, boost::bind(&HttpChannel::onConnect, this, asio::placeholders::error));
+    }
+
+    // @payload is path with query string.
+    virtual void send(const std::string& payload, Clock::time_point due)
+    {
+        ++stats.sent;
+        if (broken) {
+            ++stats.failed;
+            return;
+        }
+        inflight.push_back(due);
+        waiting.push_back(payload);
+        next();
+    }
+
+private:
+    void next()
+    {
+        if (!connected || busy || waiting.empty() || broken) {
+            return;
+        }
+        busy = true;
+        request = "GET " + waiting.front() + " HTTP/1.1\r\nHost: " + host + "\r\n\r\n";
+        waiting.pop_front();
+        asio::async_write(socket, asio::buffer(request),
+            boost::bind(&HttpChannel::onWrite, this, asio::placeholders::error));
+    }
+
+    void onConnect(const boost::system::error_code& ec)
+    {
+        if (ec) {
+            return onError();
+        }
+        connected = true;
+        next();
+    }
+
+    void onWrite(const boost::system::error_code& ec)
+    {
+        if (ec) {
+            return onError();
+        }
+        asio::async_read_until(socket, response, "\r\n\r\n",
+            boost::bind(&HttpChannel::onHeader, this, asio::placeholders::error, asio::placeholders::bytes_transferred));
+    }
+
+    void onHeader(const boost::system::error_code& ec, std::size_t headerSize)
+    {
+        if (ec) {
+            return onError();
+        }
+        std::string header(asio::buffers_begin(response.data()),
+            asio::buffers_begin(response.data()) + headerSize);
+        response.consume(headerSize);
+        std::size_t length = 0;
+        std::size_t pos = header.find("Content-Length:");
+        if (pos == std::string::npos) {
+            pos = header.find("content-length:");
+        }
+        if (pos != std::string::npos) {
+            length = std::strtoul(header.c_str() + pos + std::strlen("Content-Length:"), NULL, 10);
+        }
+        std::size_t buffered = std::min(length, response.size());
+        response.consume(buffered);
+        if (buffered == length) {
+            return onBody(boost::system::error_code());
+        }
+        asio::async_read(socket, response, asio::transfer_exactly(length - buffered),
+            boost::bind(&HttpChannel::onBodyRead, this, asio::placeholders::error, length - buffered));
+    }
+
+    void onBodyRead(const boost::system::error_code& ec, std::size_t length)
+    {
+        response.consume(length);
+        onBody(ec);
+    }
+
+    void onBody(const boost::system::error_code& ec)
+    {
+        if (ec) {
+            return onError();
+        }
+        busy = false;
+        replied();
+        next();
+    }
+
+    void onError()
+    {
+        waiting.clear();
+        fail();
+    }
+};
+
+// sends its share of the rate over its own connections, in its own io thread.
+class Worker
+{
+private:
+    const Options& options;
+    const Workload& workload;
+    const std::size_t no;
+
+    asio::io_service io;
+    WsClient client;
+    asio::steady_timer timer;
+    RandGenerator rand;
+
+    boost::ptr_vector<Channel> queryChannels, manageChannels;
+    std::size_t queryCursor, manageCursor;
+
+    Clock::time_point start, stop;
+    boost::chrono::nanoseconds interval;
+    uint64_t seq;
+
+public:
+    Stats stats;
+
+    Worker(const Options& _options, const Workload& _workload, std::size_t _no):
+        options(_options), workload(_workload), no(_no), timer(io), rand(_options.seed + _no),
+        queryCursor(0), manageCursor(0), seq(0)
+    {}
+
+    void run(Clock::time_point _start)
+    {
+        connect();
+        start = _start;
+        stop = start + boost::chrono::duration_cast<Clock::duration>(
+            boost::chrono::duration<double>(options.duration));
+        interval = boost::chrono::nanoseconds(static_cast<int64_t>(1e9 * options.threads / options.rate));
+        // workers interleave, so that the total is evenly spaced.
+        start += boost::chrono::nanoseconds(interval.count() * no / options.threads);
+        schedule(start);
+        io.run();
+    }
+
+private:
+    void connect()
+    {
+        const std::size_t queryNum = share(options.connections);
+        const std::size_t manageNum = options.attachRatio > 0 ? std::max<std::size_t>(1, share(options.manageConnections)) : 0;
+        asio::ip::tcp::endpoint manage(asio::ip::address::from_string(options.host), options.managePort);
+        if (options.protocol == "ws") {
+            client.clear_access_channels(websocketpp::log::alevel::all);
+            client.clear_error_channels(websocketpp::log::elevel::all);
+            client.init_asio(&io);
+            const std::string uri = "ws://" + options.host + ":" + boost::lexical_cast<std::string>(options.queryPort);
+            for (std::size_t i = 0; i < queryNum; ++i) {
+                queryChannels.push_back(new WsChannel(client, uri, stats));
+            }
+        } else {
+            for (std::size_t i = 0; i < queryNum; ++i) {
+                queryChannels.push_back(new HttpChannel(io, manage, options.host, stats, stats.queries));
+            }
+        }
+        for (std::size_t i = 0; i < manageNum; ++i) {
+            manageChannels.push_back(new HttpChannel(io, manage, options.host, stats, stats.attaches));
+        }
+    }
+
+    // connections of this worker out of @total.
+    std::size_t share(std::size_t total) const
+    {
+        return total / options.threads + (no < total % options.threads);
+    }
+
+    void schedule(Clock::time_point at)
+    {
+        timer.expires_at(at);
+        timer.async_wait(boost::bind(&Worker::tick, this, asio::placeholders::error));
+    }
+
+    // sends every request due by now, each stamped with when it was due.
+    void tick(const boost::system::error_code& ec)
+    {
+        if (ec) {
+            return;
+        }
+        Clock::time_point now = Clock::now();
+        Clock::time_point due = start + interval * seq;
+        for (; due <= now && due < stop; due = start + interval * ++seq) {
+            dispatch(due);
+        }
+        if (due < stop) {
+            schedule(due);
+            return;
+        }
+        drain(now + boost::chrono::duration_cast<Clock::duration>(boost::chrono::duration<double>(options.drain)));
+    }
+
+    void dispatch(Clock::time_point due)
+    {
+        if (!manageChannels.empty()
+            && boost::random::uniform_real_distribution<double>(0, 1)(rand) < options.attachRatio) {
+            manageChannels[manageCursor++ % manageChannels.size()].send(workload.attach(rand), due);
+            return;
+        }
+        const std::string query = workload.query(seq * options.threads + no, rand);
+        Channel& channel = queryChannels[queryCursor++ % queryChannels.size()];
+        if (options.protocol == "ws") {
+            channel.send(query, due);
+        } else {
+            channel.send("/query/predict?data=" + Workload::urlEncode(query), due);
+        }
+    }
+
+    // waits until all replied or @deadline, what's left unreplied is counted as failed.
+    void drain(Clock::time_point deadline)
+    {
+        std::size_t pending = 0;
+        for (std::size_t i = 0; i < queryChannels.size(); ++i) {
+            pending += queryChannels[i].pending();
+        }
+        for (std::size_t i = 0; i < manageChannels.size(); ++i) {
+            pending += manageChannels[i].pending();
+        }
+        if (pending && Clock::now() < deadline) {
+            timer.expires_from_now(boost::chrono::milliseconds(10));
+            timer.async_wait(boost::bind(&Worker::drain, this, deadline));
+            return;
+        }
+        stats.failed += pending;
+        io.stop();
+    }
+};
+
+void reportText(const Options& options, const Stats& stats, double seconds)
+{
+    static const double quantiles[] = {0.5, 0.75, 0.9, 0.99, 0.999, 0.9999, 1};
+    uint64_t replied = stats.queries.total() + stats.attaches.total();
+    std::cout << "sent " << stats.sent << ", replied " << replied << ", failed " << stats.failed
+        << " in " << seconds << "s, " << replied / seconds << " replies/s (target " << options.rate << "/s)"
+        << std::endl;
+    const Histogram* histograms[] = {&stats.queries, &stats.attaches};
+    const char* names[] = {"query", "attach"};
+    for (std::size_t h = 0; h < 2; ++h) {
+        if (histograms[h]->total() == 0) {
+            continue;
+        }
+        std::cout << names[h] << " latency (ms), " << histograms[h]->total() << " replies:" << std::endl;
+        for (std::size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); ++i) {
+            std::cout << "  p" << quantiles[i] * 100 << "\t" << histograms[h]->quantile(quantiles[i]) / 1000.0
+                << std::endl;
+        }
+    }
+}
+
+void reportJson(const Options& options, const Stats& stats, double seconds)
+{
+    static const double quantiles[] = {0.5, 0.75, 0.9, 0.99, 0.999, 0.9999, 1};
+    static const char* const quantileNames[] = {"p50", "p75", "p90", "p99", "p999", "p9999", "max"};
+    uint64_t replied = stats.queries.total() + stats.attaches.total();
+    std::cout << "{\"rate\":" << options.rate << ",\"seconds\":" << seconds << ",\"sent\":" << stats.sent
+        << ",\"replied\":" << replied << ",\"failed\":" << stats.failed << ",\"throughput\":" << replied / seconds;
+    const Histogram* histograms[] = {&stats.queries, &stats.attaches};
+    const char* names[] = {"query", "attach"};
+    for (std::size_t h = 0; h < 2; ++h) {
+        std::cout << ",\"" << names[h] << "\":{\"count\":" << histograms[h]->total();
+        for (std::size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); ++i) {
+            std::cout << ",\"" << quantileNames[i] << "Ms\":" << histograms[h]->quantile(quantiles[i]) / 1000.0;
+        }
+        std::cout << "}";
+    }
+    std::cout << "}" << std::endl;
+}
+
+}
+}
+
+int main(int argc, char* argv[])
+{
+    using namespace taboo::loadgen;
+    Options options;
+    if (!options.parse(argc, argv)) {
+        return EXIT_FAILURE;
+    }
+    Workload workload(options);
+    if (!workload.build()) {
+        return EXIT_FAILURE;
+    }
+
+    boost::ptr_vector<Worker> workers;
+    boost::thread_group threads;
+    Clock::time_point start = Clock::now() + boost::chrono::milliseconds(200);  // time to connect
+    for (std::size_t i = 0; i < options.threads; ++i) {
+        workers.push_back(new Worker(options, workload, i));
+        threads.create_thread(boost::bind(&Worker::run, &workers.back(), start));
+    }
+    threads.join_all();
+    double seconds = boost::chrono::duration<double>(Clock::now() - start).count();
+
+    Stats stats;
+    for (std::size_t i = 0; i < workers.size(); ++i) {
+        stats.merge(workers[i].stats);
+    }
+    if (options.json) {
+        reportJson(options, stats, seconds);
+    } else {
+        reportText(options, stats, seconds);
+    }
+    return stats.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
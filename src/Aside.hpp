@@ -12,6 +12,9 @@
 #include "predef.hpp"
 #include "Item.hpp"
 #include "Trie.hpp"
+#include "Shard.hpp"
+#include "Memory.hpp"
+#include "Lock.hpp"
 
 extern int main(int, char*[]);
 
@@ -19,9 +22,6 @@ namespace taboo {
 
 class Portal;
 
-typedef boost::shared_lock<boost::shared_mutex> ReadLock;
-typedef boost::unique_lock<boost::shared_mutex> WriteLock;
-
 class ValuePtrHasher
 {
 public:
@@ -59,29 +59,36 @@ private:
     const Config* config;
 
 public:
-    const std::string keyMUKey, keyMUSign, keyMUPrefixes, keyMUItem, keyMUUpsert;
+    const std::string keyMUKey, keyMUSign, keyMUPrefixes, keyMUItem, keyMUUpsert, keyMUTtl;
     const Value keyMDErrCode, keyMDErrDesc, keyMDPayload, keyMDToken, keyMDTokenExpire,
-        keyId, keyQEchoData,
+        keyId, keyScore, keyExpire, keyQEchoData,
         keyQUPayload, keyQUToken, keyQUPrefix, keyQUFilters, keyQUExcludes, keyQUFields, keyQUNum,
         keyQDErrCode, keyQDErrDesc, keyQDPayload;
 
     ValuePtrSet queryVisibleFields, queryInvisibleFields;
     bool queryVisibleAll;
 
-    ItemDict itemDict;
-    FunnelDict funnelDict;
-
-    Farm farm;
-
-    Trie trie;
+    ShardList shards;
 
-    boost::shared_mutex accessMutex;;
+    const std::time_t startTime;
 
     static Aside* instance()
     {
         return _instance;
     }
 
+    Shard& shard(id_t id) const
+    {
+        return *shards[shardOf(id)];
+    }
+
+    // fibonacci hashing, so that ids in arithmetic progression still spread evenly.
+    std::size_t shardOf(id_t id) const
+    {
+        return static_cast<std::size_t>((static_cast<uint64_t>(id) * 0x9E3779B97F4A7C15ULL) >> 32)
+            % shards.size();
+    }
+
 private:
     static Aside* _instance;
 
@@ -92,6 +99,7 @@ private:
         keyMUPrefixes(config->keyMUPrefixes),
         keyMUItem(config->keyMUItem),
         keyMUUpsert(config->keyMUUpsert),
+        keyMUTtl(config->keyMUTtl),
 
         keyMDErrCode(config->keyMDErrCode.data(), config->keyMDErrCode.length()),
         keyMDErrDesc(config->keyMDErrDesc.data(), config->keyMDErrDesc.length()),
@@ -100,6 +108,8 @@ private:
         keyMDTokenExpire(config->keyMDTokenExpire.data(), config->keyMDTokenExpire.length()),
 
         keyId(config->keyId.data(), config->keyId.length()),
+        keyScore(config->keyScore.data(), config->keyScore.length()),
+        keyExpire(config->keyExpire.data(), config->keyExpire.length()),
         keyQEchoData(config->keyQEchoData.data(), config->keyQEchoData.length()),
 
         keyQUPayload(config->keyQUPayload.data(), config->keyQUPayload.length()),
@@ -115,8 +125,11 @@ private:
         keyQDPayload(config->keyQDPayload.data(), config->keyQDPayload.length()),
 
         queryVisibleAll(config->queryVisibleAll),
-        farm(itemDict, funnelDict)
+        startTime(std::time(NULL))
     {
+        for (std::size_t i = 0; i < config->indexShards; ++i) {
+            shards.push_back(new Shard(i));
+        }
         if (!queryVisibleAll) {
             if (!config->queryVisibleFields.empty() &&
                 !(config->queryVisibleFields.size() == 1 && *config->queryVisibleFields.begin() == "*")) {
@@ -135,8 +148,11 @@ private:
     }
 
     friend class Portal;
+    friend class Bench;
     static bool initialize()
     {
+        // must be configured before trie and dicts allocate anything.
+        HugePages::configure(Config::instance()->trieHugePages, Config::instance()->memlock);
         _instance = new Aside;
         return _instance->_initialize();
     }
@@ -11,6 +11,7 @@ extern "C" {
 #   include <microhttpd.h>
 }
 #include "Config.hpp"
+#include "Latency.hpp"
 
 namespace taboo {
 
@@ -25,17 +26,18 @@ class Reply
 public:
     std::string content;
     MemMode memMode;
+    const char* contentType;
 
     explicit Reply(const std::string& _content):
-        content(_content), memMode(mem_mode_must_copy)
+        content(_content), memMode(mem_mode_must_copy), contentType("application/json")
     {}
 
     explicit Reply(MemMode _memMode):
-        memMode(mem_mode_must_copy)
+        memMode(mem_mode_must_copy), contentType("application/json")
     {}
 
     Reply(const std::string& _content, MemMode _memMode):
-        content(_content), memMode(_memMode)
+        content(_content), memMode(_memMode), contentType("application/json")
     {}
 };
 
@@ -138,6 +140,12 @@ public:
 
     virtual SharedReply process() = 0;
 
+    // histogram process() is timed into.
+    virtual Latency::Metric metric() const
+    {
+        return Latency::metric_manage_other;
+    }
+
     virtual ~BaseHandler() {}
 
 protected:
@@ -0,0 +1,340 @@
+
+#include "Cluster.hpp"
+#include <cctype>
+#include <boost/bind.hpp>
+#include <boost/asio/placeholders.hpp>
+#include <boost/asio/buffers_iterator.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <glog/logging.h>
+
+namespace taboo
+{
+
+namespace
+{
+
+using boost::asio::ip::tcp;
+
+std::string urlEncode(const std::string& str)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    std::string res;
+    res.reserve(str.length() * 3);
+    for (std::string::const_iterator it = str.begin(); it != str.end(); ++it) {
+        unsigned char c = *it;
+        if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+            res += c;
+        } else {
+            res += '%';
+            res += hex[c >> 4];
+            res += hex[c & 0xf];
+        }
+    }
+    return res;
+}
+
+// replies of a scatter(), each backend delivers exactly once.
+class Gather
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable done;
+    std::size_t remain;
+    Cluster::ReplyList& replies;
+
+public:
+    explicit Gather(Cluster::ReplyList& _replies):
+        remain(_replies.size()), replies(_replies)
+    {}
+
+    void deliver(std::size_t i, std::string& body)
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        replies[i].swap(body);
+        if (--remain == 0) {
+            done.notify_one();
+        }
+    }
+
+    void wait()
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        while (remain) {
+            done.wait(lock);
+        }
+    }
+};
+
+class Exchange;
+
+// asks a backend, on one or more of its replicas, until a reply or the deadline.
+// all handlers of a call and its exchanges run in its strand.
+class Call:
+    public boost::enable_shared_from_this<Call>
+{
+public:
+    boost::asio::io_service& service;
+    boost::asio::io_service::strand strand;
+    // shared by calls of a scatter(), outlives it as long as any exchange is in flight.
+    const boost::shared_ptr<const std::string> request;
+
+private:
+    const Cluster::Replicas& replicas;
+    const boost::posix_time::time_duration hedgeDelay;
+    boost::asio::deadline_timer deadline, hedger;
+
+    Gather* gather;
+    const std::size_t index;
+
+    std::vector<boost::shared_ptr<Exchange> > exchanges;
+    std::size_t failed;
+
+public:
+    Call(boost::asio::io_service& _service, const boost::shared_ptr<const std::string>& _request, const Cluster::Replicas& _replicas,
+        const boost::posix_time::time_duration& timeout, const boost::posix_time::time_duration& _hedgeDelay,
+        Gather* _gather, std::size_t _index):
+        service(_service), strand(_service), request(_request), replicas(_replicas),
+        hedgeDelay(_hedgeDelay), deadline(_service, timeout), hedger(_service),
+        gather(_gather), index(_index), failed(0)
+    {}
+
+    // timers are armed in the strand too, finish() may cancel them as soon as the first exchange starts.
+    void start()
+    {
+        strand.dispatch(boost::bind(&Call::begin, shared_from_this()));
+    }
+
+    // by an exchange, @body is empty if it failed.
+    void onReply(std::string& body)
+    {
+        if (gather == NULL) {
+            return;
+        }
+        if (!body.empty()) {
+            finish(body);
+        } else if (++failed == exchanges.size()) {
+            if (exchanges.size() < replicas.size()) {
+                launch();   // fails over to the next replica at once.
+            } else {
+                finish(body);
+            }
+        }
+    }
+
+private:
+    void begin()
+    {
+        deadline.async_wait(strand.wrap(boost::bind(&Call::onDeadline, shared_from_this(),
+            boost::asio::placeholders::error)));
+        if (hedgeDelay.total_milliseconds() > 0) {
+            hedger.expires_from_now(hedgeDelay);
+            hedger.async_wait(strand.wrap(boost::bind(&Call::onHedge, shared_from_this(),
+                boost::asio::placeholders::error)));
+        }
+        launch();
+    }
+
+    void launch();
+
+    void onHedge(const boost::system::error_code& err)
+    {
+        if (!err && gather) {
+            launch();
+        }
+    }
+
+    void onDeadline(const boost::system::error_code& err)
+    {
+        if (!err && gather) {
+            LOG_EVERY_N(WARNING, 100) << "backend " << index << " timed out";
+            std::string none;
+            finish(none);
+        }
+    }
+
+    void finish(std::string& body);
+};
+
+// one http request on one replica.
+class Exchange:
+    public boost::enable_shared_from_this<Exchange>
+{
+private:
+    const boost::shared_ptr<Call> call;
+    tcp::socket socket;
+    boost::asio::streambuf response;
+
+public:
+    explicit Exchange(const boost::shared_ptr<Call>& _call):
+        call(_call), socket(_call->service)
+    {}
+
+    void start(const Cluster::Endpoint& endpoint)
+    {
+        socket.async_connect(endpoint, call->strand.wrap(boost::bind(&Exchange::onConnect,
+            shared_from_this(), boost::asio::placeholders::error)));
+    }
+
+    void close()
+    {
+        boost::system::error_code err;
+        socket.close(err);
+    }
+
+private:
+    void onConnect(const boost::system::error_code& err)
+    {
+        if (err) {
+            fail(err);
+            return;
+        }
+        socket.set_option(tcp::no_delay(true));
+        boost::asio::async_write(socket, boost::asio::buffer(*call->request),
+            call->strand.wrap(boost::bind(&Exchange::onWrite, shared_from_this(),
+                boost::asio::placeholders::error)));
+    }
+
+    void onWrite(const boost::system::error_code& err)
+    {
+        if (err) {
+            fail(err);
+            return;
+        }
+        // http/1.0, server closes the connection once replied.
+        boost::asio::async_read(socket, response, boost::asio::transfer_all(),
+            call->strand.wrap(boost::bind(&Exchange::onRead, shared_from_this(),
+                boost::asio::placeholders::error)));
+    }
+
+    void onRead(const boost::system::error_code& err)
+    {
+        if (err != boost::asio::error::eof) {
+            fail(err);
+            return;
+        }
+        std::string raw(boost::asio::buffers_begin(response.data()), boost::asio::buffers_end(response.data()));
+        std::string body;
+        std::size_t space = raw.find(' '), pos = raw.find("\r\n\r\n");
+        if (raw.compare(0, 5, "HTTP/") == 0 && space != raw.npos && raw.compare(space + 1, 4, "200 ") == 0
+            && pos != raw.npos) {
+            body = raw.substr(pos + 4);
+        } else {
+            LOG_EVERY_N(WARNING, 100) << "bad reply from backend: " << raw.substr(0, raw.find('\r'));
+        }
+        call->onReply(body);
+    }
+
+    void fail(const boost::system::error_code& err)
+    {
+        if (err != boost::asio::error::operation_aborted) {
+            LOG_EVERY_N(WARNING, 100) << "failed on asking backend: " << err.message();
+        }
+        std::string none;
+        call->onReply(none);
+    }
+};
+
+void Call::launch()
+{
+    if (gather == NULL) {
+        return;
+    }
+    boost::shared_ptr<Exchange> exchange(new Exchange(shared_from_this()));
+    const Cluster::Endpoint& endpoint = replicas[exchanges.size() % replicas.size()];
+    exchanges.push_back(exchange);
+    exchange->start(endpoint);
+}
+
+void Call::finish(std::string& body)
+{
+    boost::system::error_code err;
+    deadline.cancel(err);
+    hedger.cancel(err);
+    for (std::vector<boost::shared_ptr<Exchange> >::iterator it = exchanges.begin(); it != exchanges.end(); ++it) {
+        (*it)->close();
+    }
+    // exchanges hold the call, the cycle is broken here.
+    exchanges.clear();
+    gather->deliver(index, body);
+    gather = NULL;
+}
+
+}
+
+Cluster* Cluster::_instance = NULL;
+
+bool Cluster::initialize()
+{
+    const Config* config = Config::instance();
+    if (config->clusterBackends.empty()) {
+        return true;
+    }
+    Cluster* cluster = new Cluster(config);
+    for (StringList::const_iterator it = config->clusterBackends.begin(); it != config->clusterBackends.end(); ++it) {
+        cluster->backends.push_back(Replicas());
+        if (!parse(*it, cluster->backends.back())) {
+            CS_DIE("bad backend in cluster-backends: " << *it);
+        }
+    }
+    for (std::size_t i = 0; i < config->clusterThreads; ++i) {
+        cluster->threads.create_thread(boost::bind(&boost::asio::io_service::run, &cluster->service));
+    }
+    LOG(INFO) << "routing queries to " << cluster->backends.size() << " backends";
+    _instance = cluster;
+    return true;
+}
+
+Cluster::Cluster(const Config* config):
+    requestHead("GET /query/predict?" + config->keyQUPayload + "="),
+    timeout(boost::posix_time::milliseconds(config->clusterTimeout)),
+    hedgeDelay(boost::posix_time::milliseconds(config->clusterHedgeDelay)),
+    work(service)
+{}
+
+bool Cluster::parse(const std::string& spec, Replicas& replicas)
+{
+    StringList hosts;
+    boost::split(hosts, spec, boost::is_any_of("|"), boost::token_compress_on);
+    for (StringList::const_iterator it = hosts.begin(); it != hosts.end(); ++it) {
+        std::string host = boost::algorithm::trim_copy(*it);
+        std::size_t colon = host.rfind(':');
+        if (colon == host.npos) {
+            return false;
+        }
+        boost::system::error_code err;
+        boost::asio::ip::address address = boost::asio::ip::address::from_string(host.substr(0, colon), err);
+        if (err) {
+            return false;
+        }
+        try {
+            replicas.push_back(Endpoint(address, boost::lexical_cast<unsigned short>(host.substr(colon + 1))));
+        } catch (const boost::bad_lexical_cast&) {
+            return false;
+        }
+    }
+    return !replicas.empty();
+}
+
+void Cluster::scatter(const std::string& data, ReplyList& replies)
+{
+    const boost::shared_ptr<const std::string> request(
+        new std::string(requestHead + urlEncode(data) + " HTTP/1.0\r\n\r\n"));
+    replies.assign(backends.size(), std::string());
+    Gather gather(replies);
+    for (std::size_t i = 0; i < backends.size(); ++i) {
+        boost::shared_ptr<Call> call(new Call(service, request, backends[i], timeout, hedgeDelay, &gather, i));
+        call->start();
+    }
+    gather.wait();
+}
+
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "predef.hpp"
+#include <string>
+#include <vector>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/thread/thread.hpp>
+#include "Config.hpp"
+
+namespace taboo
+{
+
+// router side of cluster mode: with @cluster-backends set, queries are not sought locally but
+// scattered to every backend (plain taboo processes, each owning a part of items), whose results
+// are merged by the predicter.
+// a backend is asked over its manage http, on one of its replicas; with @cluster-hedge-delay,
+// a backend not replied by then is asked once more, on its next replica, and the first reply wins.
+// a backend not replied in @cluster-timeout is left out of the results.
+class Cluster
+{
+public:
+    typedef boost::asio::ip::tcp::endpoint Endpoint;
+    typedef std::vector<Endpoint> Replicas;     // of a backend, each owns the same items
+    typedef std::vector<std::string> ReplyList;
+
+private:
+    static Cluster* _instance;
+
+    const std::string requestHead;
+    const boost::posix_time::time_duration timeout, hedgeDelay;
+
+    std::vector<Replicas> backends;
+
+    boost::asio::io_service service;
+    boost::asio::io_service::work work;
+    boost::thread_group threads;
+
+public:
+    static Cluster* instance()
+    {
+        return _instance;
+    }
+
+    static bool initialize();
+
+    // forwards query @data to all backends, blocks until each of them replied or timed out.
+    // @replies[i] is the reply body of backend i, empty if it failed.
+    void scatter(const std::string& data, ReplyList& replies);
+
+    std::size_t size() const
+    {
+        return backends.size();
+    }
+
+private:
+    explicit Cluster(const Config* config);
+
+    // "host:port|host:port..."
+    static bool parse(const std::string& spec, Replicas& replicas);
+};
+
+}
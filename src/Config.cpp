@@ -245,7 +245,10 @@ void Config::initDesc()
     boost::filesystem::path defaultPidFile("/var/run/" + programName + ".pid");
     boost::filesystem::path defaultStorePath("/var/lib/" + programName + "/");
     boost::filesystem::path defaultTrieFile = defaultStorePath / "trie.dat",
-        defaultItemsFile = defaultStorePath / "items.dat";
+        defaultItemsFile = defaultStorePath / "items.dat",
+        defaultWalFile = defaultStorePath / "wal.dat";
+    boost::filesystem::path defaultSlowQueryLog("/var/log/" + programName + "/slow.log");
+    boost::filesystem::path defaultQueryCaptureLog("/var/log/" + programName + "/queries.cap");
     boost::filesystem::path defaultWssCert = defaultConfigDir / "wss.cert",
         defaultHttpsCert = defaultConfigDir / "https.cert";
     std::string lanIp = stage::getLanIP();
@@ -259,9 +262,33 @@ void Config::initDesc()
             "restore trie/items from @trie-file/@items-file when startup or not, default is yes.")
 
         ("trie-file", po::value(&trieFile)->default_value(defaultTrieFile),
-            ("file to store trie, default is '" + defaultStorePath.string() + "trie.dat'.").c_str())
+            ("file to store trie, suffixed by shard and generation of snapshot, default is '" + defaultStorePath.string() + "trie.dat'.").c_str())
         ("items-file", po::value(&itemsFile)->default_value(defaultItemsFile),
             ("file to store items, default is '" + defaultStorePath.string() + "items.dat'.").c_str())
+        ("snapshot-interval", po::value(&snapshotInterval)->default_value(3600),
+            "interval (second) of storing trie/items in background, 0 means never, default is 3600.")
+        ("restore-threads", po::value(&restoreThreads)->default_value(0),
+            "num of threads decoding @items-file on restore, 0 means num of CPU cores, default is 0.")
+
+        ("wal-enable", po::bool_switch(&walEnable)->default_value(false),
+            "log manage operations into @wal-file and replay them on startup or not, default is no.")
+        ("wal-file", po::value(&walFile)->default_value(defaultWalFile),
+            ("write-ahead log file, default is '" + defaultStorePath.string() + "wal.dat'.").c_str())
+        ("wal-sync", po::value(&walSync)->default_value("always"),
+            "when to fdatasync @wal-file: 'always' before replying manage requests, "
+            "'interval' every @wal-sync-interval milliseconds, or 'never', default is 'always'.")
+        ("wal-sync-interval", po::value(&walSyncInterval)->default_value(100),
+            "interval (millisecond) of fdatasync @wal-file when @wal-sync is 'interval', default is 100.")
+
+        ("replication-host", po::value(&replicationHost)->default_value("127.0.0.1"),
+            "host to bind for followers to stream wal from, default is 127.0.0.1.")
+        ("replication-port", po::value(&replicationPort)->default_value(0),
+            "port to bind for followers to stream wal from, requires @wal-enable, "
+            "0 disables replication, default is 0.")
+        ("replicate-from", po::value(&replicateFrom)->default_value(""),
+            "host:port of @replication-port of a leader, non-empty makes this process a read-only follower, "
+            "which catches up from snapshot and wal of the leader then applies its wal as it grows, "
+            "default is empty.")
 
         ("query-enable-http", po::bool_switch(&queryEnableHttp)->default_value(true),
             "enable HTTP protocol for query, default is 'yes'.")
@@ -292,12 +319,30 @@ void Config::initDesc()
             std::min<std::size_t>(1, stage::getCpuNum() - 1)),
             "num of workers for query, default is num of CPU cores minus 1.")
 
+        ("ingest-queue-size", po::value(makePtr(ingestQueueSize))->default_value(65536),
+            "capacity of queue between manage workers and the single index writer, "
+            "0 means manage workers write index themselves, default is 64K.")
+        ("ingest-batch-size", po::value(makePtr(ingestBatchSize))->default_value(256),
+            "max num of queued manage operations applied under one write-lock, default is 256.")
+        ("ingest-ack", po::bool_switch(&ingestAck)->default_value(true),
+            "reply manage operations after they're applied (or just queued), "
+            "can be overridden by param 'ack' per request, default is yes.")
+
+        ("expiry-batch-size", po::value(makePtr(expiryBatchSize))->default_value(256),
+            "max num of expired items removed under one write-lock, default is 256.")
+        ("expiry-batch-interval", po::value(&expiryBatchInterval)->default_value(10),
+            "milliseconds to pause between batches of expired items, so that removal yields to "
+            "manage operations, default is 10.")
+
         ("stack-size", po::value(makePtr(stackSize))->default_value(0),
             "stack size limit, 0 is not set, default is 0.")
         ("max-open-files", po::value(makePtr(maxOpenFiles))->default_value(0),
             "max open files, 0 is not set, default is 0.")
         ("memlock", po::bool_switch(&memlock)->default_value(false),
             "memlock after startup or not, default is no")
+        ("trie-huge-pages", po::bool_switch(&trieHugePages)->default_value(false),
+            "place trie arrays and item/funnel dicts in 2M huge pages, falls back to "
+            "transparent huge pages if no huge page is reserved, default is no.")
         ("reuse-address", po::bool_switch(&reuseAddress)->default_value(true),
             "whether reuse-address on startup or not, default on.")
         ("tcp-nodelay", po::bool_switch(&tcpNodelay)->default_value(true),
@@ -354,6 +399,68 @@ void Config::initDesc()
         ("default-matches", po::value(makePtr(defaultMatches))->default_value(std::string("10")),
             "default count of items to match for query, default is 10.")
 
+        ("query-cache-entries", po::value(makePtr(queryCacheEntries))->default_value(std::string("64K")),
+            "max count of query replies to cache, 0 disables query cache, default is 64K.")
+        ("query-cache-shards", po::value(makePtr(queryCacheShards))->default_value(16),
+            "num of shards of query cache, default is 16.")
+        ("query-cache-generations", po::value(makePtr(queryCacheGenerations))->default_value(std::string("1M")),
+            "num of generation counters used to invalidate query cache, default is 1M.")
+
+        ("prefix-filter-size", po::value(makePtr(prefixFilterSize))->default_value(std::string("16M")),
+            "num of counters (one byte each) of the filter rejecting unknown prefixes before "
+            "touching trie, 0 disables the filter, default is 16M.")
+        ("prefix-filter-hashes", po::value(makePtr(prefixFilterHashes))->default_value(4),
+            "num of hash functions of the unknown prefixes filter, default is 4.")
+        ("trie-prefetch-batch", po::value(makePtr(triePrefetchBatch))->default_value(8),
+            "num of funnels to collect and prefetch before processing them while traversing trie, "
+            "at most 64, 1 disables prefetching, default is 8.")
+
+        ("index-shards", po::value(makePtr(indexShards))->default_value(1),
+            "num of index partitions by item id, each has its own trie, dicts and lock, "
+            "queries are fanned out to all of them, default is 1.")
+        ("query-fanout-threads", po::value(makePtr(queryFanoutThreads))->default_value(0),
+            "num of threads seeking shards for queries besides query workers, "
+            "0 means @index-shards minus 1, default is 0.")
+
+        ("cluster-backends", po::value<std::string>()->default_value(""),
+            "comma separated backends (host:port of their manage http), non-empty makes this process "
+            "a router, which forwards queries to all backends and merges their results. "
+            "each backend owns a part of items, replicas of a backend are separated by '|', "
+            "default is empty.")
+        ("cluster-timeout", po::value(&clusterTimeout)->default_value(200),
+            "milliseconds to wait for a backend, results of backends late or failed are left out, "
+            "default is 200.")
+        ("cluster-hedge-delay", po::value(&clusterHedgeDelay)->default_value(0),
+            "milliseconds after which a backend not replied yet is asked again, on its next replica "
+            "if it has any, the first reply wins, 0 disables hedging, default is 0.")
+        ("cluster-threads", po::value(makePtr(clusterThreads))->default_value(1),
+            "num of threads doing network io with backends, default is 1.")
+
+        ("latency-histograms", po::bool_switch(&latencyHistograms)->default_value(true),
+            "records latency histograms of query stages and manage requests, reported by "
+            "/manage/status, default is yes.")
+        ("lock-profiling", po::bool_switch(&lockProfiling)->default_value(false),
+            "records wait and hold time of shard and session locks per call site, reported by "
+            "/manage/status, can be switched by /manage/locks at runtime, default is no.")
+
+        ("slow-query-micros", po::value(makePtr(slowQueryMicros))->default_value(0),
+            "queries taking at least this many microseconds are logged into @slow-query-log, "
+            "0 disables, default is 0.")
+        ("slow-query-iterations", po::value(makePtr(slowQueryIterations))->default_value(0),
+            "queries iterating at least this many funnels are logged into @slow-query-log, "
+            "0 disables, default is 0.")
+        ("slow-query-rate", po::value(makePtr(slowQueryRate))->default_value(100),
+            "max num of slow queries logged per second, the rest are counted only, default is 100.")
+        ("slow-query-log", po::value(&slowQueryLog)->default_value(defaultSlowQueryLog),
+            ("file to log slow queries into, default is '" + defaultSlowQueryLog.string() + "'.").c_str())
+
+        ("query-capture-every", po::value(makePtr(queryCaptureEvery))->default_value(0),
+            "captures one in this many queries on average into @query-capture-log, e.g. 100 for 1%, "
+            "0 disables, default is 0.")
+        ("query-capture-log", po::value(&queryCaptureLog)->default_value(defaultQueryCaptureLog),
+            ("binary file to capture sampled queries into, replayable by taboo-loadgen, default is '"
+                + defaultQueryCaptureLog.string() + "'.").c_str())
+
         ("check-signature", po::bool_switch(&checkSign)->default_value(true),
             "check signature or not for manage requests, default is yes.")
         ("manage-must-post", po::bool_switch(&manageMustPost)->default_value(false),
@@ -377,6 +484,14 @@ void Config::initDesc()
             "key name for 'item' of manage requests, default is 'item'.")
         ("key-item-id", po::value(&keyId)->default_value("id"),
             "key name for 'id' of items, default is 'id'.")
+        ("key-item-score", po::value(&keyScore)->default_value(""),
+            "key name for numeric 'score' of items, matched items are ordered by it (highest first), "
+            "the top of all matched within @max-iterations funnels of each shard, "
+            "empty means items are in trie order (interleaved across shards), default is empty.")
+        ("key-item-expire", po::value(&keyExpire)->default_value(""),
+            "key name for 'expire' of items, unix time in seconds after which the item is hidden "
+            "from queries and removed; set it (e.g. to 'expire') to enable expiry and @key-manage-request-ttl, "
+            "default is empty, which disables both.")
         ("key-manage-request-upsert-item", po::value(&keyMUUpsert)->default_value("upsert"),
             "key name for 'upsert-item' of manage requests, default is 'upsert'.")
         ("key-manage-request-token-identy", po::value(&keyMUIdenty)->default_value("tid"),
@@ -385,6 +500,9 @@ void Config::initDesc()
             "key name for 'filters' of get token requests, default is 'filters'.")
         ("key-manage-request-expire", po::value(&keyMUExpire)->default_value("expire"),
             "key name for 'token expire' of get token requests, default is 'expire'.")
+        ("key-manage-request-ttl", po::value(&keyMUTtl)->default_value("ttl"),
+            "key name for 'ttl' (seconds) of attach requests, which sets @key-item-expire of the item, "
+            "ignored if @key-item-expire is empty, default is 'ttl'.")
 
         ("key-manage-response-error-code", po::value(&keyMDErrCode)->default_value("code"),
             "key name for 'error-code' of manage responses, default is 'code'.")
@@ -466,6 +584,49 @@ void Config::loadOptions()
         }
     }
 
+    if (walSync != "always" && walSync != "interval" && walSync != "never") {
+        throw ErrorInvalidValue("wal-sync", walSync, "must be one of 'always', 'interval' and 'never'");
+    }
+    if (walSync == "interval" && walSyncInterval <= 0) {
+        throw ErrorInvalidValue("wal-sync-interval", boost::lexical_cast<std::string>(walSyncInterval),
+            "must be positive");
+    }
+
+    if (!replicateFrom.empty() && !restoreOnStart) {
+        throw ErrorInvalidValue("replicate-from", replicateFrom, "requires @restore-on-start");
+    }
+    if (replicationPort && !walEnable) {
+        throw ErrorInvalidValue("replication-port", boost::lexical_cast<std::string>(replicationPort),
+            "requires @wal-enable");
+    }
+
+    if (expiryBatchSize == 0) {
+        throw ErrorInvalidValue("expiry-batch-size", "0", "must be positive");
+    }
+    if (expiryBatchInterval < 0) {
+        throw ErrorInvalidValue("expiry-batch-interval", boost::lexical_cast<std::string>(expiryBatchInterval),
+            "must not be negative");
+    }
+
+    if (slowQueryRate == 0 && (slowQueryMicros || slowQueryIterations)) {
+        throw ErrorInvalidValue("slow-query-rate", "0", "must be positive");
+    }
+
+    if (indexShards == 0) {
+        throw ErrorInvalidValue("index-shards", "0", "must be positive");
+    }
+
+    if (!options["cluster-backends"].as<std::string>().empty()) {
+        clusterBackends = series<std::string>("cluster-backends");
+    }
+    if (clusterTimeout <= 0) {
+        throw ErrorInvalidValue("cluster-timeout", boost::lexical_cast<std::string>(clusterTimeout),
+            "must be positive");
+    }
+    if (clusterThreads == 0) {
+        throw ErrorInvalidValue("cluster-threads", "0", "must be positive");
+    }
+
     queryVisibleFields = series<std::string>("query-visible-fields");
     bool visibleAll = queryVisibleFields.size() == 1 && queryVisibleFields[0] == "*";
     if (queryVisibleFields.empty() || visibleAll) {
@@ -488,6 +649,17 @@ void Config::loadOptions()
         _TABOO_OUT_CONFIG_OPTION(restoreOnStart)
         _TABOO_OUT_CONFIG_OPTION(trieFile)
         _TABOO_OUT_CONFIG_OPTION(itemsFile)
+        _TABOO_OUT_CONFIG_OPTION(snapshotInterval)
+        _TABOO_OUT_CONFIG_OPTION(restoreThreads)
+
+        _TABOO_OUT_CONFIG_OPTION(walEnable)
+        _TABOO_OUT_CONFIG_OPTION(walFile)
+        _TABOO_OUT_CONFIG_OPTION(walSync)
+        _TABOO_OUT_CONFIG_OPTION(walSyncInterval)
+
+        _TABOO_OUT_CONFIG_OPTION(replicationHost)
+        _TABOO_OUT_CONFIG_OPTION(replicationPort)
+        _TABOO_OUT_CONFIG_OPTION(replicateFrom)
 
         _TABOO_OUT_CONFIG_OPTION(queryEnableHttp)
         _TABOO_OUT_CONFIG_OPTION(queryEnableWs)
@@ -501,8 +673,15 @@ void Config::loadOptions()
         _TABOO_OUT_CONFIG_OPTION(queryPort)
         _TABOO_OUT_CONFIG_OPTION(pidFile)
         _TABOO_OUT_CONFIG_OPTION(queryWorkers)
+
+        _TABOO_OUT_CONFIG_OPTION(ingestQueueSize)
+        _TABOO_OUT_CONFIG_OPTION(ingestBatchSize)
+        _TABOO_OUT_CONFIG_OPTION(ingestAck)
+        _TABOO_OUT_CONFIG_OPTION(expiryBatchSize)
+        _TABOO_OUT_CONFIG_OPTION(expiryBatchInterval)
         _TABOO_OUT_CONFIG_OPTION(stackSize)
         _TABOO_OUT_CONFIG_OPTION(memlock)
+        _TABOO_OUT_CONFIG_OPTION(trieHugePages)
         _TABOO_OUT_CONFIG_OPTION(maxOpenFiles)
         _TABOO_OUT_CONFIG_OPTION(reuseAddress)
         _TABOO_OUT_CONFIG_OPTION(tcpNodelay)
@@ -536,6 +715,30 @@ void Config::loadOptions()
         _TABOO_OUT_CONFIG_OPTION(maxMatches)
         _TABOO_OUT_CONFIG_OPTION(defaultMatches)
 
+        _TABOO_OUT_CONFIG_OPTION(queryCacheEntries)
+        _TABOO_OUT_CONFIG_OPTION(queryCacheShards)
+        _TABOO_OUT_CONFIG_OPTION(queryCacheGenerations)
+
+        _TABOO_OUT_CONFIG_OPTION(prefixFilterSize)
+        _TABOO_OUT_CONFIG_OPTION(prefixFilterHashes)
+        _TABOO_OUT_CONFIG_OPTION(triePrefetchBatch)
+
+        _TABOO_OUT_CONFIG_OPTION(indexShards)
+        _TABOO_OUT_CONFIG_OPTION(queryFanoutThreads)
+
+        _TABOO_OUT_CONFIG_OPTION(clusterBackends)
+        _TABOO_OUT_CONFIG_OPTION(clusterTimeout)
+        _TABOO_OUT_CONFIG_OPTION(clusterHedgeDelay)
+        _TABOO_OUT_CONFIG_OPTION(clusterThreads)
+        _TABOO_OUT_CONFIG_OPTION(latencyHistograms)
+        _TABOO_OUT_CONFIG_OPTION(lockProfiling)
+        _TABOO_OUT_CONFIG_OPTION(slowQueryMicros)
+        _TABOO_OUT_CONFIG_OPTION(slowQueryIterations)
+        _TABOO_OUT_CONFIG_OPTION(slowQueryRate)
+        _TABOO_OUT_CONFIG_OPTION(slowQueryLog)
+        _TABOO_OUT_CONFIG_OPTION(queryCaptureEvery)
+        _TABOO_OUT_CONFIG_OPTION(queryCaptureLog)
+
         _TABOO_OUT_CONFIG_OPTION(checkSign)
         _TABOO_OUT_CONFIG_OPTION(manageKey)
         _TABOO_OUT_CONFIG_OPTION(manageSecret)
@@ -550,12 +753,15 @@ void Config::loadOptions()
         _TABOO_OUT_CONFIG_OPTION(keyMUIdenty)
         _TABOO_OUT_CONFIG_OPTION(keyMUFilters)
         _TABOO_OUT_CONFIG_OPTION(keyMUExpire)
+        _TABOO_OUT_CONFIG_OPTION(keyMUTtl)
 
         _TABOO_OUT_CONFIG_OPTION(keyMDErrCode)
         _TABOO_OUT_CONFIG_OPTION(keyMDErrDesc)
         _TABOO_OUT_CONFIG_OPTION(keyMDPayload)
 
         _TABOO_OUT_CONFIG_OPTION(keyId)
+        _TABOO_OUT_CONFIG_OPTION(keyScore)
+        _TABOO_OUT_CONFIG_OPTION(keyExpire)
 
         _TABOO_OUT_CONFIG_OPTION(keyQEchoData)
 
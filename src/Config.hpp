@@ -28,6 +28,7 @@ private:
 
     static boost::mutex configLoadMutex;
     friend class Portal;
+    friend class Bench;
     static bool initialize(int argc, char* argv[]);
 
     void init(int argc, char* argv[]);
@@ -61,6 +62,16 @@ public:
 
     bool storeOnExit, restoreOnStart;
     boost::filesystem::path trieFile, itemsFile;
+    std::time_t snapshotInterval;
+    uint32_t restoreThreads;
+
+    bool walEnable;
+    boost::filesystem::path walFile;
+    std::string walSync;
+    std::time_t walSyncInterval;
+
+    std::string replicationHost, replicateFrom;
+    uint16_t replicationPort;
 
     bool queryEnableHttp, queryEnableHttps, queryEnableWs, queryEnableWss;
     boost::filesystem::path wssCert, httpsCert;
@@ -70,9 +81,16 @@ public:
 
     uint32_t manageWorkers, queryWorkers;
 
+    std::size_t ingestQueueSize, ingestBatchSize;
+    bool ingestAck;
+
+    std::size_t expiryBatchSize;
+    std::time_t expiryBatchInterval;
+
     std::size_t stackSize;
     std::size_t maxOpenFiles;
     bool memlock;
+    bool trieHugePages;
     bool reuseAddress;
     bool tcpNodelay;
     uint32_t backlog;
@@ -94,15 +112,37 @@ public:
 
     uint32_t maxIterations, maxMatches, defaultMatches;
 
+    std::size_t queryCacheEntries, queryCacheShards, queryCacheGenerations;
+
+    std::size_t prefixFilterSize;
+    uint32_t prefixFilterHashes;
+
+    std::size_t triePrefetchBatch;
+
+    uint32_t indexShards, queryFanoutThreads;
+
+    StringList clusterBackends;
+    std::time_t clusterTimeout, clusterHedgeDelay;
+    uint32_t clusterThreads;
+
+    bool latencyHistograms;
+    bool lockProfiling;
+
+    uint32_t slowQueryMicros, slowQueryIterations, slowQueryRate;
+    boost::filesystem::path slowQueryLog;
+
+    uint32_t queryCaptureEvery;
+    boost::filesystem::path queryCaptureLog;
+
     bool checkSign, manageMustPost;
     std::string manageKey, manageSecret, signHyphen, signDelimiter;
 
     std::time_t tokenDefaultExpire;
 
     std::string keyMUKey, keyMUSign, keyMUPrefixes, keyMUItem, keyMUUpsert,
-        keyMUIdenty, keyMUFilters, keyMUExpire,
+        keyMUIdenty, keyMUFilters, keyMUExpire, keyMUTtl,
         keyMDErrCode, keyMDErrDesc, keyMDPayload, keyMDToken, keyMDTokenExpire,
-        keyId,
+        keyId, keyScore, keyExpire,
         keyQEchoData,
         keyQUPayload, keyQUToken, keyQUPrefix, keyQUFilters, keyQUExcludes, keyQUFields, keyQUNum,
         keyQDErrCode, keyQDErrDesc, keyQDPayload;
@@ -0,0 +1,20 @@
+
+#include "Counters.hpp"
+
+namespace taboo
+{
+
+PerThread<Counters::Recorder> Counters::recorders;
+boost::atomic<long> Counters::connections[connection_num];
+
+uint64_t Counters::sum(Counter counter)
+{
+    uint64_t res = 0;
+    PerThread<Recorder>::Reader reader(recorders);
+    for (std::vector<Recorder*>::const_iterator it = reader.all.begin(); it != reader.all.end(); ++it) {
+        res += (*it)->counts[counter];
+    }
+    return res;
+}
+
+}
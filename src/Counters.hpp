@@ -0,0 +1,78 @@
+#pragma once
+
+#include "predef.hpp"
+#include <vector>
+#include <algorithm>
+#include <boost/atomic.hpp>
+#include "Latency.hpp"
+
+namespace taboo
+{
+
+// counters of events on hot paths, kept per thread with plain increments and summed when read,
+// the way Latency keeps histograms.
+class Counters
+{
+public:
+    enum Counter {
+        counter_queries,
+        counter_cache_hits,
+        counter_empty_results,      // of queries seeking index (not answered by cache)
+        counter_reply_bytes,        // of query replies
+        counter_attach,             // manage operations applied
+        counter_update_item,
+        counter_detach,
+        counter_patch,
+        counter_read_lock_wait,     // cpu ticks waited for ReadLock/WriteLock
+        counter_write_lock_wait,
+        counter_num,
+    };
+
+    enum Connection {
+        connection_http,
+        connection_ws,
+        connection_num,
+    };
+
+private:
+    class Recorder
+    {
+    public:
+        uint64_t counts[counter_num];
+
+        Recorder()
+        {
+            std::fill(counts, counts + counter_num, 0);
+        }
+    };
+
+    static PerThread<Recorder> recorders;
+
+    // open connections change far less often than counters, they're shared.
+    static boost::atomic<long> connections[connection_num];
+
+public:
+    static void add(Counter counter, uint64_t num = 1)
+    {
+        recorders.local().counts[counter] += num;
+    }
+
+    static uint64_t sum(Counter counter);
+
+    static void open(Connection kind)
+    {
+        connections[kind].fetch_add(1, boost::memory_order_relaxed);
+    }
+
+    static void close(Connection kind)
+    {
+        connections[kind].fetch_sub(1, boost::memory_order_relaxed);
+    }
+
+    static long opened(Connection kind)
+    {
+        return connections[kind].load(boost::memory_order_relaxed);
+    }
+};
+
+}
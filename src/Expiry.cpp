@@ -0,0 +1,119 @@
+
+#include "Expiry.hpp"
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <glog/logging.h>
+#include "Aside.hpp"
+#include "Keeper.hpp"
+#include "Ingester.hpp"
+#include "Replication.hpp"
+
+namespace taboo
+{
+
+Expiry* Expiry::_instance = NULL;
+
+bool Expiry::initialize()
+{
+    const Config* config = Config::instance();
+    if (config->keyExpire.empty() || Follower::instance()) {
+        return true;
+    }
+    Expiry* expiry = new Expiry(config);
+    _instance = expiry;
+
+    std::size_t num = 0;
+    const ShardList& shards = Aside::instance()->shards;
+    for (ShardList::const_iterator it = shards.begin(); it != shards.end(); ++it) {
+        ReadLock lock((*it)->accessMutex, LockProfile::site_scan);
+        for (ItemDict::const_iterator i = (*it)->itemDict.begin(); i != (*it)->itemDict.end(); ++i) {
+            if (i->second->deadline) {
+                expiry->schedule(i->first, i->second->deadline);
+                ++num;
+            }
+        }
+    }
+    LOG(INFO) << "scheduled " << num << " items to expire";
+
+    expiry->sweeper = new boost::thread(boost::bind(&Expiry::sweepLoop, expiry));
+    return true;
+}
+
+Expiry::Expiry(const Config* config):
+    batchSize(config->expiryBatchSize),
+    batchInterval(config->expiryBatchInterval),
+    wheel(wheel_slots),
+    cursor(std::time(NULL)),
+    scheduled(0),
+    removed(0),
+    sweeper(NULL)
+{}
+
+void Expiry::take(std::time_t now, EntryList& due)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    // after a long pause, every slot is swept once.
+    std::time_t last = std::min<std::time_t>(now, cursor + wheel_slots - 1);
+    for (; cursor <= last; ++cursor) {
+        Slot& slot = wheel[cursor % wheel_slots];
+        for (std::size_t i = 0; i < slot.size(); ) {
+            if (slot[i].deadline <= now) {
+                due.push_back(slot[i]);
+                slot[i] = slot.back();
+                slot.pop_back();
+            } else {
+                ++i;
+            }
+        }
+    }
+    cursor = now + 1;
+    scheduled -= due.size();
+}
+
+void Expiry::remove(const EntryList& due)
+{
+    for (std::size_t begin = 0; begin < due.size(); begin += batchSize) {
+        if (begin && batchInterval) {
+            boost::this_thread::sleep(boost::posix_time::milliseconds(batchInterval));
+        }
+        const std::size_t end = std::min(due.size(), begin + batchSize);
+        boost::ptr_vector<Mutation> mutations;
+        MutationList batch;
+        for (std::size_t i = begin; i < end; ++i) {
+            SharedItem item = makeItem(due[i].id);
+            expireItem(*item, due[i].deadline);
+            mutations.push_back(new Mutation(WalRecord::op_detach, KeyList(), item));
+            batch.push_back(&mutations.back());
+        }
+        // queued behind manage operations of the same shard, as any other write.
+        // a busy queue is retried with the whole batch, detaching what's gone already fails harmlessly.
+        uint64_t num = 0;
+        while (true) {
+            Ingester::Result result = Ingester::ingest(batch);
+            for (MutationList::const_iterator it = batch.begin(); it != batch.end(); ++it) {
+                num += (*it)->result;
+            }
+            if (result != Ingester::result_busy) {
+                break;
+            }
+            boost::this_thread::sleep(boost::posix_time::milliseconds(std::max<std::time_t>(batchInterval, 10)));
+        }
+        removed.fetch_add(num, boost::memory_order_relaxed);
+    }
+}
+
+void Expiry::sweepLoop()
+{
+    EntryList due;
+    while (true) {
+        boost::this_thread::sleep(boost::posix_time::seconds(1));
+        due.clear();
+        take(std::time(NULL), due);
+        if (!due.empty()) {
+            remove(due);
+        }
+    }
+}
+
+}
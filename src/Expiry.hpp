@@ -0,0 +1,97 @@
+#pragma once
+
+#include "predef.hpp"
+#include <ctime>
+#include <vector>
+#include <algorithm>
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include "Config.hpp"
+#include "Item.hpp"
+
+namespace taboo
+{
+
+// removes items once their @key-item-expire passed.
+// deadlines are kept in a wheel of one-second slots, swept every second by a background thread,
+// which detaches due items through Keeper in batches of @expiry-batch-size, pausing
+// @expiry-batch-interval ms in between, so that manage operations get write-locks meanwhile.
+// entries are never cancelled: Keeper rejects one whose item is gone or expires at another time now.
+// queries hide expired items by themselves, so it's fine that removal lags a little.
+// not created on followers, they remove items as leader logged.
+class Expiry
+{
+private:
+    enum { wheel_slots = 4096 };   // deadlines further than this share slots with nearer ones
+
+    class Entry
+    {
+    public:
+        id_t id;
+        uint32_t deadline;
+
+        Entry(id_t _id, uint32_t _deadline):
+            id(_id), deadline(_deadline)
+        {}
+    };
+
+    typedef std::vector<Entry> Slot;
+    typedef std::vector<Entry> EntryList;
+
+    static Expiry* _instance;
+
+    const std::size_t batchSize;
+    const std::time_t batchInterval;
+
+    boost::mutex mutex;
+    std::vector<Slot> wheel;
+    std::time_t cursor;         // slots before it are swept
+    std::size_t scheduled;
+
+    boost::atomic<uint64_t> removed;
+
+    boost::thread* sweeper;
+
+public:
+    static Expiry* instance()
+    {
+        return _instance;
+    }
+
+    // schedules items restored from snapshot and wal, then starts sweeping.
+    static bool initialize();
+
+    // NOTE: called with write-lock of the item's shard held.
+    void schedule(id_t id, uint32_t deadline)
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        std::time_t at = std::max<std::time_t>(deadline, cursor);
+        wheel[at % wheel_slots].push_back(Entry(id, deadline));
+        ++scheduled;
+    }
+
+    // num of entries in wheel, including stale ones.
+    std::size_t pending()
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        return scheduled;
+    }
+
+    uint64_t expired() const
+    {
+        return removed.load(boost::memory_order_relaxed);
+    }
+
+private:
+    explicit Expiry(const Config* config);
+
+    // moves entries due by @now into @due.
+    void take(std::time_t now, EntryList& due);
+
+    void remove(const EntryList& due);
+
+    void sweepLoop();
+};
+
+}
@@ -0,0 +1,49 @@
+
+#include "Fanout.hpp"
+#include <boost/bind.hpp>
+
+namespace taboo
+{
+
+Fanout* Fanout::_instance = NULL;
+
+bool Fanout::initialize()
+{
+    const Config* config = Config::instance();
+    if (config->indexShards > 1) {
+        _instance = new Fanout(config->queryFanoutThreads ?
+            config->queryFanoutThreads : config->indexShards - 1);
+    }
+    return true;
+}
+
+Fanout::Fanout(std::size_t num):
+    work(service)
+{
+    for (std::size_t i = 0; i < num; ++i) {
+        threads.create_thread(boost::bind(&boost::asio::io_service::run, &service));
+    }
+}
+
+void Fanout::run(std::size_t num, const Task& task)
+{
+    if (num == 0) {
+        return;
+    }
+    Latch latch(num - 1);
+    for (std::size_t i = 1; i < num; ++i) {
+        service.post(boost::bind(&Fanout::part, boost::cref(task), i, &latch));
+    }
+    task(0);
+    if (num > 1) {
+        latch.wait();
+    }
+}
+
+void Fanout::part(const Task& task, std::size_t i, Latch* latch)
+{
+    task(i);
+    latch->countDown();
+}
+
+}
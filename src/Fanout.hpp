@@ -0,0 +1,76 @@
+#pragma once
+
+#include "predef.hpp"
+#include <boost/asio/io_service.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include "Config.hpp"
+
+namespace taboo
+{
+
+// pool of @query-fanout-threads threads, which a query fans out over to seek shards in parallel.
+// not created with a single shard.
+class Fanout
+{
+public:
+    typedef boost::function<void(std::size_t)> Task;
+
+private:
+    static Fanout* _instance;
+
+    boost::asio::io_service service;
+    boost::asio::io_service::work work;
+    boost::thread_group threads;
+
+    // counts down finished parts of a run().
+    class Latch
+    {
+    private:
+        boost::mutex mutex;
+        boost::condition_variable done;
+        std::size_t remain;
+
+    public:
+        explicit Latch(std::size_t num):
+            remain(num)
+        {}
+
+        void countDown()
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            if (--remain == 0) {
+                done.notify_one();
+            }
+        }
+
+        void wait()
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            while (remain) {
+                done.wait(lock);
+            }
+        }
+    };
+
+public:
+    static Fanout* instance()
+    {
+        return _instance;
+    }
+
+    static bool initialize();
+
+    // calls @task(0) .. @task(@num - 1), part 0 in the calling thread, the others in pool.
+    // returns once all of them are done.
+    void run(std::size_t num, const Task& task);
+
+private:
+    explicit Fanout(std::size_t num);
+
+    static void part(const Task& task, std::size_t i, Latch* latch);
+};
+
+}
@@ -14,10 +14,12 @@ private:
     FunnelDict& funnelDict;
     const Funnel emptyFunnel;
     const SharedItem dummyItem;
+    std::size_t postingNum;     // items in all funnels
+    std::size_t documentByteNum;    // of items in itemDict
 
 public:
     explicit Farm(ItemDict& _itemDict, FunnelDict& _funnelDict):
-        itemDict(_itemDict), funnelDict(_funnelDict)
+        itemDict(_itemDict), funnelDict(_funnelDict), postingNum(0), documentByteNum(0)
     {}
 
     bool attach(id_t funnelId, const SharedItem& item, bool upsert = true)
@@ -30,35 +32,85 @@ public:
         bool attached = false;
         if (pos == it->second.end()) {
             it->second.insert(std::make_pair(item->id, item->id));
+            ++postingNum;
             attached = true;
         } else if (upsert) {
             pos->second = item->id;
             attached = true;
         }
         if (attached) {
-            itemDict.insert(std::make_pair(item->id, item));
+            if (upsert) {
+                put(item);
+            } else if (itemDict.insert(std::make_pair(item->id, item)).second) {
+                documentByteNum += item->documentBytes();
+            }
         }
         return attached;
     }
 
-    bool detach(id_t id, const SharedItem& item)
+    // stores @item, replacing the one of the same id if any.
+    void put(const SharedItem& item)
     {
-        FunnelDict::iterator it = funnelDict.find(id);
-        if (it != funnelDict.end())
-        {
-            Funnel::iterator pos = it->second.find(item->id);
-            if (pos != it->second.end())
-            {
-                it->second.erase(pos);
-                if (it->second.empty())
-                {
-                    funnelDict.erase(it);
-                }
-                return true;
-            }
-            itemDict.erase(item->id);
+        SharedItem& slot = itemDict[item->id];
+        if (slot) {
+            documentByteNum -= slot->documentBytes();
+        }
+        documentByteNum += item->documentBytes();
+        slot = item;
+    }
+
+    // detaches item @id from funnel @funnelId, @emptied is set if nothing is left in the funnel.
+    bool detach(id_t funnelId, id_t id, bool& emptied)
+    {
+        emptied = false;
+        FunnelDict::iterator it = funnelDict.find(funnelId);
+        if (it == funnelDict.end()) {
+            return false;
+        }
+        Funnel::iterator pos = it->second.find(id);
+        if (pos == it->second.end()) {
+            return false;
+        }
+        it->second.erase(pos);
+        --postingNum;
+        if (it->second.empty()) {
+            funnelDict.erase(it);
+            emptied = true;
+        }
+        return true;
+    }
+
+    // removes item @id, which should have been detached from all funnels.
+    void erase(id_t id)
+    {
+        ItemDict::iterator it = itemDict.find(id);
+        if (it != itemDict.end()) {
+            documentByteNum -= it->second->documentBytes();
+            itemDict.erase(it);
+        }
+    }
+
+    std::size_t postings() const
+    {
+        return postingNum;
+    }
+
+    std::size_t documentBytes() const
+    {
+        return documentByteNum;
+    }
+
+    // counts postings and documents again, once items and funnels are restored.
+    void recount()
+    {
+        postingNum = 0;
+        for (FunnelDict::const_iterator it = funnelDict.begin(); it != funnelDict.end(); ++it) {
+            postingNum += it->second.size();
+        }
+        documentByteNum = 0;
+        for (ItemDict::const_iterator it = itemDict.begin(); it != itemDict.end(); ++it) {
+            documentByteNum += it->second->documentBytes();
         }
-        return false;
     }
 
     const Funnel& funnel(id_t id) const
@@ -68,6 +120,31 @@ public:
         return it == funnelDict.end() ? emptyFunnel : it->second;
     }
 
+    // hints cpu to load the bucket of funnel @id and its first node, so that locate() finds it
+    // in cache. only the bucket slot is read here, no node is compared.
+    void prefetch(id_t id) const
+    {
+        const std::size_t bucket = funnelDict.bucket(id);
+        FunnelDict::const_local_iterator it = funnelDict.begin(bucket);
+        if (it != funnelDict.end(bucket)) {
+            __builtin_prefetch(&*it);
+        }
+    }
+
+    // looks up the funnel prefetch()ed and hints cpu to load its first posting, the funnel returned
+    // is to be iterated later instead of looking it up again by funnel().
+    const Funnel* locate(id_t id) const
+    {
+        FunnelDict::const_iterator it = funnelDict.find(id);
+        if (it == funnelDict.end()) {
+            return &emptyFunnel;
+        }
+        if (!it->second.empty()) {
+            __builtin_prefetch(&*it->second.begin());
+        }
+        return &it->second;
+    }
+
     const SharedItem& item(id_t id) const
     {
         ItemDict::const_iterator it = itemDict.find(id);
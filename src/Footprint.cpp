@@ -0,0 +1,69 @@
+
+#include "Footprint.hpp"
+#include <algorithm>
+#include <boost/shared_ptr.hpp>
+
+namespace taboo
+{
+
+namespace
+{
+
+const char* const partNames[] = {
+    "trieArray",
+    "trieInfo",
+    "itemDict",
+    "funnelDict",
+    "postings",
+    "keysDict",
+    "keyStrings",
+    "items",
+    "sharedCounts",
+    "documents",
+};
+
+}
+
+Footprint::Footprint():
+    items(0)
+{
+    std::fill(bytes, bytes + part_num, 0);
+}
+
+Footprint Footprint::read(const ShardList& shards)
+{
+    Footprint res;
+    const ShardTotals totals = ShardTotals::read(shards);
+    res.items = totals.items;
+    if (!shards.empty()) {
+        res.bytes[part_trie_array] = totals.trieCapacity * shards.front()->trie.nodeSize();
+    }
+    // capacities of cedar are whole blocks of 256 nodes, so summed up they count the same.
+    res.bytes[part_trie_info] = Trie::infoBytes(totals.trieCapacity);
+    res.bytes[part_key_strings] = totals.keyBytes;
+    res.bytes[part_documents] = totals.documentBytes;
+    res.bytes[part_item_dict] = ArenaStat<ItemDictTag>::load();
+    res.bytes[part_funnel_dict] = ArenaStat<FunnelDictTag>::load();
+    res.bytes[part_postings] = ArenaStat<FunnelTag>::load();
+    res.bytes[part_keys_dict] = ArenaStat<KeysDictTag>::load();
+    // items are made by new and owned by shared_ptr, see makeItem().
+    res.bytes[part_items] = res.items * sizeof(Item);
+    res.bytes[part_shared_counts] = res.items * sizeof(boost::detail::sp_counted_impl_p<Item>);
+    return res;
+}
+
+const char* Footprint::nameOf(Part part)
+{
+    return partNames[part];
+}
+
+uint64_t Footprint::total() const
+{
+    uint64_t res = 0;
+    for (int i = 0; i < part_num; ++i) {
+        res += bytes[i];
+    }
+    return res;
+}
+
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "predef.hpp"
+#include "Shard.hpp"
+
+namespace taboo
+{
+
+// memory taken by index, broken down by structure, for /manage/status and taboo-bench.
+// read from counters kept up to date by writers (ShardStat and ArenaStat), nothing is scanned.
+// bytes are those asked from allocators, their own overhead (and that of boost pools) is not included.
+class Footprint
+{
+public:
+    enum Part {
+        part_trie_array,        // double array nodes of cedar, allocated ones
+        part_trie_info,         // sibling info and blocks cedar keeps along nodes
+        part_item_dict,         // nodes and buckets of ItemDict
+        part_funnel_dict,       // nodes and buckets of FunnelDict, with funnel headers
+        part_postings,          // nodes and buckets of funnels
+        part_keys_dict,         // nodes and buckets of KeysDict
+        part_key_strings,       // keys of items joined in KeysDict
+        part_items,             // Item objects
+        part_shared_counts,     // control blocks of SharedItem
+        part_documents,         // rapidjson documents of items
+        part_num,
+    };
+
+    uint64_t items;
+    uint64_t bytes[part_num];
+
+    Footprint();
+
+    // dicts are accounted over all of them, @shards should be all of those alive.
+    static Footprint read(const ShardList& shards);
+
+    static const char* nameOf(Part part);
+
+    uint64_t total() const;
+};
+
+}
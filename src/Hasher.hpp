@@ -0,0 +1,52 @@
+#pragma once
+
+#include "predef.hpp"
+#include <cstddef>
+
+namespace taboo
+{
+
+// 64 bit FNV-1a, can be fed byte by byte.
+class PrefixHasher
+{
+private:
+    uint64_t value;
+
+public:
+    PrefixHasher():
+        value(0xcbf29ce484222325ULL)
+    {}
+
+    void feed(char chr)
+    {
+        value ^= static_cast<uint8_t>(chr);
+        value *= 0x100000001b3ULL;
+    }
+
+    uint64_t operator()(const char* data, std::size_t length)
+    {
+        for (const char* end = data + length; data != end; ++data) {
+            feed(*data);
+        }
+        return value;
+    }
+
+    uint64_t hash() const
+    {
+        return value;
+    }
+
+    // murmur3 finalizer, spreads bits of hash() over the whole word.
+    uint64_t mixed() const
+    {
+        uint64_t h = value;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+};
+
+}
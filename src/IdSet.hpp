@@ -0,0 +1,113 @@
+#pragma once
+
+#include "predef.hpp"
+#include <vector>
+#include "Item.hpp"
+
+namespace taboo
+{
+
+// open-addressing set of item ids, slots are stamped with an epoch, so that
+// reset() is O(1) and the storage is reused for the whole life of a thread.
+// inserting beyond the @expected passed to reset() doubles the slots.
+class IdSet
+{
+private:
+    class Slot
+    {
+    public:
+        id_t id;
+        uint32_t epoch;
+
+        Slot():
+            id(0), epoch(0)
+        {}
+    };
+
+    std::vector<Slot> slots;
+    std::size_t mask;
+    std::size_t size;
+    uint32_t epoch;
+
+public:
+    IdSet():
+        mask(0), size(0), epoch(0)
+    {}
+
+    void reset(std::size_t expected)
+    {
+        std::size_t capacity = 16;
+        while (capacity < (expected << 1)) {
+            capacity <<= 1;
+        }
+        if (slots.size() < capacity) {
+            slots.assign(capacity, Slot());
+            mask = capacity - 1;
+            epoch = 0;
+        }
+        if (CS_BUNLIKELY(++epoch == 0)) {
+            slots.assign(slots.size(), Slot());
+            epoch = 1;
+        }
+        size = 0;
+    }
+
+    bool contains(id_t id) const
+    {
+        for (std::size_t i = hash(id) & mask; ; i = (i + 1) & mask) {
+            const Slot& slot = slots[i];
+            if (slot.epoch != epoch) {
+                return false;
+            }
+            if (slot.id == id) {
+                return true;
+            }
+        }
+    }
+
+    // false if already exists.
+    bool insert(id_t id)
+    {
+        for (std::size_t i = hash(id) & mask; ; i = (i + 1) & mask) {
+            Slot& slot = slots[i];
+            if (slot.epoch != epoch) {
+                slot.id = id;
+                slot.epoch = epoch;
+                if (CS_BUNLIKELY(++size << 1 > slots.size())) {
+                    grow();
+                }
+                return true;
+            }
+            if (slot.id == id) {
+                return false;
+            }
+        }
+    }
+
+private:
+    void grow()
+    {
+        std::vector<id_t> ids;
+        ids.reserve(size);
+        for (std::vector<Slot>::const_iterator it = slots.begin(); it != slots.end(); ++it) {
+            if (it->epoch == epoch) {
+                ids.push_back(it->id);
+            }
+        }
+        slots.assign(slots.size() << 1, Slot());
+        mask = slots.size() - 1;
+        epoch = 1;
+        size = 0;
+        for (std::vector<id_t>::const_iterator it = ids.begin(); it != ids.end(); ++it) {
+            insert(*it);
+        }
+    }
+
+    static std::size_t hash(id_t id)
+    {
+        uint32_t h = id * 0x9e3779b1U;
+        return h ^ (h >> 16);
+    }
+};
+
+}
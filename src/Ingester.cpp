@@ -0,0 +1,145 @@
+
+#include "Ingester.hpp"
+#include <algorithm>
+#include <boost/bind.hpp>
+
+namespace taboo
+{
+
+Ingester* Ingester::_instance = NULL;
+
+bool Ingester::initialize()
+{
+    const Config* config = Config::instance();
+    if (config->ingestQueueSize) {
+        _instance = new Ingester(config);
+        for (std::vector<Lane*>::iterator it = _instance->lanes.begin(); it != _instance->lanes.end(); ++it) {
+            (*it)->writer = new boost::thread(boost::bind(&Ingester::run, _instance, *it));
+        }
+    }
+    return true;
+}
+
+Ingester::Result Ingester::ingest(const Mutation& mutation, bool ack)
+{
+    if (_instance) {
+        return _instance->submit(mutation, ack);
+    }
+    Mutation applied(mutation);
+    return Keeper::instance()->apply(applied) ? result_applied : result_unchanged;
+}
+
+Ingester::Result Ingester::ingest(const MutationList& batch)
+{
+    if (_instance) {
+        return _instance->submit(batch);
+    }
+    Keeper::instance()->apply(batch);
+    return result_applied;
+}
+
+Ingester::Ingester(const Config* config):
+    batchSize(std::max<std::size_t>(1, config->ingestBatchSize))
+{
+    for (std::size_t i = 0; i < Aside::instance()->shards.size(); ++i) {
+        lanes.push_back(new Lane(config->ingestQueueSize));
+    }
+}
+
+Ingester::Result Ingester::submit(const Mutation& mutation, bool ack)
+{
+    Lane* lane = laneOf(mutation);
+    Waiter waiter;
+    Ticket* ticket = new Ticket(mutation, ack ? &waiter : NULL);
+    if (!lane->queue.bounded_push(ticket)) {
+        delete ticket;
+        return result_busy;
+    }
+    wake(lane);
+    if (!ack) {
+        return result_queued;
+    }
+    waiter.wait();
+    Result res = ticket->mutation.result ? result_applied : result_unchanged;
+    delete ticket;
+    return res;
+}
+
+Ingester::Result Ingester::submit(const MutationList& batch)
+{
+    Waiter waiter(batch.size());
+    std::vector<Ticket*> tickets;
+    tickets.reserve(batch.size());
+    Result res = result_applied;
+    for (MutationList::const_iterator it = batch.begin(); it != batch.end(); ++it) {
+        Ticket* ticket = new Ticket(**it, &waiter);
+        tickets.push_back(ticket);
+        // once a queue is full the rest fail too, rather than being applied out of order.
+        if (res == result_busy || !laneOf(**it)->queue.bounded_push(ticket)) {
+            res = result_busy;
+            waiter.notify();
+        }
+    }
+    for (std::vector<Lane*>::const_iterator it = lanes.begin(); it != lanes.end(); ++it) {
+        wake(*it);
+    }
+    waiter.wait();
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+        batch[i]->result = tickets[i]->mutation.result;
+        delete tickets[i];
+    }
+    return res;
+}
+
+void Ingester::wake(Lane* lane)
+{
+    if (lane->sleeping.load()) {
+        boost::mutex::scoped_lock lock(lane->mutex);
+        lane->wakeup.notify_one();
+    }
+}
+
+void Ingester::run(Lane* lane)
+{
+    Keeper* keeper = Keeper::instance();
+    std::vector<Ticket*> tickets;
+    MutationList batch;
+    tickets.reserve(batchSize);
+    batch.reserve(batchSize);
+    while (true) {
+        Ticket* ticket;
+        while (tickets.size() < batchSize && lane->queue.pop(ticket)) {
+            tickets.push_back(ticket);
+            batch.push_back(&ticket->mutation);
+        }
+        if (tickets.empty()) {
+            idle(lane);
+            continue;
+        }
+
+        keeper->apply(batch);
+
+        for (std::vector<Ticket*>::const_iterator it = tickets.begin(); it != tickets.end(); ++it) {
+            if ((*it)->waiter) {
+                (*it)->waiter->notify();
+            } else {
+                delete *it;
+            }
+        }
+        tickets.clear();
+        batch.clear();
+    }
+}
+
+void Ingester::idle(Lane* lane)
+{
+    boost::mutex::scoped_lock lock(lane->mutex);
+    lane->sleeping = true;
+    // a push racing with the flag is caught by the check, or by the timeout at worst.
+    if (lane->queue.empty()) {
+        lane->wakeup.timed_wait(lock, boost::posix_time::milliseconds(10));
+    }
+    lane->sleeping = false;
+}
+
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "predef.hpp"
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/lockfree/queue.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/thread.hpp>
+#include "Config.hpp"
+#include "Keeper.hpp"
+
+namespace taboo
+{
+
+// manage workers enqueue mutations into lock-free queues, one per shard, each drained
+// by its own writer thread applying them in batches of up to @ingest-batch-size, so the
+// write-lock, wal commit and cache invalidation are paid once per batch, and shards
+// are written in parallel.
+// with @ingest-queue-size 0, mutations are applied by the calling worker.
+class Ingester
+{
+public:
+    enum Result {
+        result_applied,     // applied, and it changed the index
+        result_unchanged,   // applied, but rejected by index (exists already, no such key...)
+        result_queued,      // queued, not waited for
+        result_busy,        // queue is full
+    };
+
+private:
+    // notified by the writer once each of the @remain mutations is applied.
+    class Waiter
+    {
+    private:
+        boost::mutex mutex;
+        boost::condition_variable cond;
+        std::size_t remain;
+
+    public:
+        explicit Waiter(std::size_t _remain = 1):
+            remain(_remain)
+        {}
+
+        void notify()
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            if (--remain == 0) {
+                cond.notify_one();
+            }
+        }
+
+        void wait()
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            while (remain) {
+                cond.wait(lock);
+            }
+        }
+    };
+
+    class Ticket
+    {
+    public:
+        Mutation mutation;
+        Waiter* waiter;     // NULL if nobody waits, then the writer deletes the ticket
+
+        Ticket(const Mutation& _mutation, Waiter* _waiter):
+            mutation(_mutation), waiter(_waiter)
+        {}
+    };
+
+    // queue of a shard, and its writer.
+    class Lane
+    {
+    public:
+        boost::lockfree::queue<Ticket*> queue;
+
+        boost::atomic<bool> sleeping;
+        boost::mutex mutex;
+        boost::condition_variable wakeup;
+
+        boost::thread* writer;
+
+        explicit Lane(std::size_t capacity):
+            queue(capacity), sleeping(false), writer(NULL)
+        {}
+    };
+
+    static Ingester* _instance;
+
+    const std::size_t batchSize;
+
+    std::vector<Lane*> lanes;
+
+public:
+    static Ingester* instance()
+    {
+        return _instance;
+    }
+
+    static bool initialize();
+
+    // queues @mutation, waits until it's applied with @ack.
+    // without an Ingester, @mutation is applied right now.
+    static Result ingest(const Mutation& mutation, bool ack);
+
+    // queues mutations of @batch into their lanes and waits until they're applied, results are set
+    // into them. result_busy if a queue is full: mutations queued before are applied still, the rest fail.
+    // without an Ingester, @batch is applied right now.
+    static Result ingest(const MutationList& batch);
+
+private:
+    explicit Ingester(const Config* config);
+
+    Result submit(const Mutation& mutation, bool ack);
+
+    Result submit(const MutationList& batch);
+
+    Lane* laneOf(const Mutation& mutation) const
+    {
+        return lanes[Aside::instance()->shardOf(mutation.item->id)];
+    }
+
+    void wake(Lane* lane);
+
+    void run(Lane* lane);
+
+    void idle(Lane* lane);
+};
+
+}
@@ -1,12 +1,252 @@
 
 #include "Item.hpp"
+#include <cstring>
 #include "rapidjson/error/en.h"
+#include "rapidjson/writer.h"
+#include "rapidjson/stringbuffer.h"
 #include "Config.hpp"
 #include "Aside.hpp"
 
 namespace taboo
 {
 
+namespace
+{
+
+enum ValueTag {
+    tag_null = 0,
+    tag_false,
+    tag_true,
+    tag_int,
+    tag_uint,
+    tag_double,
+    tag_string,
+    tag_array,
+    tag_object,
+};
+
+template<typename T>
+inline void put(std::string& out, T value)
+{
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+inline void put(std::string& out, const char* str, uint32_t length)
+{
+    put(out, length);
+    out.append(str, length);
+}
+
+void encodeValue(const Value& value, std::string& out)
+{
+    switch (value.GetType()) {
+    case rapidjson::kNullType:
+        put<uint8_t>(out, tag_null);
+        break;
+    case rapidjson::kFalseType:
+        put<uint8_t>(out, tag_false);
+        break;
+    case rapidjson::kTrueType:
+        put<uint8_t>(out, tag_true);
+        break;
+    case rapidjson::kNumberType:
+        if (value.IsInt64()) {
+            put<uint8_t>(out, tag_int);
+            put<int64_t>(out, value.GetInt64());
+        } else if (value.IsUint64()) {
+            put<uint8_t>(out, tag_uint);
+            put<uint64_t>(out, value.GetUint64());
+        } else {
+            put<uint8_t>(out, tag_double);
+            put<double>(out, value.GetDouble());
+        }
+        break;
+    case rapidjson::kStringType:
+        put<uint8_t>(out, tag_string);
+        put(out, value.GetString(), value.GetStringLength());
+        break;
+    case rapidjson::kArrayType:
+        put<uint8_t>(out, tag_array);
+        put<uint32_t>(out, value.Size());
+        for (Value::ConstValueIterator it = value.Begin(); it != value.End(); ++it) {
+            encodeValue(*it, out);
+        }
+        break;
+    case rapidjson::kObjectType:
+        put<uint8_t>(out, tag_object);
+        put<uint32_t>(out, value.MemberCount());
+        for (Value::ConstMemberIterator it = value.MemberBegin(); it != value.MemberEnd(); ++it) {
+            put(out, it->name.GetString(), it->name.GetStringLength());
+            encodeValue(it->value, out);
+        }
+        break;
+    }
+}
+
+class Decoder
+{
+private:
+    enum { max_depth = 128 };   // of nested arrays and objects, deeper is taken as corrupt
+
+    const char*& cursor;
+    const char* const end;
+    Dom::AllocatorType& allocator;
+
+public:
+    Decoder(const char*& _cursor, const char* _end, Dom::AllocatorType& _allocator):
+        cursor(_cursor), end(_end), allocator(_allocator)
+    {}
+
+    template<typename T>
+    bool get(T& value)
+    {
+        if (CS_BUNLIKELY(static_cast<std::size_t>(end - cursor) < sizeof(value))) {
+            return false;
+        }
+        std::memcpy(&value, cursor, sizeof(value));
+        cursor += sizeof(value);
+        return true;
+    }
+
+    bool get(Value& str)
+    {
+        uint32_t length;
+        if (!get(length) || CS_BUNLIKELY(static_cast<std::size_t>(end - cursor) < length)) {
+            return false;
+        }
+        str.SetString(cursor, length, allocator);
+        cursor += length;
+        return true;
+    }
+
+    bool decode(Value& value, std::size_t depth = 0)
+    {
+        uint8_t tag;
+        if (!get(tag)) {
+            return false;
+        }
+        switch (tag) {
+        case tag_null:
+            value.SetNull();
+            return true;
+        case tag_false:
+        case tag_true:
+            value.SetBool(tag == tag_true);
+            return true;
+        case tag_int:
+            {
+                int64_t number;
+                if (!get(number)) {
+                    return false;
+                }
+                value.SetInt64(number);
+                return true;
+            }
+        case tag_uint:
+            {
+                uint64_t number;
+                if (!get(number)) {
+                    return false;
+                }
+                value.SetUint64(number);
+                return true;
+            }
+        case tag_double:
+            {
+                double number;
+                if (!get(number)) {
+                    return false;
+                }
+                value.SetDouble(number);
+                return true;
+            }
+        case tag_string:
+            return get(value);
+        case tag_array:
+            {
+                uint32_t size;
+                if (!get(size) || !fits(size, depth)) {
+                    return false;
+                }
+                value.SetArray();
+                value.Reserve(size, allocator);
+                for (uint32_t i = 0; i < size; ++i) {
+                    Value element;
+                    if (!decode(element, depth + 1)) {
+                        return false;
+                    }
+                    value.PushBack(element, allocator);
+                }
+                return true;
+            }
+        case tag_object:
+            {
+                uint32_t size;
+                if (!get(size) || !fits(size, depth)) {
+                    return false;
+                }
+                value.SetObject();
+                for (uint32_t i = 0; i < size; ++i) {
+                    Value name, member;
+                    if (!get(name) || !decode(member, depth + 1)) {
+                        return false;
+                    }
+                    value.AddMember(name, member, allocator);
+                }
+                return true;
+            }
+        default:
+            return false;
+        }
+    }
+
+private:
+    // every element takes a byte at least, a size beyond what's left is corrupt, not to be reserved.
+    bool fits(uint32_t size, std::size_t depth) const
+    {
+        return depth < max_depth && size <= static_cast<std::size_t>(end - cursor);
+    }
+};
+
+inline void reviseDeadline(Item& item)
+{
+    const Value& key = Aside::instance()->keyExpire;
+    if (key.GetStringLength() && item.dom.IsObject()) {
+        Value::ConstMemberIterator it = item.dom.FindMember(key);
+        if (it != item.dom.MemberEnd() && it->value.IsUint()) {
+            item.deadline = it->value.GetUint();
+        }
+    }
+}
+
+void mergePatch(Value& target, const Value& patch, Value::AllocatorType& allocator)
+{
+    if (!patch.IsObject()) {
+        target.CopyFrom(patch, allocator);
+        return;
+    }
+    if (!target.IsObject()) {
+        target.SetObject();
+    }
+    for (Value::ConstMemberIterator it = patch.MemberBegin(); it != patch.MemberEnd(); ++it) {
+        if (it->value.IsNull()) {
+            target.RemoveMember(it->name);
+            continue;
+        }
+        Value::MemberIterator pos = target.FindMember(it->name);
+        if (pos != target.MemberEnd()) {
+            mergePatch(pos->value, it->value, allocator);
+        } else {
+            Value name, value;
+            name.CopyFrom(it->name, allocator);
+            mergePatch(value, it->value, allocator);
+            target.AddMember(name, value, allocator);
+        }
+    }
+}
+
+}
+
 SharedItem makeItem(const char* str)
 {
     SharedItem item(new Item), res;
@@ -16,6 +256,7 @@ SharedItem makeItem(const char* str)
         if (CS_BLIKELY(it != item->dom.MemberEnd())) {
             if (CS_BLIKELY(it->value.IsUint())) {
                 item->id = it->value.GetUint();
+                reviseDeadline(*item);
                 res = item;
             }
         }
@@ -23,4 +264,64 @@ SharedItem makeItem(const char* str)
     return res;
 }
 
+SharedItem makeItem(id_t id)
+{
+    SharedItem item(new Item(id));
+    const Value& key = Aside::instance()->keyId;
+    Value name(key.GetString(), key.GetStringLength(), item->dom.GetAllocator()), value(id);
+    item->dom.SetObject();
+    item->dom.AddMember(name, value, item->dom.GetAllocator());
+    return item;
+}
+
+SharedItem patchItem(const Item& item, const Value& patch)
+{
+    SharedItem res(new Item(item.id));
+    res->dom.CopyFrom(item.dom, res->dom.GetAllocator());
+    mergePatch(res->dom, patch, res->dom.GetAllocator());
+    reviseDeadline(*res);
+    return res;
+}
+
+void expireItem(Item& item, uint32_t deadline)
+{
+    const Value& key = Aside::instance()->keyExpire;
+    if (!key.GetStringLength() || !item.dom.IsObject()) {
+        return;
+    }
+    Value::MemberIterator it = item.dom.FindMember(key);
+    if (it != item.dom.MemberEnd()) {
+        it->value.SetUint(deadline);
+    } else {
+        Value name(key.GetString(), key.GetStringLength(), item.dom.GetAllocator()), value(deadline);
+        item.dom.AddMember(name, value, item.dom.GetAllocator());
+    }
+    item.deadline = deadline;
+}
+
+std::string dumpItem(const Item& item)
+{
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    item.dom.Accept(writer);
+    return std::string(buffer.GetString(), buffer.GetSize());
+}
+
+void encodeItem(const Item& item, std::string& out)
+{
+    put<id_t>(out, item.id);
+    encodeValue(item.dom, out);
+}
+
+SharedItem decodeItem(const char*& cursor, const char* end)
+{
+    SharedItem item(new Item), res;
+    Decoder decoder(cursor, end, item->dom.GetAllocator());
+    if (CS_BLIKELY(decoder.get(item->id) && decoder.decode(item->dom))) {
+        reviseDeadline(*item);
+        res = item;
+    }
+    return res;
+}
+
 }
@@ -2,12 +2,17 @@
 #pragma once
 
 #include "predef.hpp"
+#include <string>
+#include <ctime>
+#include <functional>
+#include <limits>
 #include <boost/shared_ptr.hpp>
 #include <boost/unordered_map.hpp>
 #include <boost/functional/hash.hpp>
 #include <glog/logging.h>
 #include "rapidjson/document.h"
 #include "stage/misc.hpp"
+#include "Memory.hpp"
 
 namespace taboo {
 
@@ -20,15 +25,29 @@ class Item
 public:
     Dom dom;
     id_t id;
+    uint32_t deadline;  // unix time of @key-item-expire, 0 means never
 
     explicit Item(id_t _id):
-        id(_id)
+        id(_id), deadline(0)
     {}
 
     Item():
-        id(0)
+        id(0), deadline(0)
     {}
 
+    // checked by queries, expired items are hidden before the sweeper removes them.
+    bool isExpired(std::time_t now) const
+    {
+        return deadline && deadline <= now;
+    }
+
+    // heap taken by @dom: its pool allocator, the chunks of the pool and what's left of parse stack.
+    std::size_t documentBytes() const
+    {
+        return sizeof(Dom::AllocatorType) + const_cast<Dom&>(dom).GetAllocator().Capacity()
+            + dom.GetStackCapacity();
+    }
+
     bool operator!() const
     {
         return id;
@@ -39,6 +58,33 @@ typedef boost::shared_ptr<Item> SharedItem;
 
 extern SharedItem makeItem(const char* str);
 
+// an item of nothing but @id, to name the item in detach operations.
+extern SharedItem makeItem(id_t id);
+
+// a copy of @item with JSON merge patch (RFC 7396) @patch applied, @item itself is left as it is.
+extern SharedItem patchItem(const Item& item, const Value& patch);
+
+// sets @key-item-expire of @item, so that it's kept in wal and snapshots along with the item.
+extern void expireItem(Item& item, uint32_t deadline);
+
+// serializes @item back into JSON, makeItem() accepts it.
+extern std::string dumpItem(const Item& item);
+
+// appends compact binary form of @item to @out, which restores without a JSON parser.
+extern void encodeItem(const Item& item, std::string& out);
+
+// decodes an item encoded by encodeItem() at @cursor, moves @cursor past it.
+// returns null item on malformed input.
+extern SharedItem decodeItem(const char*& cursor, const char* end);
+
+// numeric field @key of @item, items without it rank last.
+inline double scoreOf(const Value& item, const Value& key)
+{
+    Value::ConstMemberIterator it = item.FindMember(key);
+    return it != item.MemberEnd() && it->value.IsNumber() ?
+        it->value.GetDouble() : -std::numeric_limits<double>::max();
+}
+
 inline bool operator==(const Item& lhs, const Item& rhs)
 {
     return lhs.id == rhs.id;
@@ -60,8 +106,16 @@ public:
 
 typedef std::vector<SharedItem> SharedItemList;
 
-typedef boost::unordered_map<id_t, SharedItem> ItemDict;
-typedef boost::unordered_map<id_t, id_t> Funnel;
-typedef boost::unordered_map<id_t, Funnel> FunnelDict;
+// tags of ArenaAllocator, so that memory of each kind of dict is accounted apart.
+class ItemDictTag {};
+class FunnelTag {};
+class FunnelDictTag {};
+
+typedef boost::unordered_map<id_t, SharedItem, boost::hash<id_t>, std::equal_to<id_t>,
+    ArenaAllocator<std::pair<const id_t, SharedItem>, ItemDictTag> > ItemDict;
+typedef boost::unordered_map<id_t, id_t, boost::hash<id_t>, std::equal_to<id_t>,
+    ArenaAllocator<std::pair<const id_t, id_t>, FunnelTag> > Funnel;
+typedef boost::unordered_map<id_t, Funnel, boost::hash<id_t>, std::equal_to<id_t>,
+    ArenaAllocator<std::pair<const id_t, Funnel>, FunnelDictTag> > FunnelDict;
 
 }
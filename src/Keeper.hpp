@@ -4,23 +4,46 @@
 #include "predef.hpp"
 #include <string>
 #include <vector>
+#include <set>
 #include <algorithm>
 #include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
 #include "Aside.hpp"
 #include "Trie.hpp"
 #include "Farm.hpp"
+#include "Shard.hpp"
 #include "Item.hpp"
+#include "ResultCache.hpp"
+#include "Wal.hpp"
+#include "Expiry.hpp"
+#include "Counters.hpp"
 
 namespace taboo
 {
 
-class Keeper
+// a manage operation on index, applied by Keeper.
+class Mutation
 {
-private:
-    Trie& trie;
+public:
+    WalRecord::Op op;
+    KeyList keys;
+    SharedItem item;
+    bool upsert;    // of update_item: the key is in another shard, attach it in the item's one
+
+    bool result;
+    WalRecord record;   // formed outside of write-lock, or as shipped from leader
+
+    Mutation(WalRecord::Op _op, const KeyList& _keys, const SharedItem& _item, bool _upsert = false):
+        op(_op), keys(_keys), item(_item), upsert(_upsert), result(false)
+    {}
+};
 
-    Farm& farm;
+typedef std::vector<Mutation*> MutationList;
 
+class Keeper
+{
+private:
     static Keeper* _instance;
 
 public:
@@ -37,38 +60,381 @@ public:
 
     bool attach(const KeyList& keys, const SharedItem& item, bool upsertItem)
     {
-        AttachCallback cb(farm, item, upsertItem);
-        WriteLock lock(Aside::instance()->accessMutex);
-        return (trie.attach(keys, cb) && cb.attached) || upsertItem;
+        Mutation mutation(WalRecord::op_attach, keys, item, upsertItem);
+        return apply(mutation);
     }
 
+    // fails if no shard has @key.
     bool update_item(const std::string& key, const SharedItem& item)
     {
-        id_t id;
-        {
-            ReadLock lock(Aside::instance()->accessMutex);
-            id = trie[key];
-        }
-        if (id) {
-            WriteLock lock(Aside::instance()->accessMutex);
-            return farm.attach(id, item);
-        }
-        return false;
+        Mutation mutation(WalRecord::op_update_item, KeyList(1, key), item);
+        return apply(mutation);
+    }
+
+    // @patch names the item by its id.
+    bool patch(const SharedItem& patch)
+    {
+        Mutation mutation(WalRecord::op_patch, KeyList(), patch);
+        return apply(mutation);
     }
 
     // TODO: 重前缀 会重复出现
+    // empty @keys detaches @item from all keys it's attached to.
     bool detach(const KeyList& keys, const SharedItem& item)
     {
-        EraseCallback cb(farm, item);
-        WriteLock lock(Aside::instance()->accessMutex);
-        return trie.erase(keys, item->id, cb);
+        Mutation mutation(WalRecord::op_detach, keys, item);
+        return apply(mutation);
+    }
+
+    bool apply(Mutation& mutation)
+    {
+        MutationList batch(1, &mutation);
+        apply(batch);
+        return mutation.result;
+    }
+
+    // applies @batch under a single write-lock per shard, results are set into mutations.
+    // wal records are formed before and committed after the locks, once for the whole batch.
+    // if wal is broken the batch fails all, though what's applied before it breaks stays in memory.
+    void apply(const MutationList& batch)
+    {
+        // decided before any write-lock is taken, and logged, so that replay doesn't look again.
+        for (MutationList::const_iterator it = batch.begin(); it != batch.end(); ++it) {
+            Mutation& mutation = **it;
+            if (mutation.op == WalRecord::op_update_item && !mutation.record.lsn && !mutation.upsert) {
+                mutation.upsert = hasKey(mutation.keys.front());
+            }
+        }
+        if (Wal::instance()) {
+            if (CS_BUNLIKELY(Wal::instance()->isBroken())) {
+                fail(batch);
+                return;
+            }
+            for (MutationList::const_iterator it = batch.begin(); it != batch.end(); ++it) {
+                Mutation& mutation = **it;
+                if (!mutation.record.lsn) {
+                    mutation.record = WalRecord(mutation.op, mutation.keys, mutation.item, mutation.upsert);
+                }
+            }
+        }
+        const Aside* aside = Aside::instance();
+        lsn_t lsn = 0;
+        if (aside->shards.size() == 1) {
+            apply(*aside->shards.front(), batch, lsn);
+        } else {
+            std::vector<MutationList> groups(aside->shards.size());
+            for (MutationList::const_iterator it = batch.begin(); it != batch.end(); ++it) {
+                groups[aside->shardOf((*it)->item->id)].push_back(*it);
+            }
+            for (std::size_t i = 0; i < groups.size(); ++i) {
+                if (!groups[i].empty()) {
+                    apply(*aside->shards[i], groups[i], lsn);
+                }
+            }
+        }
+        if (CS_BUNLIKELY(!commit(lsn))) {
+            fail(batch);
+        }
+    }
+
+    // applies a logged operation, without logging it again.
+    bool replay(const WalRecord& record)
+    {
+        boost::scoped_ptr<Mutation> mutation(mutationOf(record));
+        if (!mutation) {
+            return false;
+        }
+        mutation->record = record;
+        return apply(*mutation);
+    }
+
+    // applies operations shipped from leader, which are logged again with their lsns if wal is enabled.
+    // consecutive operations on a shard are applied as a batch, so that lsns stay in order in log.
+    void replay(const WalRecordList& records)
+    {
+        const Aside* aside = Aside::instance();
+        boost::ptr_vector<Mutation> mutations;
+        MutationList batch;
+        std::size_t shard = 0;
+        for (WalRecordList::const_iterator it = records.begin(); it != records.end(); ++it) {
+            Mutation* mutation = mutationOf(*it);
+            if (mutation == NULL) {
+                continue;
+            }
+            mutations.push_back(mutation);
+            mutation->record = *it;
+            std::size_t current = aside->shardOf(mutation->item->id);
+            if (!batch.empty() && current != shard) {
+                apply(batch);
+                batch.clear();
+            }
+            shard = current;
+            batch.push_back(mutation);
+        }
+        if (!batch.empty()) {
+            apply(batch);
+        }
     }
 
 private:
-    Keeper():
-        trie(Aside::instance()->trie),
-        farm(Aside::instance()->farm)
-    {}
+    Keeper() {}
+
+    static Mutation* mutationOf(const WalRecord& record)
+    {
+        SharedItem item = makeItem(record.item.c_str());
+        if (!item || (record.keys.empty()
+            && record.op != WalRecord::op_detach && record.op != WalRecord::op_patch)) {
+            LOG(ERROR) << "bad wal record " << record.lsn;
+            return NULL;
+        }
+        switch (record.op) {
+        case WalRecord::op_attach:
+        case WalRecord::op_update_item:
+        case WalRecord::op_detach:
+        case WalRecord::op_patch:
+            return new Mutation(static_cast<WalRecord::Op>(record.op), record.keys, item, record.upsert);
+        default:
+            LOG(ERROR) << "unknown op " << static_cast<int>(record.op) << " of wal record " << record.lsn;
+            return NULL;
+        }
+    }
+
+    // NOTE: mutations of @batch must all belong to @shard.
+    void apply(Shard& shard, const MutationList& batch, lsn_t& lsn)
+    {
+        WriteLock lock(shard.accessMutex, LockProfile::site_apply);
+        for (MutationList::const_iterator it = batch.begin(); it != batch.end(); ++it) {
+            (*it)->result = applyLocked(shard, **it, lsn);
+            if ((*it)->result) {
+                Counters::add(counterOf((*it)->op));
+            }
+        }
+        shard.publish();
+    }
+
+    // NOTE: must be called with write-lock of @shard held, @lsn is raised to the lsn logged if any.
+    bool applyLocked(Shard& shard, Mutation& mutation, lsn_t& lsn)
+    {
+        Trie& trie = shard.trie;
+        Farm& farm = shard.farm;
+        switch (mutation.op) {
+        case WalRecord::op_attach:
+            if (mutation.upsert) {
+                return upsert(shard, mutation, lsn);
+            } else {
+                AttachCallback cb(farm, mutation.item, false);
+                bool attached = trie.attach(mutation.keys, cb);
+                if (attached || cb.touched) {
+                    for (KeyList::const_iterator it = mutation.keys.begin(); it != mutation.keys.end(); ++it) {
+                        shard.index(mutation.item->id, *it);
+                    }
+                    schedule(*mutation.item);
+                    invalidate(mutation.keys);
+                    lsn = journal(mutation.record);
+                }
+                return attached && cb.attached;
+            }
+        case WalRecord::op_update_item:
+            {
+                const std::string& key = mutation.keys.front();
+                id_t id = trie[key];
+                if (id) {
+                    if (!farm.attach(id, mutation.item)) {
+                        return false;
+                    }
+                } else {
+                    // items are sharded by id, not by key: one named by a key of other shards
+                    // gets a funnel for it in its own.
+                    if (!mutation.upsert) {
+                        return false;
+                    }
+                    AttachCallback cb(farm, mutation.item, true);
+                    trie.attach(mutation.keys, cb);
+                    if (!cb.attached) {
+                        return false;
+                    }
+                }
+                // indexed as attach does, so that detach by id and expiry find it under @key.
+                shard.index(mutation.item->id, key);
+                schedule(*mutation.item);
+                // the item is replaced under every key it has, as patch does, not only the one named.
+                invalidate(shard.keysOf(mutation.item->id));
+                lsn = journal(mutation.record);
+                return true;
+            }
+        case WalRecord::op_detach:
+            {
+                const id_t id = mutation.item->id;
+                const SharedItem& current = farm.item(id);
+                if (!current) {
+                    return false;
+                }
+                // an item named with a deadline (as expiry does) is detached only if it's still due then,
+                // it may have been attached again with another one since.
+                if (mutation.item->deadline && mutation.item->deadline != current->deadline) {
+                    return false;
+                }
+                const KeyList keys = mutation.keys.empty() ? shard.keysOf(id) : mutation.keys;
+                if (!detach(shard, id, keys)) {
+                    return false;
+                }
+                invalidate(keys);
+                lsn = journal(mutation.record);
+                return true;
+            }
+        case WalRecord::op_patch:
+            {
+                // copy-on-write, so that queries still holding the stored item see it unchanged.
+                const SharedItem& stored = farm.item(mutation.item->id);
+                if (!stored) {
+                    return false;
+                }
+                SharedItem patched = patchItem(*stored, mutation.item->dom);
+                if (patched->dom == stored->dom) {
+                    return true;
+                }
+                farm.put(patched);
+                schedule(*patched);
+                invalidate(shard.keysOf(patched->id));
+                lsn = journal(mutation.record);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // makes @mutation.keys the keys of the item, touching only those it gains or loses,
+    // and replaces the stored item only if its document differs.
+    bool upsert(Shard& shard, Mutation& mutation, lsn_t& lsn)
+    {
+        const SharedItem& item = mutation.item;
+        const std::set<std::string> wanted(mutation.keys.begin(), mutation.keys.end());
+        const KeyList current = shard.keysOf(item->id);
+        const std::set<std::string> had(current.begin(), current.end());
+        KeyList fresh, stale;
+        for (std::set<std::string>::const_iterator it = wanted.begin(); it != wanted.end(); ++it) {
+            if (had.find(*it) == had.end()) {
+                fresh.push_back(*it);
+            }
+        }
+        for (KeyList::const_iterator it = current.begin(); it != current.end(); ++it) {
+            if (wanted.find(*it) == wanted.end()) {
+                stale.push_back(*it);
+            }
+        }
+        const SharedItem& stored = shard.farm.item(item->id);
+        const bool changed = !stored || stored->dom != item->dom;
+        if (!changed && fresh.empty() && stale.empty()) {
+            return true;
+        }
+
+        if (!fresh.empty()) {
+            AttachCallback cb(shard.farm, item, false);
+            shard.trie.attach(fresh, cb);
+            for (KeyList::const_iterator it = fresh.begin(); it != fresh.end(); ++it) {
+                shard.index(item->id, *it);
+            }
+        }
+        if (changed) {
+            shard.farm.put(item);
+            schedule(*item);
+        }
+        // after attaching, so that the item is not erased in between.
+        if (!stale.empty()) {
+            detach(shard, item->id, stale);
+        }
+
+        if (changed) {
+            invalidate(mutation.keys);
+        } else {
+            invalidate(fresh);
+        }
+        invalidate(stale);
+        lsn = journal(mutation.record);
+        return true;
+    }
+
+    // NOTE: must be called with no write-lock held.
+    static bool hasKey(const std::string& key)
+    {
+        const ShardList& shards = Aside::instance()->shards;
+        for (ShardList::const_iterator it = shards.begin(); it != shards.end(); ++it) {
+            ReadLock lock((*it)->accessMutex);
+            if ((*it)->trie[key]) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // detaches item @id from @keys, removes keys left with no item from trie,
+    // and the item once it has no key left.
+    static bool detach(Shard& shard, id_t id, const KeyList& keys)
+    {
+        bool detached = false;
+        for (KeyList::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+            id_t funnelId = shard.trie[*it];
+            bool emptied = false;
+            if (!funnelId || !shard.farm.detach(funnelId, id, emptied)) {
+                continue;
+            }
+            shard.unindex(id, *it);
+            if (emptied) {
+                shard.trie.remove(*it);
+            }
+            detached = true;
+        }
+        if (detached && !shard.isIndexed(id)) {
+            shard.farm.erase(id);
+        }
+        return detached;
+    }
+
+    static Counters::Counter counterOf(WalRecord::Op op)
+    {
+        switch (op) {
+        case WalRecord::op_attach:
+            return Counters::counter_attach;
+        case WalRecord::op_update_item:
+            return Counters::counter_update_item;
+        case WalRecord::op_detach:
+            return Counters::counter_detach;
+        default:
+            return Counters::counter_patch;
+        }
+    }
+
+    static lsn_t journal(WalRecord& record)
+    {
+        return Wal::instance() ? Wal::instance()->append(record) : 0;
+    }
+
+    static bool commit(lsn_t lsn)
+    {
+        return !Wal::instance() || Wal::instance()->commit(lsn);
+    }
+
+    static void fail(const MutationList& batch)
+    {
+        for (MutationList::const_iterator it = batch.begin(); it != batch.end(); ++it) {
+            (*it)->result = false;
+        }
+    }
+
+    static void schedule(const Item& item)
+    {
+        if (item.deadline && Expiry::instance()) {
+            Expiry::instance()->schedule(item.id, item.deadline);
+        }
+    }
+
+    template<typename Keys>
+    static void invalidate(const Keys& keys)
+    {
+        if (ResultCache::instance()) {
+            ResultCache::instance()->invalidate(keys);
+        }
+    }
 
     class AttachCallback
     {
@@ -79,31 +445,16 @@ private:
 
     public:
         mutable bool attached;
+        mutable bool touched;   // any funnel changed
 
         AttachCallback(Farm& _farm, const SharedItem& _item, bool _upsert):
-            farm(_farm), item(_item), upsert(_upsert), attached(false)
+            farm(_farm), item(_item), upsert(_upsert), attached(false), touched(false)
         {}
 
         void operator()(id_t id) const
         {
             attached = farm.attach(id, item, upsert);
-        }
-    };
-
-    class EraseCallback
-    {
-    private:
-        Farm& farm;
-        const SharedItem& item;
-
-    public:
-        EraseCallback(Farm& _farm, const SharedItem& _item):
-            farm(_farm), item(_item)
-        {}
-
-        void operator()(id_t funnelId) const
-        {
-            farm.attach(funnelId, item);
+            touched = touched || attached;
         }
     };
 };
@@ -0,0 +1,76 @@
+
+#include "Latency.hpp"
+extern "C" {
+#   include <time.h>
+}
+#include <glog/logging.h>
+#include <boost/thread/thread.hpp>
+
+namespace taboo
+{
+
+bool Latency::enabled = false;
+double Latency::ticksPerMicro = 1;
+
+PerThread<Latency::Recorder> Latency::recorders;
+
+namespace
+{
+
+inline uint64_t clockNanos()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+const char* const metricNames[] = {
+    "ws_receive",
+    "query_parse",
+    "filter_rebuild",
+    "trie_traverse",
+    "filtering",
+    "form_reply",
+    "ws_send",
+    "query",
+    "manage_attach",
+    "manage_detach",
+    "manage_erase",
+    "manage_patch",
+    "manage_store",
+    "manage_status",
+    "manage_token",
+    "manage_metrics",
+    "manage_other",
+};
+
+}
+
+bool Latency::initialize()
+{
+    uint64_t startNanos = clockNanos(), startTicks = now();
+    boost::this_thread::sleep(boost::posix_time::milliseconds(20));
+    uint64_t nanos = clockNanos() - startNanos, ticks = now() - startTicks;
+    ticksPerMicro = nanos ? ticks * 1000.0 / nanos : 1;
+    LOG(INFO) << ticksPerMicro << " ticks per microsecond";
+    if (Config::instance()->latencyHistograms) {
+        LOG(INFO) << "latency histograms enabled";
+        enabled = true;
+    }
+    return true;
+}
+
+void Latency::merge(Metric metric, Histogram& out)
+{
+    PerThread<Recorder>::Reader reader(recorders);
+    for (std::vector<Recorder*>::const_iterator it = reader.all.begin(); it != reader.all.end(); ++it) {
+        out.merge((*it)->histograms[metric]);
+    }
+}
+
+const char* Latency::nameOf(Metric metric)
+{
+    return metricNames[metric];
+}
+
+}
@@ -0,0 +1,270 @@
+#pragma once
+
+#include "predef.hpp"
+#include <vector>
+#include <algorithm>
+extern "C" {
+#   include <time.h>
+}
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+#include "Config.hpp"
+
+namespace taboo
+{
+
+// log-linear buckets of durations in cpu ticks: 16 buckets per power of two,
+// so a bucket is off from what it holds by 1/16 at most.
+class Histogram
+{
+public:
+    enum {
+        sub_bits = 4,
+        sub_buckets = 1 << sub_bits,
+        max_bits = 42,      // longer durations are counted as this long
+        bucket_num = (max_bits - sub_bits + 1) * sub_buckets,
+    };
+
+    uint64_t counts[bucket_num];
+    uint64_t sum;
+
+    Histogram()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        std::fill(counts, counts + bucket_num, 0);
+        sum = 0;
+    }
+
+    void record(uint64_t ticks)
+    {
+        ++counts[bucketOf(ticks)];
+        sum += ticks;
+    }
+
+    void merge(const Histogram& other)
+    {
+        for (std::size_t i = 0; i < bucket_num; ++i) {
+            counts[i] += other.counts[i];
+        }
+        sum += other.sum;
+    }
+
+    uint64_t total() const
+    {
+        uint64_t res = 0;
+        for (std::size_t i = 0; i < bucket_num; ++i) {
+            res += counts[i];
+        }
+        return res;
+    }
+
+    // number counted into buckets wholly at or below @ticks.
+    uint64_t countUpTo(uint64_t ticks) const
+    {
+        uint64_t res = 0;
+        for (std::size_t i = 0; i < bucket_num && upperOf(i) <= ticks; ++i) {
+            res += counts[i];
+        }
+        return res;
+    }
+
+    // upper bound of the bucket holding the @quantile (0..1) of all counted.
+    uint64_t quantile(double quantile) const
+    {
+        uint64_t num = total();
+        if (num == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(quantile * num), seen = 0;
+        for (std::size_t i = 0; i < bucket_num; ++i) {
+            seen += counts[i];
+            if (seen > rank) {
+                return upperOf(i);
+            }
+        }
+        return upperOf(bucket_num - 1);
+    }
+
+    static std::size_t bucketOf(uint64_t ticks)
+    {
+        if (ticks < sub_buckets) {
+            return ticks;
+        }
+        if (CS_BUNLIKELY(ticks >> max_bits)) {
+            ticks = (static_cast<uint64_t>(1) << max_bits) - 1;
+        }
+        int shift = 63 - __builtin_clzll(ticks) - sub_bits;
+        return (shift << sub_bits) + (ticks >> shift);
+    }
+
+    // the largest duration counted into bucket @i.
+    static uint64_t upperOf(std::size_t i)
+    {
+        if (i < sub_buckets) {
+            return i;
+        }
+        std::size_t shift = (i >> sub_bits) - 1;
+        return (((i & (sub_buckets - 1)) + sub_buckets + 1) << shift) - 1;
+    }
+};
+
+// a T for each thread, written by the thread alone with plain stores, read by others as it's written.
+// T's outlive their threads, so what exited threads recorded is still reported.
+template<typename T>
+class PerThread
+{
+private:
+    boost::thread_specific_ptr<T> holder;
+    boost::mutex mutex;
+    std::vector<T*> all;
+
+public:
+    // T's of all threads, threads making their first one are held off meanwhile.
+    class Reader
+    {
+    private:
+        boost::mutex::scoped_lock lock;
+
+    public:
+        const std::vector<T*>& all;
+
+        explicit Reader(PerThread& owner):
+            lock(owner.mutex), all(owner.all)
+        {}
+    };
+
+    PerThread():
+        holder(&PerThread::keep)
+    {}
+
+    T& local()
+    {
+        T* res = holder.get();
+        if (CS_BUNLIKELY(res == NULL)) {
+            res = attach();
+        }
+        return *res;
+    }
+
+private:
+    T* attach()
+    {
+        T* res = new T;
+        holder.reset(res);
+        boost::mutex::scoped_lock lock(mutex);
+        all.push_back(res);
+        return res;
+    }
+
+    static void keep(T*) {}
+};
+
+// latency histograms of query stages and manage endpoints.
+// every thread records into histograms of its own with plain increments, no atomics, no locks;
+// readers merge histograms of all threads, reading counters being written (word sized,
+// only ever growing) at worst misses the latest few samples.
+// durations are cpu ticks (rdtsc), converted to time only when read.
+class Latency
+{
+public:
+    enum Metric {
+        metric_ws_receive,      // routing a websocket message to its handler
+        metric_query_parse,     // Query::rebuild
+        metric_filter_rebuild,  // FilterChain::rebuild
+        metric_trie_traverse,   // walking trie and funnels of a shard, filtering excluded
+        metric_filtering,       // filters applied to candidates of a shard
+        metric_form_reply,
+        metric_ws_send,
+        metric_query,           // a whole query, over http or websocket
+        metric_manage_attach,
+        metric_manage_detach,
+        metric_manage_erase,
+        metric_manage_patch,
+        metric_manage_store,
+        metric_manage_status,
+        metric_manage_token,
+        metric_manage_metrics,
+        metric_manage_other,
+        metric_num,
+    };
+
+    class Timer
+    {
+    private:
+        const Metric metric;
+        const uint64_t start;
+
+    public:
+        explicit Timer(Metric _metric):
+            metric(_metric), start(now())
+        {}
+
+        ~Timer()
+        {
+            record(metric, now() - start);
+        }
+    };
+
+private:
+    class Recorder
+    {
+    public:
+        Histogram histograms[metric_num];
+    };
+
+    static bool enabled;
+    static double ticksPerMicro;
+
+    static PerThread<Recorder> recorders;
+
+public:
+    // calibrates ticks against the clock, takes a few milliseconds.
+    // ticks are converted even if histograms are disabled, for lock wait and slow queries.
+    static bool initialize();
+
+    static bool isEnabled()
+    {
+        return enabled;
+    }
+
+    static uint64_t now()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        uint32_t low, high;
+        __asm__ __volatile__("rdtsc" : "=a"(low), "=d"(high));
+        return (static_cast<uint64_t>(high) << 32) | low;
+#else
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+    }
+
+    static void record(Metric metric, uint64_t ticks)
+    {
+        if (enabled) {
+            recorders.local().histograms[metric].record(ticks);
+        }
+    }
+
+    // histogram of @metric merged from all threads.
+    static void merge(Metric metric, Histogram& out);
+
+    static double toMicros(uint64_t ticks)
+    {
+        return ticks / ticksPerMicro;
+    }
+
+    static uint64_t fromMicros(double micros)
+    {
+        return static_cast<uint64_t>(micros * ticksPerMicro);
+    }
+
+    static const char* nameOf(Metric metric);
+};
+
+}
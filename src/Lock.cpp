@@ -0,0 +1,81 @@
+
+#include "Lock.hpp"
+#include <glog/logging.h>
+#include "Config.hpp"
+
+namespace taboo
+{
+
+boost::atomic<bool> LockProfile::enabled(false);
+
+PerThread<LockProfile::Recorder> LockProfile::recorders;
+
+namespace
+{
+
+const char* const siteLocks[] = {
+    "shard",
+    "shard",
+    "shard",
+    "shards",
+    "shards",
+    "session",
+    "session",
+    "session",
+    "other",
+};
+
+const char* const siteNames[] = {
+    "seek",
+    "apply",
+    "scan",
+    "snapshot",
+    "restore",
+    "lookup",
+    "create",
+    "auth",
+    "other",
+};
+
+}
+
+bool LockProfile::initialize()
+{
+    if (Config::instance()->lockProfiling) {
+        LOG(INFO) << "lock profiling enabled";
+        enable(true);
+    }
+    return true;
+}
+
+void LockProfile::reset()
+{
+    PerThread<Recorder>::Reader reader(recorders);
+    for (std::vector<Recorder*>::const_iterator it = reader.all.begin(); it != reader.all.end(); ++it) {
+        for (int i = 0; i < site_num; ++i) {
+            (*it)->waits[i].reset();
+            (*it)->holds[i].reset();
+        }
+    }
+}
+
+void LockProfile::merge(Site site, Histogram& waits, Histogram& holds)
+{
+    PerThread<Recorder>::Reader reader(recorders);
+    for (std::vector<Recorder*>::const_iterator it = reader.all.begin(); it != reader.all.end(); ++it) {
+        waits.merge((*it)->waits[site]);
+        holds.merge((*it)->holds[site]);
+    }
+}
+
+const char* LockProfile::lockOf(Site site)
+{
+    return siteLocks[site];
+}
+
+const char* LockProfile::nameOf(Site site)
+{
+    return siteNames[site];
+}
+
+}
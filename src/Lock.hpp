@@ -0,0 +1,122 @@
+#pragma once
+
+#include "predef.hpp"
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include "Latency.hpp"
+#include "Counters.hpp"
+
+namespace taboo
+{
+
+// wait and hold time of locks, per call site.
+// off by default (@lock-profiling), switched at runtime by /manage/locks, reported by /manage/status.
+// histograms are kept per thread the way Latency keeps them; while off, a lock costs two
+// more rdtsc than a bare one, which also feed the lock wait counters of /manage/metrics.
+class LockProfile
+{
+public:
+    // grouped by the lock they take.
+    enum Site {
+        site_seek,              // shard, read: a query seeking a shard
+        site_apply,             // shard, write: a batch of manage operations
+        site_scan,              // shard, read: scanning items on start
+        site_snapshot,          // all shards, read: forking snapshot
+        site_restore,           // all shards, write: restoring snapshot
+        site_session_lookup,    // session, read: token of an identy
+        site_session_create,    // session, write
+        site_session_auth,      // session, read: session of a token
+        site_other,
+        site_num,
+    };
+
+private:
+    class Recorder
+    {
+    public:
+        Histogram waits[site_num];
+        Histogram holds[site_num];
+    };
+
+    static boost::atomic<bool> enabled;
+
+    static PerThread<Recorder> recorders;
+
+public:
+    static bool initialize();
+
+    static bool isEnabled()
+    {
+        return enabled.load(boost::memory_order_relaxed);
+    }
+
+    static void enable(bool on)
+    {
+        enabled.store(on, boost::memory_order_relaxed);
+    }
+
+    // NOTE: threads recording meanwhile may keep a few samples from before.
+    static void reset();
+
+    static void record(Site site, uint64_t waitTicks, uint64_t holdTicks)
+    {
+        if (isEnabled()) {
+            Recorder& recorder = recorders.local();
+            recorder.waits[site].record(waitTicks);
+            recorder.holds[site].record(holdTicks);
+        }
+    }
+
+    // histograms of @site merged from all threads.
+    static void merge(Site site, Histogram& waits, Histogram& holds);
+
+    static const char* lockOf(Site site);
+
+    static const char* nameOf(Site site);
+};
+
+// scoped lock of a shared_mutex, shared or exclusive, recording its wait and hold time.
+template<bool exclusive>
+class ProfiledLock
+{
+private:
+    boost::shared_mutex& mutex;
+    const LockProfile::Site site;
+    const uint64_t start;
+    uint64_t locked;
+
+public:
+    explicit ProfiledLock(boost::shared_mutex& _mutex, LockProfile::Site _site = LockProfile::site_other):
+        mutex(_mutex), site(_site), start(Latency::now())
+    {
+        if (exclusive) {
+            mutex.lock();
+        } else {
+            mutex.lock_shared();
+        }
+        locked = Latency::now();
+        Counters::add(exclusive ? Counters::counter_write_lock_wait : Counters::counter_read_lock_wait,
+            locked - start);
+    }
+
+    ~ProfiledLock()
+    {
+        if (exclusive) {
+            mutex.unlock();
+        } else {
+            mutex.unlock_shared();
+        }
+        LockProfile::record(site, locked - start, Latency::now() - locked);
+    }
+
+private:
+    ProfiledLock(const ProfiledLock&);
+    ProfiledLock& operator=(const ProfiledLock&);
+};
+
+typedef ProfiledLock<false> ReadLock;
+typedef ProfiledLock<true> WriteLock;
+
+}
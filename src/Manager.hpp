@@ -24,6 +24,7 @@ extern "C" {
 #include "stage/sys.hpp"
 #include "Config.hpp"
 #include "Router.hpp"
+#include "Counters.hpp"
 
 namespace taboo
 {
@@ -134,6 +135,9 @@ protected:
             MHD_OPTION_LISTENING_ADDRESS_REUSE, config->reuseAddress,
 #endif
             MHD_OPTION_NOTIFY_COMPLETED, &Manager::onRequestCompleted, NULL,
+#if MHD_VERSION >= 0x00094400
+            MHD_OPTION_NOTIFY_CONNECTION, &Manager::onConnection, NULL,
+#endif
             MHD_OPTION_END);
         if (daemon == NULL) {
             CS_DIE("failed on create MHD_Daemon: " << CS_LINESEP << strerror(errno));
@@ -169,7 +173,12 @@ protected:
             return res;
 
         } else {
-            SharedReply reply = static_cast<Closure*>(*conClosure)->handler->process();
+            SharedReply reply;
+            {
+                BaseHandler* handler = static_cast<Closure*>(*conClosure)->handler;
+                Latency::Timer timer(handler->metric());
+                reply = handler->process();
+            }
             static_cast<Closure*>(*conClosure)->destroy();
             *conClosure = NULL;
             uint32_t httpStatus;
@@ -186,7 +195,7 @@ protected:
         httpStatus = 500;
         if (CS_LIKELY(response)) {
             if (CS_BLIKELY(MHD_add_response_header(response, "Content-Type",
-                "application/json") == MHD_YES)) {
+                reply->contentType) == MHD_YES)) {
                 httpStatus = 200;
             }
         }
@@ -214,6 +223,18 @@ protected:
         }
     }
 
+#if MHD_VERSION >= 0x00094400
+    static void onConnection(void* closure, MHD_Connection* connection,
+        void** socketContext, MHD_ConnectionNotificationCode code) throw()
+    {
+        if (code == MHD_CONNECTION_NOTIFY_STARTED) {
+            Counters::open(Counters::connection_http);
+        } else {
+            Counters::close(Counters::connection_http);
+        }
+    }
+#endif
+
     static int checkAccess(void* cls, const sockaddr* addr, socklen_t addrlen) throw()
     {
         return MHD_YES;
@@ -0,0 +1,177 @@
+
+#include "Memory.hpp"
+extern "C" {
+#   include <sys/mman.h>
+}
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+// resolved only if jemalloc is linked.
+extern "C" int mallctl(const char* name, void* oldp, std::size_t* oldlenp, void* newp, std::size_t newlen)
+    __attribute__((weak));
+
+namespace taboo
+{
+
+namespace
+{
+
+class BlockHeader
+{
+public:
+    std::size_t capacity;   // usable bytes
+    std::size_t kind;
+    std::size_t locked;
+};
+
+// keeps blocks 16 bytes aligned, as malloc does.
+const std::size_t header_size = (sizeof(BlockHeader) + 15) & ~static_cast<std::size_t>(15);
+
+inline BlockHeader* headerOf(void* ptr)
+{
+    return reinterpret_cast<BlockHeader*>(static_cast<char*>(ptr) - header_size);
+}
+
+inline void* dataOf(BlockHeader* header)
+{
+    return reinterpret_cast<char*>(header) + header_size;
+}
+
+inline std::size_t mappedLength(const BlockHeader* header)
+{
+    return header->capacity + header_size;
+}
+
+}
+
+bool HugePages::enabled = false;
+bool HugePages::memlock = false;
+
+boost::atomic<std::size_t> HugePages::heapBytes(0);
+boost::atomic<std::size_t> HugePages::hugetlbBytes(0);
+boost::atomic<std::size_t> HugePages::transparentBytes(0);
+boost::atomic<std::size_t> HugePages::lockedBytes(0);
+boost::atomic<std::size_t> HugePages::hugetlbFailures(0);
+boost::atomic<std::size_t> HugePages::lockFailures(0);
+
+void* HugePages::realloc(void* ptr, std::size_t size)
+{
+    if (!enabled) {
+        return std::realloc(ptr, size);
+    }
+    BlockHeader* old = ptr ? headerOf(ptr) : NULL;
+    if (old && size <= old->capacity && old->kind != kind_heap) {
+        return ptr;
+    }
+
+    if (size + header_size < huge_page_size) {
+        if (old == NULL || old->kind == kind_heap) {
+            std::size_t oldCapacity = old ? old->capacity : 0;
+            BlockHeader* header = static_cast<BlockHeader*>(std::realloc(old, size + header_size));
+            if (CS_BUNLIKELY(header == NULL)) {
+                return NULL;
+            }
+            header->capacity = size;
+            header->kind = kind_heap;
+            header->locked = false;
+            if (size < oldCapacity) {
+                heapBytes.fetch_sub(oldCapacity - size, boost::memory_order_relaxed);
+            } else {
+                heapBytes.fetch_add(size - oldCapacity, boost::memory_order_relaxed);
+            }
+            return dataOf(header);
+        }
+    }
+
+    std::size_t length = (size + header_size + huge_page_size - 1) & ~(huge_page_size - 1);
+    std::size_t kind = kind_hugetlb;
+    void* addr = mmap(NULL, length, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (addr == MAP_FAILED) {
+        hugetlbFailures.fetch_add(1, boost::memory_order_relaxed);
+        kind = kind_transparent;
+        addr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (CS_BUNLIKELY(addr == MAP_FAILED)) {
+            return NULL;
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(addr, length, MADV_HUGEPAGE);
+#endif
+    }
+    (kind == kind_hugetlb ? hugetlbBytes : transparentBytes).fetch_add(length, boost::memory_order_relaxed);
+
+    BlockHeader* header = static_cast<BlockHeader*>(addr);
+    header->capacity = length - header_size;
+    header->kind = kind;
+    header->locked = false;
+    if (memlock) {
+        if (mlock(addr, length) == 0) {
+            header->locked = true;
+            lockedBytes.fetch_add(length, boost::memory_order_relaxed);
+        } else {
+            lockFailures.fetch_add(1, boost::memory_order_relaxed);
+        }
+    }
+    if (old) {
+        std::memcpy(dataOf(header), ptr, std::min(old->capacity, size));
+        free(ptr);
+    }
+    return dataOf(header);
+}
+
+void HugePages::free(void* ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+    if (!enabled) {
+        std::free(ptr);
+        return;
+    }
+    BlockHeader* header = headerOf(ptr);
+    if (header->kind == kind_heap) {
+        heapBytes.fetch_sub(header->capacity, boost::memory_order_relaxed);
+        std::free(header);
+        return;
+    }
+    std::size_t length = mappedLength(header);
+    (header->kind == kind_hugetlb ? hugetlbBytes : transparentBytes)
+        .fetch_sub(length, boost::memory_order_relaxed);
+    if (header->locked) {
+        lockedBytes.fetch_sub(length, boost::memory_order_relaxed);
+    }
+    munmap(header, length);
+}
+
+HugePages::Stat HugePages::stat()
+{
+    Stat res;
+    res.heapBytes = heapBytes.load(boost::memory_order_relaxed);
+    res.hugetlbBytes = hugetlbBytes.load(boost::memory_order_relaxed);
+    res.transparentBytes = transparentBytes.load(boost::memory_order_relaxed);
+    res.lockedBytes = lockedBytes.load(boost::memory_order_relaxed);
+    res.hugetlbFailures = hugetlbFailures.load(boost::memory_order_relaxed);
+    res.lockFailures = lockFailures.load(boost::memory_order_relaxed);
+    return res;
+}
+
+MallocStat MallocStat::read()
+{
+    MallocStat stat = MallocStat();
+    if (mallctl == NULL) {
+        return stat;
+    }
+    // stats are cached by jemalloc until epoch is bumped.
+    uint64_t epoch = 1;
+    std::size_t length = sizeof(epoch);
+    mallctl("epoch", &epoch, &length, &epoch, length);
+    length = sizeof(std::size_t);
+    stat.available = mallctl("stats.allocated", &stat.allocated, &length, NULL, 0) == 0
+        && mallctl("stats.active", &stat.active, &length, NULL, 0) == 0
+        && mallctl("stats.resident", &stat.resident, &length, NULL, 0) == 0
+        && mallctl("stats.mapped", &stat.mapped, &length, NULL, 0) == 0;
+    return stat;
+}
+
+}
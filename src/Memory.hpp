@@ -0,0 +1,245 @@
+#pragma once
+
+#include "predef.hpp"
+#include <cstddef>
+#include <new>
+#include <algorithm>
+#include <boost/atomic.hpp>
+#include <boost/pool/pool.hpp>
+#include <boost/thread/tss.hpp>
+
+namespace taboo
+{
+
+// allocator for big and randomly accessed arrays (double array of trie, dict nodes).
+// blocks from 2M on are placed in huge pages: MAP_HUGETLB first, falls back to
+// madvise(MADV_HUGEPAGE) (transparent huge pages) if no huge page is reserved.
+// with @memlock, mapped blocks are mlock()ed.
+// every block carries a header, so huge and heap blocks can be mixed freely.
+// disabled, it's plain realloc() and free(), no header, nothing counted.
+class HugePages
+{
+public:
+    enum Kind {
+        kind_heap = 1,
+        kind_hugetlb,
+        kind_transparent,
+    };
+
+    class Stat
+    {
+    public:
+        std::size_t heapBytes, hugetlbBytes, transparentBytes, lockedBytes;
+        std::size_t hugetlbFailures, lockFailures;
+    };
+
+    static const std::size_t huge_page_size = 2 << 20;
+
+private:
+    static bool enabled, memlock;
+
+    static boost::atomic<std::size_t> heapBytes, hugetlbBytes, transparentBytes, lockedBytes,
+        hugetlbFailures, lockFailures;
+
+public:
+    // NOTE: must be called before anything is allocated, and only once: blocks are freed
+    // the way they're allocated by then.
+    static void configure(bool _enabled, bool _memlock)
+    {
+        enabled = _enabled;
+        memlock = _memlock;
+    }
+
+    static bool isEnabled()
+    {
+        return enabled;
+    }
+
+    // realloc() alike, but @ptr must come from HugePages.
+    static void* realloc(void* ptr, std::size_t size);
+
+    static void free(void* ptr);
+
+    static Stat stat();
+};
+
+// stats of malloc, available only when jemalloc is linked.
+class MallocStat
+{
+public:
+    bool available;
+    std::size_t allocated, active, resident, mapped;
+
+    static MallocStat read();
+};
+
+// user allocator for boost::pool, pool chunks grow quickly into huge pages.
+class HugePageUserAllocator
+{
+public:
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+
+    static char* malloc BOOST_PREVENT_MACRO_SUBSTITUTION(const size_type bytes)
+    {
+        return static_cast<char*>(HugePages::realloc(NULL, bytes));
+    }
+
+    static void free BOOST_PREVENT_MACRO_SUBSTITUTION(char* const block)
+    {
+        HugePages::free(block);
+    }
+};
+
+// pool of single nodes of @size bytes of the calling thread, so that no lock is taken.
+// pools are never destroyed: a node may outlive the thread which allocated it, and a node freed
+// by another thread just joins the free list of that thread's pool.
+template<std::size_t size>
+class NodePool
+{
+private:
+    typedef boost::pool<HugePageUserAllocator> Pool;
+
+    static boost::thread_specific_ptr<Pool> holder;
+
+public:
+    static void* malloc BOOST_PREVENT_MACRO_SUBSTITUTION()
+    {
+        return local().malloc();
+    }
+
+    static void free BOOST_PREVENT_MACRO_SUBSTITUTION(void* const node)
+    {
+        local().free(node);
+    }
+
+private:
+    static Pool& local()
+    {
+        Pool* res = holder.get();
+        if (CS_BUNLIKELY(res == NULL)) {
+            res = new Pool(size);
+            holder.reset(res);
+        }
+        return *res;
+    }
+
+    static void keep(Pool*) {}
+};
+
+template<std::size_t size>
+boost::thread_specific_ptr<typename NodePool<size>::Pool> NodePool<size>::holder(&NodePool<size>::keep);
+
+class ArenaPoolTag {};
+
+// bytes of nodes and buckets held by dicts of @Tag, for /manage/status and taboo-bench.
+template<typename Tag>
+class ArenaStat
+{
+public:
+    static boost::atomic<int64_t> bytes;
+
+    static uint64_t load()
+    {
+        return std::max<int64_t>(0, bytes.load(boost::memory_order_relaxed));
+    }
+};
+
+template<typename Tag>
+boost::atomic<int64_t> ArenaStat<Tag>::bytes(0);
+
+// STL allocator for dicts: single nodes come from per-thread pools backed by
+// HugePages, arrays (buckets) directly from HugePages; if HugePages is disabled, all from
+// operator new as std::allocator does.
+// what's allocated is accounted to ArenaStat<@Tag> either way, nodes of all tags share pools by size.
+template<typename T, typename Tag = ArenaPoolTag>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+
+    template<typename U>
+    struct rebind
+    {
+        typedef ArenaAllocator<U, Tag> other;
+    };
+
+    ArenaAllocator() {}
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U, Tag>&) {}
+
+    pointer address(reference r) const
+    {
+        return &r;
+    }
+
+    const_pointer address(const_reference r) const
+    {
+        return &r;
+    }
+
+    pointer allocate(size_type n, const void* = NULL)
+    {
+        void* res;
+        if (!HugePages::isEnabled()) {
+            res = ::operator new(n * sizeof(T));
+        } else {
+            res = (n == 1) ? NodePool<sizeof(T)>::malloc() : HugePages::realloc(NULL, n * sizeof(T));
+            if (CS_BUNLIKELY(res == NULL)) {
+                throw std::bad_alloc();
+            }
+        }
+        ArenaStat<Tag>::bytes.fetch_add(n * sizeof(T), boost::memory_order_relaxed);
+        return static_cast<pointer>(res);
+    }
+
+    void deallocate(pointer p, size_type n)
+    {
+        if (p) {
+            ArenaStat<Tag>::bytes.fetch_sub(n * sizeof(T), boost::memory_order_relaxed);
+            if (!HugePages::isEnabled()) {
+                ::operator delete(p);
+            } else if (n == 1) {
+                NodePool<sizeof(T)>::free(p);
+            } else {
+                HugePages::free(p);
+            }
+        }
+    }
+
+    size_type max_size() const
+    {
+        return static_cast<size_type>(-1) / sizeof(T);
+    }
+
+    void construct(pointer p, const T& value)
+    {
+        new (p) T(value);
+    }
+
+    void destroy(pointer p)
+    {
+        p->~T();
+    }
+};
+
+template<typename T, typename U, typename Tag>
+inline bool operator==(const ArenaAllocator<T, Tag>&, const ArenaAllocator<U, Tag>&)
+{
+    return true;
+}
+
+template<typename T, typename U, typename Tag>
+inline bool operator!=(const ArenaAllocator<T, Tag>&, const ArenaAllocator<U, Tag>&)
+{
+    return false;
+}
+
+}
@@ -11,6 +11,18 @@
 #include "Keeper.hpp"
 #include "Seeker.hpp"
 #include "Manager.hpp"
+#include "ResultCache.hpp"
+#include "Wal.hpp"
+#include "Snapshot.hpp"
+#include "Ingester.hpp"
+#include "Fanout.hpp"
+#include "Cluster.hpp"
+#include "Replication.hpp"
+#include "Expiry.hpp"
+#include "Latency.hpp"
+#include "Counters.hpp"
+#include "SlowLog.hpp"
+#include "QueryCapture.hpp"
 
 namespace taboo  {
 
@@ -33,13 +45,31 @@ public:
     static void onMessage(Server *server, websocketpp::connection_hdl hdl,
         Server::message_ptr message)
     {
-        SharedReply reply = Router::instance()->route(message)->process();
+        uint64_t start = Latency::now();
+        SharedWsPredicter handler = Router::instance()->route(message);
+        uint64_t routed = Latency::now();
+        Latency::record(Latency::metric_ws_receive, routed - start);
+        SharedReply reply = handler->process();
+        Latency::record(Latency::metric_query, Latency::now() - routed);
+        Latency::Timer timer(Latency::metric_ws_send);
         server->send(hdl, reply->content, message->get_opcode());
     }
 
+    static void onOpen(websocketpp::connection_hdl hdl)
+    {
+        Counters::open(Counters::connection_ws);
+    }
+
+    static void onClose(websocketpp::connection_hdl hdl)
+    {
+        Counters::close(Counters::connection_ws);
+    }
+
     void startWs() const
     {
         Server server;
+        server.set_open_handler(&Portal::onOpen);
+        server.set_close_handler(&Portal::onClose);
         server.set_message_handler(websocketpp::lib::bind(
             &Portal::onMessage, &server,
             websocketpp::lib::placeholders::_1,
@@ -60,8 +90,22 @@ public:
     {
         google::InitGoogleLogging(argv[0]);
         return (!taboo::Config::initialize(argc, argv)
+            || !taboo::Latency::initialize()
+            || !taboo::LockProfile::initialize()
+            || !taboo::SlowLog::initialize()
+            || !taboo::QueryCapture::initialize()
             || !taboo::Aside::initialize()
+            || !taboo::ResultCache::initialize()
             || !taboo::Keeper::initialize()
+            || !taboo::Fanout::initialize()
+            || !taboo::Cluster::initialize()
+            || !taboo::Follower::initialize()
+            || !taboo::Snapshot::initialize()
+            || !taboo::Wal::initialize(taboo::Snapshot::instance()->lsn())
+            || !taboo::Follower::follow()
+            || !taboo::Ingester::initialize()
+            || !taboo::Expiry::initialize()
+            || !taboo::Shipper::initialize()
             || !taboo::Manager::initialize()
             || !taboo::Router::initialize());
     }
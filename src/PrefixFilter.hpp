@@ -0,0 +1,125 @@
+#pragma once
+
+#include "predef.hpp"
+#include <string>
+#include <boost/atomic.hpp>
+#include <boost/scoped_array.hpp>
+#include "Hasher.hpp"
+
+namespace taboo
+{
+
+// counting bloom filter over every query-able prefix of attached keys.
+// "no" is always right, so queries for unknown prefixes can be rejected
+// without touching the trie or taking the access lock.
+// counters saturate at 255 and then stick, which only costs false positives.
+class PrefixFilter
+{
+private:
+    typedef boost::atomic<uint8_t> Counter;
+
+    enum { saturated = 0xff };
+
+    const std::size_t mask;
+    const uint32_t hashes;
+    const std::size_t minLen, maxLen;
+    boost::scoped_array<Counter> counters;
+
+public:
+    // @size: num of counters, 0 disables the filter (everything may exist).
+    PrefixFilter(std::size_t size, uint32_t _hashes, std::size_t _minLen, std::size_t _maxLen):
+        mask(size ? roundUp(size) - 1 : 0), hashes(_hashes ? _hashes : 1),
+        minLen(_minLen ? _minLen : 1), maxLen(_maxLen),
+        counters(size ? new Counter[mask + 1] : NULL)
+    {
+        if (counters) {
+            for (std::size_t i = 0; i <= mask; ++i) {
+                counters[i].store(0, boost::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool enabled() const
+    {
+        return counters;
+    }
+
+    bool mayContain(const std::string& prefix) const
+    {
+        if (!counters) {
+            return true;
+        }
+        PrefixHasher hasher;
+        hasher(prefix.data(), prefix.length());
+        uint64_t hash = hasher.mixed();
+        for (uint32_t i = 0; i < hashes; ++i) {
+            if (counters[slot(hash, i)].load(boost::memory_order_relaxed) == 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // NOTE: writers must be serialized by caller.
+    void add(const std::string& key)
+    {
+        update(key, true);
+    }
+
+    void remove(const std::string& key)
+    {
+        update(key, false);
+    }
+
+    void clear()
+    {
+        for (std::size_t i = 0; counters && i <= mask; ++i) {
+            counters[i].store(0, boost::memory_order_relaxed);
+        }
+    }
+
+private:
+    void update(const std::string& key, bool increase)
+    {
+        if (!counters) {
+            return;
+        }
+        PrefixHasher hasher;
+        std::size_t end = std::min(key.length(), maxLen);
+        for (std::size_t len = 0; len < end; ++len) {
+            hasher.feed(key[len]);
+            if (len + 1 < minLen) {
+                continue;
+            }
+            uint64_t hash = hasher.mixed();
+            for (uint32_t i = 0; i < hashes; ++i) {
+                Counter& counter = counters[slot(hash, i)];
+                uint8_t count = counter.load(boost::memory_order_relaxed);
+                if (count != saturated) {
+                    if (increase) {
+                        counter.store(count + 1, boost::memory_order_release);
+                    } else if (count) {
+                        counter.store(count - 1, boost::memory_order_release);
+                    }
+                }
+            }
+        }
+    }
+
+    // double hashing
+    std::size_t slot(uint64_t hash, uint32_t i) const
+    {
+        return (static_cast<uint32_t>(hash) + i * (static_cast<uint32_t>(hash >> 32) | 1)) & mask;
+    }
+
+    static std::size_t roundUp(std::size_t num)
+    {
+        std::size_t res = 1;
+        while (res < num) {
+            res <<= 1;
+        }
+        return res;
+    }
+};
+
+}
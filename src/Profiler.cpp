@@ -0,0 +1,187 @@
+
+#include "Profiler.hpp"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <algorithm>
+#include <execinfo.h>
+#include <dlfcn.h>
+#include <cxxabi.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/thread.hpp>
+#include <glog/logging.h>
+
+namespace taboo
+{
+
+boost::atomic<bool> Profiler::running(false);
+boost::atomic<bool> Profiler::collecting(false);
+boost::atomic<std::size_t> Profiler::sampleNum(0);
+Profiler::Sample* Profiler::samples = NULL;
+
+namespace
+{
+
+// frames of onSignal() itself and of the signal trampoline.
+const int skipped_frames = 2;
+
+bool setTimer(uint32_t hz)
+{
+    itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = hz ? 1000000 / hz : 0;
+    timer.it_value = timer.it_interval;
+    return setitimer(ITIMER_PROF, &timer, NULL) == 0;
+}
+
+std::string threadName(pid_t tid)
+{
+    std::ifstream in(("/proc/self/task/" + boost::lexical_cast<std::string>(tid) + "/comm").c_str());
+    std::string name;
+    if (!std::getline(in, name) || name.empty()) {
+        name = "thread";
+    }
+    return name;
+}
+
+std::string frameName(void* frame)
+{
+    Dl_info info;
+    if (dladdr(frame, &info) == 0 || info.dli_fname == NULL) {
+        std::ostringstream out;
+        out << frame;
+        return out.str();
+    }
+    std::string res;
+    if (info.dli_sname) {
+        int status = 0;
+        char* demangled = abi::__cxa_demangle(info.dli_sname, NULL, NULL, &status);
+        res = status == 0 && demangled ? demangled : info.dli_sname;
+        std::free(demangled);
+    } else {
+        const char* module = std::strrchr(info.dli_fname, '/');
+        std::ostringstream out;
+        out << (module ? module + 1 : info.dli_fname) << "+0x" << std::hex
+            << (static_cast<char*>(frame) - static_cast<char*>(info.dli_fbase));
+        res = out.str();
+    }
+    std::replace(res.begin(), res.end(), ';', ':');  // separator of folded stacks
+    return res;
+}
+
+}
+
+Profiler::Status Profiler::profile(uint32_t seconds, uint32_t hz, bool byThread, std::string& folded)
+{
+    if (running.exchange(true)) {
+        return status_running;
+    }
+    if (!prepare()) {
+        running.store(false);
+        return status_failed;
+    }
+    LOG(INFO) << "profiling for " << seconds << "s at " << hz << "hz";
+    sampleNum.store(0);
+    collecting.store(true);
+    if (!setTimer(hz)) {
+        LOG(ERROR) << "failed on setitimer: " << std::strerror(errno);
+        collecting.store(false);
+        running.store(false);
+        return status_failed;
+    }
+    boost::this_thread::sleep(boost::posix_time::seconds(seconds));
+    setTimer(0);
+    collecting.store(false);
+    // handlers entered just before may still be writing their samples.
+    boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+
+    folded = fold(sampleNum.load(), byThread);
+    running.store(false);
+    return status_ok;
+}
+
+// the handler is installed once and kept, so that a SIGPROF pending after the timer is stopped
+// doesn't fall to the default action, which terminates.
+bool Profiler::prepare()
+{
+    if (samples) {
+        return true;
+    }
+    // backtrace() loads libgcc on its first call, which is not safe in a signal handler.
+    void* frames[1];
+    backtrace(frames, 1);
+
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_sigaction = &Profiler::onSignal;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, NULL) != 0) {
+        LOG(ERROR) << "failed on installing SIGPROF handler: " << std::strerror(errno);
+        return false;
+    }
+    samples = new Sample[max_samples];
+    return true;
+}
+
+// NOTE: async-signal-safe only.
+void Profiler::onSignal(int signo, siginfo_t* info, void* context)
+{
+    if (!collecting.load(boost::memory_order_relaxed)) {
+        return;
+    }
+    std::size_t slot = sampleNum.fetch_add(1, boost::memory_order_relaxed);
+    if (slot >= max_samples) {
+        return;
+    }
+    int savedErrno = errno;
+    Sample& sample = samples[slot];
+    sample.tid = syscall(SYS_gettid);
+    sample.depth = backtrace(sample.frames, max_depth);
+    errno = savedErrno;
+}
+
+std::string Profiler::fold(std::size_t num, bool byThread)
+{
+    std::map<std::string, uint64_t> stacks;
+    std::map<void*, std::string> frameNames;
+    std::map<pid_t, std::string> threadNames;
+    for (std::size_t i = 0; i < std::min<std::size_t>(num, max_samples); ++i) {
+        const Sample& sample = samples[i];
+        std::map<pid_t, std::string>::iterator thread = threadNames.find(sample.tid);
+        if (thread == threadNames.end()) {
+            std::string name = threadName(sample.tid);
+            if (byThread) {
+                name += '-' + boost::lexical_cast<std::string>(sample.tid);
+            }
+            thread = threadNames.insert(std::make_pair(sample.tid, name)).first;
+        }
+        std::string stack = thread->second;
+        for (int j = sample.depth - 1; j >= skipped_frames; --j) {
+            std::map<void*, std::string>::iterator frame = frameNames.find(sample.frames[j]);
+            if (frame == frameNames.end()) {
+                frame = frameNames.insert(std::make_pair(sample.frames[j], frameName(sample.frames[j]))).first;
+            }
+            stack += ';';
+            stack += frame->second;
+        }
+        ++stacks[stack];
+    }
+
+    std::ostringstream out;
+    for (std::map<std::string, uint64_t>::const_iterator it = stacks.begin(); it != stacks.end(); ++it) {
+        out << it->first << ' ' << it->second << '\n';
+    }
+    if (num > max_samples) {
+        out << "[lost] " << num - max_samples << '\n';
+    }
+    return out.str();
+}
+
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "predef.hpp"
+#include <string>
+#include <signal.h>
+#include <sys/types.h>
+#include <boost/atomic.hpp>
+
+namespace taboo
+{
+
+// in-process cpu profiler behind /manage/profile.
+// ITIMER_PROF raises SIGPROF every 1/@hz second of cpu time the process spends, and each signal records
+// the stack of the thread it interrupts into a buffer allocated once; stacks are folded afterwards into
+// lines of "thread;outermost;...;innermost count", the input of flamegraph.pl.
+// overhead is bounded: at most max_hz samples per cpu second, each a backtrace() of max_depth frames,
+// samples finding the buffer full are only counted, as "[lost]".
+// NOTE: frames are named by dladdr(), which needs taboo linked with -rdynamic, others are left as
+// "module+offset" for addr2line.
+class Profiler
+{
+public:
+    enum {
+        max_seconds = 60,
+        max_hz = 1000,
+        default_hz = 99,    // off beat of periodic work
+        max_depth = 64,
+        max_samples = 1 << 16,
+    };
+
+    enum Status {
+        status_ok,
+        status_running,     // another profile in progress
+        status_failed,
+    };
+
+private:
+    class Sample
+    {
+    public:
+        pid_t tid;
+        int depth;
+        void* frames[max_depth];
+    };
+
+    static boost::atomic<bool> running;     // a profile in progress
+    static boost::atomic<bool> collecting;  // checked by signal handler
+    static boost::atomic<std::size_t> sampleNum;   // claimed, may go beyond max_samples
+    static Sample* samples;
+
+public:
+    // blocks for @seconds, then fills @folded; stacks of threads of the same name are merged
+    // unless @byThread.
+    static Status profile(uint32_t seconds, uint32_t hz, bool byThread, std::string& folded);
+
+private:
+    static bool prepare();
+
+    static void onSignal(int signo, siginfo_t* info, void* context);
+
+    static std::string fold(std::size_t num, bool byThread);
+};
+
+}
@@ -4,19 +4,57 @@
 #include "predef.hpp"
 #include <algorithm>
 #include <string>
+#include <vector>
 #include <boost/unordered_set.hpp>
+#include <boost/lexical_cast.hpp>
 #include "rapidjson/error/en.h"
+#include "rapidjson/writer.h"
+#include "rapidjson/stringbuffer.h"
 #include "stage/hash.hpp"
 #include "stage/math.hpp"
 #include "Aside.hpp"
 #include "Session.hpp"
+#include "Latency.hpp"
 
 namespace taboo {
 
+// work done answering a query, counted as it goes so that slow queries can be told apart.
+class QueryWork
+{
+public:
+    uint64_t keys;          // keys under the prefix visited in trie
+    uint64_t funnels;       // funnels iterated, bounded by @max-iterations per shard
+    uint64_t candidates;    // items taken from funnels
+    uint64_t rejected;      // candidates expired, filtered out, or outscored by those kept
+    uint64_t items;         // items serialized into reply
+    uint64_t bytes;         // of reply
+
+    QueryWork()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        keys = funnels = candidates = rejected = items = bytes = 0;
+    }
+
+    void merge(const QueryWork& other)
+    {
+        keys += other.keys;
+        funnels += other.funnels;
+        candidates += other.candidates;
+        rejected += other.rejected;
+        items += other.items;
+        bytes += other.bytes;
+    }
+};
+
 class Query
 {
 private:
     Dom body;
+    std::string _fingerprint;
 
 public:
     ValuePtrSet fields;
@@ -26,6 +64,18 @@ public:
     std::size_t num;
     bool fieldsAll;
 
+    // parts of fingerprint(), in the order they're joined.
+    enum FingerprintPart {
+        part_prefix,
+        part_filters,
+        part_excludes,
+        part_fields,
+        part_num,
+        fingerprint_parts,
+    };
+
+    typedef std::pair<const char*, std::size_t> Span;
+
 public:
     Query():
         echoData(NULL), filters(NULL), excludes(NULL), num(0)
@@ -34,6 +84,7 @@ public:
 public:
     bool rebuild(const std::string& str)
     {
+        Latency::Timer timer(Latency::metric_query_parse);
         if (!body.IsNull()) {
             body.SetNull();
         }
@@ -47,6 +98,8 @@ public:
             return false;
         }
 
+        _fingerprint.clear();
+
         prefix.clear();
         {
             Dom::ConstMemberIterator it = body.FindMember(Aside::instance()->keyQUPrefix);
@@ -152,6 +205,49 @@ public:
         return true;
     }
 
+    // splits @fingerprint, as fingerprint() forms it, back into @parts indexed by FingerprintPart.
+    static void splitFingerprint(const std::string& fingerprint, Span parts[fingerprint_parts])
+    {
+        const char* const end = fingerprint.data() + fingerprint.length();
+        const char* begin = fingerprint.data();
+        for (std::size_t i = 0; i < fingerprint_parts; ++i) {
+            const char* sep = std::find(begin, end, '\0');
+            parts[i] = Span(begin, sep - begin);
+            begin = (sep == end) ? end : sep + 1;
+        }
+    }
+
+    // normalized form of query, everything but echo-data, its parts are joined by '\0'.
+    const std::string& fingerprint()
+    {
+        if (_fingerprint.empty()) {
+            _fingerprint.reserve(prefix.length() + 64);
+            _fingerprint += prefix;
+            _fingerprint += '\0';
+            serialize(_fingerprint, filters);
+            _fingerprint += '\0';
+            serialize(_fingerprint, excludes);
+            _fingerprint += '\0';
+            if (fieldsAll) {
+                _fingerprint += '*';
+            } else {
+                std::vector<std::string> names;
+                names.reserve(fields.size());
+                for (ValuePtrSet::const_iterator it = fields.begin(); it != fields.end(); ++it) {
+                    names.push_back(std::string((*it)->GetString(), (*it)->GetStringLength()));
+                }
+                std::sort(names.begin(), names.end());
+                for (std::vector<std::string>::const_iterator it = names.begin(); it != names.end(); ++it) {
+                    _fingerprint += *it;
+                    _fingerprint += ',';
+                }
+            }
+            _fingerprint += '\0';
+            _fingerprint += boost::lexical_cast<std::string>(num);
+        }
+        return _fingerprint;
+    }
+
     void reviseFields()
     {
         const Aside* const aside = Aside::instance();
@@ -184,6 +280,16 @@ public:
         }
     }
 
+    static void serialize(std::string& out, const Value* value)
+    {
+        if (value) {
+            rapidjson::StringBuffer buffer;
+            rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+            value->Accept(writer);
+            out.append(buffer.GetString(), buffer.GetSize());
+        }
+    }
+
     static bool prefixValid(const Value& _prefix)
     {
         return stage::between<std::size_t>(_prefix.GetStringLength(), Config::instance()->prefixMinLen, Config::instance()->prefixMaxLen);
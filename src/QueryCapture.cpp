@@ -0,0 +1,138 @@
+
+#include "QueryCapture.hpp"
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <glog/logging.h>
+#include "Latency.hpp"
+#include "Hasher.hpp"
+
+namespace taboo
+{
+
+QueryCapture* QueryCapture::_instance = NULL;
+
+namespace
+{
+
+const char magic[4] = {'T', 'B', 'Q', 'C'};
+
+// copies at most @size of @length bytes at @data, returns true if truncated.
+bool copyField(const char* data, std::size_t length, char* to, uint8_t& toLength, std::size_t size)
+{
+    std::size_t copied = std::min(length, size);
+    std::memcpy(to, data, copied);
+    toLength = copied;
+    return copied < length;
+}
+
+template <typename Number>
+void writeNumber(std::ofstream& out, Number number)
+{
+    out.write(reinterpret_cast<const char*>(&number), sizeof(number));
+}
+
+}
+
+bool QueryCapture::initialize()
+{
+    const Config* config = Config::instance();
+    if (config->queryCaptureEvery == 0) {
+        return true;
+    }
+    std::ofstream out(config->queryCaptureLog.c_str(), std::ios::app | std::ios::binary);
+    if (!out) {
+        LOG(ERROR) << "failed on open query capture log " << config->queryCaptureLog;
+        return false;
+    }
+    if (out.tellp() == 0) {
+        out.write(magic, sizeof(magic));
+        writeNumber(out, static_cast<uint32_t>(version));
+    }
+    LOG(INFO) << "capturing one in " << config->queryCaptureEvery << " queries into " << config->queryCaptureLog;
+    _instance = new QueryCapture(config);
+    _instance->writer = new boost::thread(boost::bind(&QueryCapture::writeLoop, _instance));
+    return true;
+}
+
+QueryCapture::QueryCapture(const Config* config):
+    every(config->queryCaptureEvery),
+    path(config->queryCaptureLog.string()),
+    queue(queue_size),
+    captured(0),
+    dropped(0),
+    writer(NULL)
+{}
+
+QueryCapture::Sampler* QueryCapture::attach()
+{
+    Sampler* sampler = new Sampler;
+    // seeded apart per thread, never 0.
+    sampler->state = (reinterpret_cast<uintptr_t>(sampler) ^ Latency::now()) | 1;
+    sampler->countdown = gap(*sampler);
+    samplerHolder.reset(sampler);
+    return sampler;
+}
+
+void QueryCapture::push(Query& query, uint64_t ticks, const QueryWork& work, bool cacheHit)
+{
+    Query::Span parts[Query::fingerprint_parts];
+    Query::splitFingerprint(query.fingerprint(), parts);
+    const Query::Span& prefix = parts[Query::part_prefix];
+    const Query::Span& fields = parts[Query::part_fields];
+    // filters and excludes are hashed together, with the separator between them.
+    const char* const filters = parts[Query::part_filters].first;
+    const std::size_t filtersLength = parts[Query::part_excludes].first + parts[Query::part_excludes].second
+        - filters;
+
+    Record record;
+    record.time = std::time(NULL);
+    record.micros = Latency::toMicros(ticks);
+    record.results = work.items;
+    record.num = query.num;
+    record.filters = 0;
+    if (filtersLength > 1) {
+        record.filters = PrefixHasher()(filters, filtersLength);
+    }
+    record.flags = cacheHit ? flag_cache_hit : 0;
+    if (copyField(prefix.first, prefix.second, record.prefix, record.prefixLength, prefix_size)
+        | copyField(fields.first, fields.second, record.fields, record.fieldsLength, fields_size)) {
+        record.flags |= flag_truncated;
+    }
+
+    if (!queue.bounded_push(record)) {
+        dropped.fetch_add(1, boost::memory_order_relaxed);
+    }
+}
+
+void QueryCapture::writeLoop()
+{
+    std::ofstream out(path.c_str(), std::ios::app | std::ios::binary);
+    while (true) {
+        Record record;
+        std::size_t num = 0;
+        while (queue.pop(record)) {
+            writeNumber(out, record.time);
+            writeNumber(out, record.micros);
+            writeNumber(out, record.results);
+            writeNumber(out, record.num);
+            writeNumber(out, record.filters);
+            writeNumber(out, record.flags);
+            writeNumber(out, record.prefixLength);
+            out.write(record.prefix, record.prefixLength);
+            writeNumber(out, record.fieldsLength);
+            out.write(record.fields, record.fieldsLength);
+            ++num;
+        }
+        if (num) {
+            out.flush();
+            captured.fetch_add(num, boost::memory_order_relaxed);
+        } else {
+            boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+        }
+    }
+}
+
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "predef.hpp"
+#include <string>
+#include <boost/atomic.hpp>
+#include <boost/lockfree/queue.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/tss.hpp>
+#include "Config.hpp"
+#include "Query.hpp"
+
+namespace taboo
+{
+
+// samples about one in @query-capture-every queries into @query-capture-log, a compact binary log of
+// real traffic, for replaying (taboo-loadgen --replay) and analysing cache hit ratio offline.
+// each query thread counts down a random gap to its next sample, so an unsampled query costs a
+// decrement; a sampled one is copied into a fixed-size record in a bounded lock-free queue, which a
+// background thread drains into the log. records finding the queue full are counted as dropped.
+//
+// log is a header of magic "TBQC" and uint32 version, then records of, in host byte order:
+//   uint32 time, uint32 micros, uint32 results, uint32 num, uint64 filters, uint8 flags,
+//   uint8 prefix length, prefix, uint8 fields length, fields
+// where filters is FNV-1a of filters and excludes (0 if neither), fields is '*' or sorted names
+// joined by ',', results is the num of items replied (unknown, 0, for cache hits).
+class QueryCapture
+{
+public:
+    enum { version = 1 };
+
+    enum Flag {
+        flag_cache_hit      = 1,
+        flag_truncated      = 2,    // prefix or fields longer than a record holds
+    };
+
+private:
+    enum {
+        queue_size = 4096,
+        prefix_size = 128,
+        fields_size = 128,
+    };
+
+    class Record
+    {
+    public:
+        uint32_t time;
+        uint32_t micros;
+        uint32_t results;
+        uint32_t num;
+        uint64_t filters;
+        uint8_t flags;
+        uint8_t prefixLength;
+        uint8_t fieldsLength;
+        char prefix[prefix_size];
+        char fields[fields_size];
+    };
+
+    // of a query thread.
+    class Sampler
+    {
+    public:
+        uint32_t countdown;
+        uint64_t state;     // of xorshift64
+    };
+
+    static QueryCapture* _instance;
+
+    const uint32_t every;
+    const std::string path;
+
+    boost::lockfree::queue<Record> queue;
+    boost::thread_specific_ptr<Sampler> samplerHolder;
+
+    boost::atomic<uint64_t> captured, dropped;
+
+    boost::thread* writer;
+
+public:
+    static QueryCapture* instance()
+    {
+        return _instance;
+    }
+
+    // not created if @query-capture-every is 0.
+    static bool initialize();
+
+    // NOTE: called by query workers, for every query.
+    void sample(Query& query, uint64_t ticks, const QueryWork& work, bool cacheHit)
+    {
+        Sampler& sampler = local();
+        if (CS_BLIKELY(--sampler.countdown)) {
+            return;
+        }
+        sampler.countdown = gap(sampler);
+        push(query, ticks, work, cacheHit);
+    }
+
+    uint64_t numCaptured() const
+    {
+        return captured.load(boost::memory_order_relaxed);
+    }
+
+    uint64_t numDropped() const
+    {
+        return dropped.load(boost::memory_order_relaxed);
+    }
+
+private:
+    explicit QueryCapture(const Config* config);
+
+    Sampler& local()
+    {
+        Sampler* res = samplerHolder.get();
+        if (CS_BUNLIKELY(res == NULL)) {
+            res = attach();
+        }
+        return *res;
+    }
+
+    Sampler* attach();
+
+    // uniform in [1, 2 * @every - 1], so that one in @every is sampled on average without
+    // locking onto a period of the traffic.
+    uint32_t gap(Sampler& sampler) const
+    {
+        sampler.state ^= sampler.state << 13;
+        sampler.state ^= sampler.state >> 7;
+        sampler.state ^= sampler.state << 17;
+        return 1 + sampler.state % (2 * static_cast<uint64_t>(every) - 1);
+    }
+
+    void push(Query& query, uint64_t ticks, const QueryWork& work, bool cacheHit);
+
+    void writeLoop();
+};
+
+}
@@ -0,0 +1,489 @@
+
+#include "Replication.hpp"
+extern "C" {
+#   include <fcntl.h>
+#   include <unistd.h>
+#   include <sys/stat.h>
+}
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <boost/bind.hpp>
+#include <boost/crc.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/chrono.hpp>
+#include "Snapshot.hpp"
+#include "Keeper.hpp"
+
+namespace taboo
+{
+
+namespace
+{
+
+using boost::asio::ip::tcp;
+
+const uint32_t replication_magic = 0x50524254;  // "TBRP"
+
+// first message of follower.
+class Hello
+{
+public:
+    uint32_t magic, shards;
+    lsn_t lsn;
+    uint32_t acceptSnapshot, reserved;
+};
+
+// replies of leader to hello.
+enum Mode {
+    mode_wal        = 0,    // wal after lsn of hello is there
+    mode_snapshot   = 1,    // followed by snapshot of leader, then wal after it is there
+    mode_behind     = 2,    // wal after lsn of hello is purged, but follower doesn't accept snapshot
+    mode_refused    = 3,    // bad hello, mismatched shards or follower ahead of leader
+};
+
+// records are framed as in wal, a frame of 0 length is a heartbeat followed by last lsn of leader.
+const uint32_t heartbeat_header[2] = {0, 0};
+
+const long heartbeat_millis = 1000;
+const std::size_t batch_bytes = 1 << 20;
+const std::size_t chunk_size = 1 << 16;
+
+template<typename T>
+inline void send(tcp::socket& socket, const T& value)
+{
+    boost::asio::write(socket, boost::asio::buffer(&value, sizeof(value)));
+}
+
+template<typename T>
+inline void receive(tcp::socket& socket, T& value)
+{
+    boost::asio::read(socket, boost::asio::buffer(&value, sizeof(value)));
+}
+
+// keeps snapshot files of leader in place while they're sent, or of follower while they're replaced
+// by those of leader. nothing is stored before Snapshot is initialized, there's nothing to pin then.
+class SnapshotPin
+{
+public:
+    SnapshotPin()
+    {
+        while (Snapshot::instance() && !Snapshot::instance()->pin()) {
+            boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+        }
+    }
+
+    ~SnapshotPin()
+    {
+        if (Snapshot::instance()) {
+            Snapshot::instance()->unpin();
+        }
+    }
+};
+
+bool parseEndpoint(const std::string& address, tcp::endpoint& endpoint)
+{
+    std::size_t colon = address.rfind(':');
+    if (colon == address.npos) {
+        return false;
+    }
+    boost::system::error_code err;
+    boost::asio::ip::address host = boost::asio::ip::address::from_string(address.substr(0, colon), err);
+    if (err) {
+        return false;
+    }
+    try {
+        endpoint = tcp::endpoint(host, boost::lexical_cast<unsigned short>(address.substr(colon + 1)));
+    } catch (const boost::bad_lexical_cast&) {
+        return false;
+    }
+    return true;
+}
+
+}
+
+Shipper* Shipper::_instance = NULL;
+
+bool Shipper::initialize()
+{
+    const Config* config = Config::instance();
+    if (!config->replicationPort) {
+        return true;
+    }
+    _instance = new Shipper(config);
+    _instance->listener = new boost::thread(boost::bind(&Shipper::listen, _instance));
+    LOG(INFO) << "shipping wal to followers on " << config->replicationHost << ":" << config->replicationPort;
+    return true;
+}
+
+Shipper::Shipper(const Config* _config):
+    config(_config),
+    acceptor(service),
+    listener(NULL)
+{
+    tcp::endpoint endpoint(boost::asio::ip::address::from_string(config->replicationHost), config->replicationPort);
+    boost::system::error_code err;
+    acceptor.open(endpoint.protocol(), err);
+    if (!err) {
+        acceptor.set_option(tcp::acceptor::reuse_address(config->reuseAddress), err);
+        acceptor.bind(endpoint, err);
+    }
+    if (!err) {
+        acceptor.listen(boost::asio::socket_base::max_connections, err);
+    }
+    if (err) {
+        CS_DIE("failed on listening " << endpoint << " for replication: " << err.message());
+    }
+}
+
+Shipper::PeerList Shipper::followers() const
+{
+    PeerList res;
+    boost::mutex::scoped_lock lock(peersMutex);
+    for (std::list<Peer*>::const_iterator it = peers.begin(); it != peers.end(); ++it) {
+        res.push_back(std::make_pair((*it)->address, (*it)->acked.load()));
+    }
+    return res;
+}
+
+void Shipper::listen()
+{
+    while (true) {
+        boost::shared_ptr<tcp::socket> socket(new tcp::socket(service));
+        boost::system::error_code err;
+        acceptor.accept(*socket, err);
+        if (err) {
+            LOG(ERROR) << "failed on accepting follower: " << err.message();
+            boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+            continue;
+        }
+        boost::thread(boost::bind(&Shipper::serve, this, socket)).detach();
+    }
+}
+
+void Shipper::serve(boost::shared_ptr<tcp::socket> socket)
+{
+    Wal* wal = Wal::instance();
+    Snapshot* snapshot = Snapshot::instance();
+    boost::system::error_code err;
+    const std::string address = boost::lexical_cast<std::string>(socket->remote_endpoint(err));
+    lsn_t held = 0;
+    bool holding = false;
+    Peer peer(address);
+    {
+        boost::mutex::scoped_lock lock(peersMutex);
+        peers.push_back(&peer);
+    }
+    try {
+        Hello hello;
+        receive(*socket, hello);
+        if (hello.magic != replication_magic || hello.shards != config->indexShards || wal->last() < hello.lsn) {
+            LOG(WARNING) << "refused follower " << address << " at lsn " << hello.lsn
+                << " with " << hello.shards << " shards";
+            send<uint8_t>(*socket, mode_refused);
+            throw std::runtime_error("refused");
+        }
+        // retained before checking against wal, so that no purge slips in between.
+        held = hello.lsn;
+        wal->retain(held);
+        holding = true;
+        if (hello.lsn < snapshot->lsn() && !wal->covers(hello.lsn)) {
+            if (!hello.acceptSnapshot) {
+                send<uint8_t>(*socket, mode_behind);
+                throw std::runtime_error("behind wal");
+            }
+            lsn_t lsn = sendSnapshot(*socket);
+            wal->retain(lsn);
+            wal->release(held);
+            held = lsn;
+        } else {
+            send<uint8_t>(*socket, mode_wal);
+        }
+
+        lsn_t start;
+        receive(*socket, start);
+        if (start < held) {
+            throw std::runtime_error("start before lsn told");
+        }
+        wal->retain(start);
+        wal->release(held);
+        held = start;
+        peer.acked = start;
+        LOG(INFO) << "shipping wal after lsn " << start << " to follower " << address;
+        ship(*socket, peer, held);
+    } catch (const std::exception& e) {
+        LOG(WARNING) << "stopped shipping wal to follower " << address << ": " << e.what();
+    }
+    if (holding) {
+        wal->release(held);
+    }
+    boost::mutex::scoped_lock lock(peersMutex);
+    peers.remove(&peer);
+}
+
+lsn_t Shipper::sendSnapshot(tcp::socket& socket)
+{
+    SnapshotPin pin;
+    lsn_t lsn = Snapshot::instance()->lsn();
+    std::vector<std::string> files = Snapshot::files(config);
+    send<uint8_t>(socket, mode_snapshot);
+    send(socket, lsn);
+    send<uint32_t>(socket, files.size());
+    std::vector<char> chunk(chunk_size);
+    for (std::vector<std::string>::const_iterator it = files.begin(); it != files.end(); ++it) {
+        int fd = ::open(it->c_str(), O_RDONLY);
+        struct stat st;
+        if (fd == -1 || fstat(fd, &st) != 0) {
+            throw std::runtime_error("failed on opening " + *it + ": " + std::strerror(errno));
+        }
+        uint64_t remain = st.st_size;
+        send(socket, remain);
+        while (remain) {
+            ssize_t got = ::read(fd, &chunk[0], std::min<uint64_t>(remain, chunk.size()));
+            if (got <= 0) {
+                ::close(fd);
+                throw std::runtime_error("failed on reading " + *it);
+            }
+            boost::asio::write(socket, boost::asio::buffer(&chunk[0], got));
+            remain -= got;
+        }
+        ::close(fd);
+    }
+    LOG(INFO) << "sent snapshot at lsn " << lsn << " in " << files.size() << " files";
+    return lsn;
+}
+
+void Shipper::ship(tcp::socket& socket, Peer& peer, lsn_t& held)
+{
+    Wal* wal = Wal::instance();
+    WalReader reader(*wal, held);
+    std::string batch;
+    lsn_t lsn;
+    while (true) {
+        // waits for records only when there's nothing to send, a heartbeat is sent anyway.
+        batch.clear();
+        while (batch.length() < batch_bytes && reader.next(batch, lsn, batch.empty() ? heartbeat_millis : 0)) {}
+        if (reader.isBroken()) {
+            throw std::runtime_error("broken wal");
+        }
+        lsn_t last = wal->last();
+        batch.append(reinterpret_cast<const char*>(heartbeat_header), sizeof(heartbeat_header));
+        batch.append(reinterpret_cast<const char*>(&last), sizeof(last));
+        boost::asio::write(socket, boost::asio::buffer(batch));
+
+        lsn_t acked = held;
+        while (socket.available() >= sizeof(acked)) {
+            receive(socket, acked);
+        }
+        if (held < acked) {
+            wal->retain(acked);
+            wal->release(held);
+            held = acked;
+            peer.acked = acked;
+        }
+    }
+}
+
+Follower* Follower::_instance = NULL;
+
+bool Follower::initialize()
+{
+    const Config* config = Config::instance();
+    if (config->replicateFrom.empty()) {
+        return true;
+    }
+    tcp::endpoint leader;
+    if (!parseEndpoint(config->replicateFrom, leader)) {
+        CS_DIE("bad replicate-from: " << config->replicateFrom);
+    }
+    _instance = new Follower(config, leader);
+    // local wal may go further than local snapshot, follow() asks for what's after it.
+    if (!_instance->handshake(Snapshot::peek(config), true)) {
+        LOG(WARNING) << "leader " << config->replicateFrom << " is not reachable, starts with local snapshot";
+    }
+    return true;
+}
+
+bool Follower::follow()
+{
+    if (_instance) {
+        lsn_t lsn = Snapshot::instance()->lsn();
+        if (Wal::instance()) {
+            lsn = std::max(lsn, Wal::instance()->last());
+        }
+        _instance->applied = lsn;
+        _instance->receiver = new boost::thread(boost::bind(&Follower::run, _instance));
+    }
+    return true;
+}
+
+Follower::Follower(const Config* _config, const tcp::endpoint& _leader):
+    config(_config), leader(_leader),
+    applied(0), leaderLsn(0), connected(false), caughtUpAt(now()), receiver(NULL)
+{}
+
+std::string Follower::address() const
+{
+    return boost::lexical_cast<std::string>(leader);
+}
+
+int64_t Follower::lagMillis() const
+{
+    return applied.load() < leaderLsn.load() ? now() - caughtUpAt.load() : 0;
+}
+
+bool Follower::handshake(lsn_t lsn, bool acceptSnapshot)
+{
+    socket.reset(new tcp::socket(service));
+    boost::system::error_code err;
+    socket->connect(leader, err);
+    if (err) {
+        socket.reset();
+        return false;
+    }
+    socket->set_option(tcp::no_delay(true), err);
+
+    Hello hello;
+    std::memset(&hello, 0, sizeof(hello));
+    hello.magic = replication_magic;
+    hello.shards = config->indexShards;
+    hello.lsn = lsn;
+    hello.acceptSnapshot = acceptSnapshot;
+    send(*socket, hello);
+    uint8_t mode;
+    receive(*socket, mode);
+    switch (mode) {
+    case mode_wal:
+        break;
+    case mode_snapshot:
+        receiveSnapshot();
+        break;
+    case mode_behind:
+        throw std::runtime_error("behind wal of leader, which sends no snapshot");
+    default:
+        CS_DIE("refused by leader " << config->replicateFrom << " at lsn " << lsn
+            << ", check @index-shards of both, or if it's another leader");
+        break;
+    }
+    return true;
+}
+
+void Follower::receiveSnapshot()
+{
+    SnapshotPin pin;
+    lsn_t lsn;
+    uint32_t num;
+    receive(*socket, lsn);
+    receive(*socket, num);
+    uint64_t generation;
+    std::vector<std::string> files = Snapshot::stage(config, generation);
+    if (num != files.size()) {
+        CS_DIE("snapshot of leader has " << num << " files, expected " << files.size());
+    }
+    std::vector<char> chunk(chunk_size);
+    for (std::vector<std::string>::const_iterator it = files.begin(); it != files.end(); ++it) {
+        uint64_t remain;
+        receive(*socket, remain);
+        FILE* fp = std::fopen(it->c_str(), "wb");
+        if (fp == NULL) {
+            CS_DIE("failed on opening " << *it << ": " << std::strerror(errno));
+        }
+        while (remain) {
+            std::size_t size = std::min<uint64_t>(remain, chunk.size());
+            boost::asio::read(*socket, boost::asio::buffer(&chunk[0], size));
+            if (std::fwrite(&chunk[0], 1, size, fp) != size) {
+                CS_DIE("failed on writing " << *it << ": " << std::strerror(errno));
+            }
+            remain -= size;
+        }
+        if (std::fflush(fp) != 0 || fsync(fileno(fp)) != 0 || std::fclose(fp) != 0) {
+            CS_DIE("failed on writing " << *it << ": " << std::strerror(errno));
+        }
+    }
+    if (!Snapshot::install(config, generation)) {
+        CS_DIE("failed on installing snapshot of leader into " << config->itemsFile << ": "
+            << std::strerror(errno));
+    }
+    LOG(INFO) << "fetched snapshot at lsn " << lsn << " from leader " << config->replicateFrom;
+
+    // while following, what's restored is replaced in place, before that it's restored as usual.
+    if (Snapshot::instance()) {
+        if (!Snapshot::instance()->reload()) {
+            CS_DIE("failed on reloading snapshot of leader from " << config->itemsFile);
+        }
+        if (Wal::instance()) {
+            Wal::instance()->skipTo(lsn);
+            Wal::instance()->purge(lsn);
+        }
+        applied = lsn;
+    }
+}
+
+void Follower::run()
+{
+    while (true) {
+        try {
+            if (socket || handshake(applied, true)) {
+                send(*socket, applied.load());
+                connected = true;
+                LOG(INFO) << "following leader " << config->replicateFrom << " after lsn " << applied;
+                stream();
+            }
+        } catch (const std::exception& e) {
+            LOG(WARNING) << "lost leader " << config->replicateFrom << ": " << e.what();
+        }
+        connected = false;
+        socket.reset();
+        boost::this_thread::sleep(boost::posix_time::milliseconds(heartbeat_millis));
+    }
+}
+
+void Follower::stream()
+{
+    Keeper* keeper = Keeper::instance();
+    WalRecordList records;
+    std::vector<char> body;
+    while (true) {
+        uint32_t header[2];
+        receive(*socket, header);
+        if (header[0] == 0) {
+            lsn_t last;
+            receive(*socket, last);
+            if (!records.empty()) {
+                keeper->replay(records);
+                applied = records.back().lsn;
+                records.clear();
+                send(*socket, applied.load());
+            }
+            leaderLsn = std::max(last, applied.load());
+            if (leaderLsn.load() <= applied.load()) {
+                caughtUpAt = now();
+            }
+            continue;
+        }
+        if (WalReader::max_record_size < header[0]) {
+            throw std::runtime_error("bad record length");
+        }
+        body.resize(header[0]);
+        boost::asio::read(*socket, boost::asio::buffer(&body[0], body.size()));
+        boost::crc_32_type crc32;
+        crc32.process_bytes(&body[0], body.size());
+        records.push_back(WalRecord());
+        if (crc32.checksum() != header[1] || !records.back().decode(&body[0], body.size())) {
+            throw std::runtime_error("bad record");
+        }
+        if (records.back().lsn <= applied.load()) {
+            records.pop_back();
+        }
+    }
+}
+
+int64_t Follower::now()
+{
+    return boost::chrono::duration_cast<boost::chrono::milliseconds>(
+        boost::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "predef.hpp"
+#include <string>
+#include <list>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include "Config.hpp"
+#include "Wal.hpp"
+
+namespace taboo
+{
+
+// leader side of replication: streams wal to followers connected to @replication-port.
+// a follower tells the lsn of its snapshot, and is sent the snapshot of leader first if wal of
+// leader doesn't go back that far. then, restored, it tells the lsn it has got to and is streamed
+// every record after that, as they're written. records not acknowledged by connected followers
+// are retained in wal.
+class Shipper
+{
+public:
+    // a connected follower.
+    class Peer
+    {
+    public:
+        const std::string address;
+        boost::atomic<lsn_t> acked;
+
+        explicit Peer(const std::string& _address):
+            address(_address), acked(0)
+        {}
+    };
+
+    typedef std::vector<std::pair<std::string, lsn_t> > PeerList;
+
+private:
+    static Shipper* _instance;
+
+    const Config* config;
+
+    boost::asio::io_service service;
+    boost::asio::ip::tcp::acceptor acceptor;
+
+    mutable boost::mutex peersMutex;
+    std::list<Peer*> peers;
+
+    boost::thread* listener;
+
+public:
+    static Shipper* instance()
+    {
+        return _instance;
+    }
+
+    static bool initialize();
+
+    // addresses and acknowledged lsns of connected followers.
+    PeerList followers() const;
+
+private:
+    explicit Shipper(const Config* _config);
+
+    void listen();
+
+    void serve(boost::shared_ptr<boost::asio::ip::tcp::socket> socket);
+
+    // returns lsn of the snapshot sent.
+    lsn_t sendSnapshot(boost::asio::ip::tcp::socket& socket);
+
+    void ship(boost::asio::ip::tcp::socket& socket, Peer& peer, lsn_t& held);
+};
+
+// follower side of replication: applies wal of @replicate-from to own index (and own wal, so that
+// it restarts from where it was), manage requests writing index are rejected.
+class Follower
+{
+private:
+    static Follower* _instance;
+
+    const Config* config;
+    const boost::asio::ip::tcp::endpoint leader;
+
+    boost::asio::io_service service;
+    boost::scoped_ptr<boost::asio::ip::tcp::socket> socket;
+
+    boost::atomic<lsn_t> applied, leaderLsn;
+    boost::atomic<bool> connected;
+    boost::atomic<int64_t> caughtUpAt;  // milliseconds since epoch, when @applied last reached leader
+
+    boost::thread* receiver;
+
+public:
+    static Follower* instance()
+    {
+        return _instance;
+    }
+
+    // connects to leader before index is restored, and replaces the local snapshot with the one
+    // of leader if it's too old to catch up from wal of leader. once following, a snapshot of
+    // leader sent on reconnecting is reloaded in place.
+    static bool initialize();
+
+    // starts applying wal of leader after what's restored.
+    static bool follow();
+
+    std::string address() const;
+
+    bool isConnected() const
+    {
+        return connected.load();
+    }
+
+    lsn_t appliedLsn() const
+    {
+        return applied.load();
+    }
+
+    lsn_t leaderLastLsn() const
+    {
+        return leaderLsn.load();
+    }
+
+    // how long since it was last in sync with leader, 0 if it's in sync.
+    int64_t lagMillis() const;
+
+private:
+    Follower(const Config* _config, const boost::asio::ip::tcp::endpoint& _leader);
+
+    // connects and tells leader @lsn, false if leader is not reachable.
+    bool handshake(lsn_t lsn, bool acceptSnapshot);
+
+    void receiveSnapshot();
+
+    void run();
+
+    // applies records as they come, until connection is lost.
+    void stream();
+
+    static int64_t now();
+};
+
+}
@@ -0,0 +1,9 @@
+
+#include "ResultCache.hpp"
+
+namespace taboo
+{
+
+ResultCache* ResultCache::_instance = NULL;
+
+}
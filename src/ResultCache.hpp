@@ -0,0 +1,242 @@
+#pragma once
+
+#include "predef.hpp"
+#include <string>
+#include <ctime>
+#include <list>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/functional/hash.hpp>
+#include "Config.hpp"
+#include "Trie.hpp"
+#include "Hasher.hpp"
+
+namespace taboo
+{
+
+// generation counters for query prefixes.
+// a write on key K bumps every prefix of K, so a cached reply for prefix P is
+// stale iff the generation of P changed since the reply was produced.
+// prefixes are hashed into a fixed number of slots, collisions only cause extra misses.
+class PrefixGenerations
+{
+public:
+    typedef uint32_t gen_t;
+
+private:
+    typedef boost::atomic<gen_t> Counter;
+
+    const std::size_t mask;
+    boost::scoped_array<Counter> counters;
+
+public:
+    explicit PrefixGenerations(std::size_t slots):
+        mask(roundUp(slots) - 1), counters(new Counter[mask + 1])
+    {
+        for (std::size_t i = 0; i <= mask; ++i) {
+            counters[i].store(0, boost::memory_order_relaxed);
+        }
+    }
+
+    gen_t get(const std::string& prefix) const
+    {
+        return counters[PrefixHasher()(prefix.data(), prefix.length()) & mask]
+            .load(boost::memory_order_acquire);
+    }
+
+    // NOTE: must be called with write-lock held, after the write was applied.
+    void bump(const std::string& key, std::size_t minLen, std::size_t maxLen)
+    {
+        PrefixHasher hasher;
+        std::size_t end = std::min(key.length(), maxLen);
+        for (std::size_t i = 0; i < end; ++i) {
+            hasher.feed(key[i]);
+            if (minLen <= i + 1) {
+                counters[hasher.hash() & mask].fetch_add(1, boost::memory_order_release);
+            }
+        }
+    }
+
+    // makes every cached reply stale, once the whole index is replaced.
+    void bumpAll()
+    {
+        for (std::size_t i = 0; i <= mask; ++i) {
+            counters[i].fetch_add(1, boost::memory_order_release);
+        }
+    }
+
+private:
+    static std::size_t roundUp(std::size_t num)
+    {
+        std::size_t res = 1;
+        while (res < num) {
+            res <<= 1;
+        }
+        return res;
+    }
+};
+
+// sharded, bounded LRU cache of serialized query replies (echo-data excluded),
+// keyed by normalized query. a reply is stale once any item in it expires, as queries would
+// hide it from then on.
+class ResultCache
+{
+private:
+    static ResultCache* _instance;
+
+    class Entry
+    {
+    public:
+        std::string key;
+        PrefixGenerations::gen_t gen;
+        uint32_t deadline;  // earliest of items in reply, 0 means none expires
+        std::string reply;
+
+        Entry(const std::string& _key, PrefixGenerations::gen_t _gen, uint32_t _deadline,
+            const std::string& _reply):
+            key(_key), gen(_gen), deadline(_deadline), reply(_reply)
+        {}
+
+        bool isFresh(PrefixGenerations::gen_t _gen, std::time_t now) const
+        {
+            return gen == _gen && !(deadline && deadline <= now);
+        }
+    };
+
+    typedef std::list<Entry> EntryList;
+    typedef boost::unordered_map<std::string, EntryList::iterator> EntryIndex;
+
+    class Shard
+    {
+    private:
+        std::size_t capacity;
+        EntryList entries;      // most recently used first
+        EntryIndex index;
+        boost::mutex mutex;
+
+    public:
+        Shard():
+            capacity(0)
+        {}
+
+        void init(std::size_t _capacity)
+        {
+            capacity = _capacity;
+            index.rehash(capacity);
+        }
+
+        bool fetch(const std::string& key, PrefixGenerations::gen_t gen, std::time_t now, std::string& reply)
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            EntryIndex::iterator it = index.find(key);
+            if (it == index.end()) {
+                return false;
+            }
+            if (!it->second->isFresh(gen, now)) {
+                entries.erase(it->second);
+                index.erase(it);
+                return false;
+            }
+            entries.splice(entries.begin(), entries, it->second);
+            reply = it->second->reply;
+            return true;
+        }
+
+        void store(const std::string& key, PrefixGenerations::gen_t gen, uint32_t deadline,
+            const std::string& reply)
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            EntryIndex::iterator it = index.find(key);
+            if (it != index.end()) {
+                it->second->gen = gen;
+                it->second->deadline = deadline;
+                it->second->reply = reply;
+                entries.splice(entries.begin(), entries, it->second);
+                return;
+            }
+            if (index.size() >= capacity) {
+                index.erase(entries.back().key);
+                entries.pop_back();
+            }
+            entries.push_front(Entry(key, gen, deadline, reply));
+            index.insert(std::make_pair(key, entries.begin()));
+        }
+    };
+
+    const std::size_t shardNum;
+    boost::scoped_array<Shard> shards;
+    PrefixGenerations generations;
+    const std::size_t prefixMinLen, prefixMaxLen;
+
+public:
+    static ResultCache* instance()
+    {
+        return _instance;
+    }
+
+    static bool initialize()
+    {
+        const Config* config = Config::instance();
+        if (config->queryCacheEntries) {
+            _instance = new ResultCache(config);
+        }
+        return true;
+    }
+
+    PrefixGenerations::gen_t generation(const std::string& prefix) const
+    {
+        return generations.get(prefix);
+    }
+
+    bool fetch(const std::string& key, PrefixGenerations::gen_t gen, std::string& reply)
+    {
+        return shard(key).fetch(key, gen, std::time(NULL), reply);
+    }
+
+    // @deadline is the earliest of items in @reply, 0 if none of them expires.
+    void store(const std::string& key, PrefixGenerations::gen_t gen, uint32_t deadline, const std::string& reply)
+    {
+        shard(key).store(key, gen, deadline, reply);
+    }
+
+    // NOTE: must be called with write-lock held, after the write was applied.
+    void invalidate(const KeyList& keys)
+    {
+        for (KeyList::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+            generations.bump(*it, prefixMinLen, prefixMaxLen);
+        }
+    }
+
+    void invalidate(const std::string& key)
+    {
+        generations.bump(key, prefixMinLen, prefixMaxLen);
+    }
+
+    void invalidateAll()
+    {
+        generations.bumpAll();
+    }
+
+private:
+    explicit ResultCache(const Config* config):
+        shardNum(std::max<std::size_t>(config->queryCacheShards, 1)),
+        shards(new Shard[shardNum]),
+        generations(config->queryCacheGenerations),
+        prefixMinLen(config->prefixMinLen), prefixMaxLen(config->prefixMaxLen)
+    {
+        std::size_t perShard = std::max<std::size_t>(config->queryCacheEntries / shardNum, 1);
+        for (std::size_t i = 0; i < shardNum; ++i) {
+            shards[i].init(perShard);
+        }
+    }
+
+    Shard& shard(const std::string& key)
+    {
+        return shards[boost::hash<std::string>()(key) % shardNum];
+    }
+};
+
+}
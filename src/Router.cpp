@@ -1,9 +1,14 @@
 
 #include "Router.hpp"
 #include "manager/StatusHandler.hpp"
+#include "manager/MetricsHandler.hpp"
 #include "manager/TokenHandler.hpp"
 #include "manager/AttachHandler.hpp"
 #include "manager/DetachHandler.hpp"
+#include "manager/PatchHandler.hpp"
+#include "manager/StoreHandler.hpp"
+#include "manager/LocksHandler.hpp"
+#include "manager/ProfileHandler.hpp"
 #include "query/HttpPredicter.hpp"
 #include "query/WsPredicter.hpp"
 
@@ -15,12 +20,18 @@ void Router::initHandlerMap()
 {
     HandlerCreatorMap& creators = const_cast<HandlerCreatorMap&>(handlerCreatorMap);
     creators.insert(std::make_pair(std::string("/manage/status"), &manager::StatusHandler::create));
+    // status in Prometheus text format
+    creators.insert(std::make_pair(std::string("/manage/metrics"), &manager::MetricsHandler::create));
     // params: update=1
     creators.insert(std::make_pair(std::string("/manage/attach"), &manager::AttachHandler::create));
 
-    creators.insert(std::make_pair(std::string("/manage/detach"), manager::DetachHandler::create));
+    // params: prefixes (all if absent)
+    creators.insert(std::make_pair(std::string("/manage/detach"), &manager::DetachHandler::create));
 
-    // todo: How to clean an item once all it's prefixes are lost ?
+    // params: item (a merge patch with id, or an array of them)
+    creators.insert(std::make_pair(std::string("/manage/patch"), &manager::PatchHandler::create));
+
+    // detaches item from all its prefixes, which removes it.
     creators.insert(std::make_pair(std::string("/manage/erase"), &manager::DetachHandler::create));
 
     creators.insert(std::make_pair(std::string("/manage/get_access_token"), &manager::TokenHandler::create));
@@ -31,7 +42,13 @@ void Router::initHandlerMap()
 //    creators.insert(std::make_pair(std::string("/manage/tidy"), &manager::DetachHandler::create));
 
     // params: force=0
-//    handlers.insert(std::make_pair(std::string("/manage/store"), &manager::StoreHandler::create));
+    creators.insert(std::make_pair(std::string("/manage/store"), &manager::StoreHandler::create));
+
+    // params: enable=0|1, reset=0
+    creators.insert(std::make_pair(std::string("/manage/locks"), &manager::LocksHandler::create));
+
+    // params: seconds=10 (1 to 60), hz=99 (1 to 1000), threads=0, replies folded stacks
+    creators.insert(std::make_pair(std::string("/manage/profile"), &manager::ProfileHandler::create));
 }
 
 const std::string BaseHandler::escapedQuotation("\\\"");
@@ -46,17 +63,30 @@ const SharedReply NoRouteHandler::reply;
 const BaseHandler::SharedReplyMap BaseHandler::replys;
 
 const SharedReply manager::AttachHandler::okReply;
+const SharedReply manager::DetachHandler::okReply;
+const SharedReply manager::PatchHandler::okReply;
+const std::string manager::DetachHandler::uriErase("/manage/erase");
+const SharedReply manager::StoreHandler::okReply;
+const SharedReply manager::LocksHandler::okReply;
+const char* const manager::MetricsHandler::contentType = "text/plain; version=0.0.4";
+const char* const manager::ProfileHandler::contentType = "text/plain";
 
 const SharedReply query::BasePredicter::errNoQueryReply;
 const SharedReply query::BasePredicter::errBadQueryReply;
+const SharedReply query::BasePredicter::errNoBackendReply;
 
 void Router::initHandlerRelyMap()
 {
     NoRouteHandler::initReplys();
     manager::BaseHandler::initReplys();
     manager::StatusHandler::initReplys();
+    manager::MetricsHandler::initReplys();
     manager::AttachHandler::initReplys();
     manager::DetachHandler::initReplys();
+    manager::PatchHandler::initReplys();
+    manager::StoreHandler::initReplys();
+    manager::LocksHandler::initReplys();
+    manager::ProfileHandler::initReplys();
     query::BasePredicter::initReplys();
     query::HttpPredicter::initReplys();
     query::WsPredicter::initReplys();
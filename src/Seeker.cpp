@@ -0,0 +1,9 @@
+
+#include "Seeker.hpp"
+
+namespace taboo
+{
+
+boost::thread_specific_ptr<IdSet> Seeker::ItemCallback::recordedHolder;
+
+}
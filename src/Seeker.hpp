@@ -2,94 +2,314 @@
 #pragma once
 
 #include "predef.hpp"
+#include <ctime>
+#include <vector>
 #include <algorithm>
-#include <boost/unordered_set.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/tss.hpp>
 #include "Aside.hpp"
+#include "Shard.hpp"
+#include "Fanout.hpp"
 #include "Config.hpp"
 #include "Farm.hpp"
 #include "Item.hpp"
 #include "Trie.hpp"
 #include "Filter.hpp"
 #include "Query.hpp"
+#include "IdSet.hpp"
+#include "Latency.hpp"
 
 namespace taboo {
 
+// a query seeks every shard which may contain its prefix, in parallel through Fanout,
+// then results of shards are merged: by @key-item-score descending if it's set,
+// otherwise round-robin, so that no shard crowds out the others.
+// ordered by score, a shard keeps its best @num in a heap and goes on through funnels up to
+// @max-iterations, rather than stopping at the first @num matched, so the merged ones are the top
+// of all within that bound.
 class Seeker
 {
 private:
-    const Trie& trie;
-
-    const Farm& farm;
+    const Aside* const aside;
 
     mutable FilterChain filter;
 
     mutable SharedItemList items;
 
+    mutable std::vector<const Shard*> targets;
+
+    mutable std::vector<SharedItemList> parts;
+
+    mutable std::vector<QueryWork> works;   // of shards
+
+    mutable QueryWork _work;
+
+    mutable std::time_t now;    // items expired by then are hidden
+
 public:
     Seeker():
-        trie(Aside::instance()->trie),
-        farm(Aside::instance()->farm)
+        aside(Aside::instance()),
+        parts(Aside::instance()->shards.size()),
+        works(Aside::instance()->shards.size()),
+        now(0)
     {}
 
     const SharedItemList& seek(const Query& query) const
     {
         items.clear();
-        FilterChain::rebuild(filter, query);
-        _seek(query);
+        targets.clear();
+        _work.reset();
+        for (ShardList::const_iterator it = aside->shards.begin(); it != aside->shards.end(); ++it) {
+            if ((*it)->trie.mayContain(query.prefix)) {
+                targets.push_back(*it);
+            }
+        }
+        if (targets.empty()) {
+            return items;
+        }
+        {
+            Latency::Timer timer(Latency::metric_filter_rebuild);
+            FilterChain::rebuild(filter, query);
+        }
+        now = std::time(NULL);
+        if (targets.size() == 1) {
+            _seek(*targets.front(), query, items, _work);
+            return items;
+        }
+        Fanout* fanout = Fanout::instance();
+        Fanout::Task task(boost::bind(&Seeker::seekPart, this, boost::cref(query), _1));
+        if (fanout) {
+            fanout->run(targets.size(), task);
+        } else {
+            for (std::size_t i = 0; i < targets.size(); ++i) {
+                task(i);
+            }
+        }
+        merge(query.num);
+        for (std::size_t i = 0; i < targets.size(); ++i) {
+            _work.merge(works[i]);
+        }
         return items;
     }
 
+    // work of the last seek(), in all shards.
+    const QueryWork& work() const
+    {
+        return _work;
+    }
+
 private:
-    void _seek(const Query& query) const
+    void seekPart(const Query& query, std::size_t i) const
+    {
+        parts[i].clear();
+        works[i].reset();
+        _seek(*targets[i], query, parts[i], works[i]);
+    }
+
+    void _seek(const Shard& shard, const Query& query, SharedItemList& out, QueryWork& work) const
     {
-        ItemCallback cb(this, query.num);
-        ReadLock lock(Aside::instance()->accessMutex);
-        trie.traverse(query.prefix, cb);
+        ItemCallback cb(shard.farm, filter, out, query.num, now, work,
+            aside->keyScore.GetStringLength() ? &aside->keyScore : NULL);
+        ReadLock lock(shard.accessMutex, LockProfile::site_seek);
+        uint64_t start = Latency::now();
+        shard.trie.traverse(query.prefix, cb);
+        cb.finish();
+        Latency::record(Latency::metric_trie_traverse, Latency::now() - start - cb.filterTicks);
+        Latency::record(Latency::metric_filtering, cb.filterTicks);
+    }
+
+    void merge(std::size_t num) const
+    {
+        if (aside->keyScore.GetStringLength()) {
+            for (std::size_t i = 0; i < targets.size(); ++i) {
+                items.insert(items.end(), parts[i].begin(), parts[i].end());
+            }
+            std::size_t top = std::min(num, items.size());
+            std::partial_sort(items.begin(), items.begin() + top, items.end(), ScoreGreater(aside->keyScore));
+            items.resize(top);
+            return;
+        }
+        for (std::size_t rank = 0; items.size() < num; ++rank) {
+            bool more = false;
+            for (std::size_t i = 0; i < targets.size() && items.size() < num; ++i) {
+                if (rank < parts[i].size()) {
+                    items.push_back(parts[i][rank]);
+                    more = true;
+                }
+            }
+            if (!more) {
+                break;
+            }
+        }
     }
 
+    class ScoreGreater
+    {
+    private:
+        const Value& key;
+
+    public:
+        explicit ScoreGreater(const Value& _key):
+            key(_key)
+        {}
+
+        bool operator()(const SharedItem& lhs, const SharedItem& rhs) const
+        {
+            return scoreOf(lhs->dom, key) > scoreOf(rhs->dom, key);
+        }
+    };
+
     class ItemCallback
     {
     private:
-        typedef boost::unordered_set<id_t> ItemIdSet;
-        mutable ItemIdSet recorded;
-        const Seeker* const seeker;
+        enum { batch_size = 16 };
+
+        typedef std::pair<double, const SharedItem*> Scored;
+
+        // of a min-heap, the lowest score at front.
+        class ScoredGreater
+        {
+        public:
+            bool operator()(const Scored& lhs, const Scored& rhs) const
+            {
+                return lhs.first > rhs.first;
+            }
+        };
+
+        static boost::thread_specific_ptr<IdSet> recordedHolder;
+
+        IdSet& recorded;
+        const Farm& farm;
+        const FilterChain& chain;
+        SharedItemList& items;
         const std::size_t maxMatch;
-        mutable std::size_t iterated;
+        const std::time_t now;
+        QueryWork& work;
+        const Value* const scoreKey;    // NULL unless ordered by score
+        mutable std::vector<Scored> heap;
 
     public:
-        ItemCallback(const Seeker* _seeker, std::size_t _maxMatch):
-            seeker(_seeker), maxMatch(_maxMatch), iterated(0)
-        {}
+        mutable uint64_t filterTicks;
+
+        ItemCallback(const Farm& _farm, const FilterChain& _chain, SharedItemList& _items, std::size_t _maxMatch,
+            std::time_t _now, QueryWork& _work, const Value* _scoreKey):
+            recorded(localRecorded()), farm(_farm), chain(_chain), items(_items),
+            maxMatch(_maxMatch), now(_now), work(_work), scoreKey(_scoreKey), filterTicks(0)
+        {
+            recorded.reset(maxMatch);
+            if (scoreKey) {
+                heap.reserve(maxMatch + 1);
+            }
+        }
+
+        // moves what's in heap into items, highest score first.
+        // NOTE: must be called with read-lock of the shard still held.
+        void finish() const
+        {
+            if (scoreKey) {
+                std::sort_heap(heap.begin(), heap.end(), ScoredGreater());
+                for (std::vector<Scored>::const_iterator it = heap.begin(); it != heap.end(); ++it) {
+                    items.push_back(*it->second);
+                }
+            }
+        }
+
+        typedef const Funnel* Hint;
+
+        bool operator()(id_t funnelId, Hint funnel) const
+        {
+            return Config::instance()->maxIterations < ++work.funnels ? false : pump(*funnel);
+        }
 
-        bool operator()(id_t funnelId) const
+        void prefetch(id_t funnelId) const
         {
-            return Config::instance()->maxIterations < ++iterated ? false : pump(funnelId);
+            ++work.keys;
+            farm.prefetch(funnelId);
+        }
+
+        Hint locate(id_t funnelId) const
+        {
+            return farm.locate(funnelId);
         }
 
     private:
-        bool pump(id_t funnelId) const
+        // candidates of a funnel are looked up in batches, items of a batch are
+        // prefetched before filters touch them, so that cache misses overlap.
+        bool pump(const Funnel& funnel) const
         {
-            const Funnel& funnel = seeker->farm.funnel(funnelId);
             CS_DUMP(funnel.size());
-            if (!funnel.empty()) {
-                for (Funnel::const_iterator it = funnel.begin(); it != funnel.end(); ++it) {
-                    CS_DUMP(it->second);
-                    if (seeker->items.size() < maxMatch) {
-                        if (recorded.find(it->second) == recorded.end()) {
-                            CS_SAY("not recorded");
-                            const SharedItem& item = seeker->farm.item(it->second);
-                            CS_DUMP(!!item);
-                            if (item && seeker->filter.apply(item)) {
-                                CS_DUMP(item->id);
-                                recorded.insert(item->id);
-                                seeker->items.push_back(item);
-                            }
+            const SharedItem* candidates[batch_size];
+            std::size_t num = 0;
+            for (Funnel::const_iterator it = funnel.begin(); it != funnel.end(); ++it) {
+                if (!scoreKey && items.size() >= maxMatch) {
+                    break;
+                }
+                if (!recorded.contains(it->second)) {
+                    const SharedItem& item = farm.item(it->second);
+                    if (item) {
+                        __builtin_prefetch(item.get());
+                        candidates[num++] = &item;
+                        if (num == batch_size) {
+                            filter(candidates, num);
+                            num = 0;
                         }
                     }
                 }
             }
-            CS_DUMP(seeker->items.size());
-            return seeker->items.size() < maxMatch;
+            if (num) {
+                filter(candidates, num);
+            }
+            CS_DUMP(items.size());
+            return scoreKey || items.size() < maxMatch;
+        }
+
+        void filter(const SharedItem* const* candidates, std::size_t num) const
+        {
+            uint64_t start = Latency::now();
+            for (const SharedItem* const* end = candidates + num;
+                candidates != end && (scoreKey || items.size() < maxMatch); ++candidates) {
+                const SharedItem& item = **candidates;
+                ++work.candidates;
+                if (scoreKey) {
+                    keep(*candidates);
+                } else if (!item->isExpired(now) && chain.apply(item)) {
+                    CS_DUMP(item->id);
+                    recorded.insert(item->id);
+                    items.push_back(item);
+                } else {
+                    ++work.rejected;
+                }
+            }
+            filterTicks += Latency::now() - start;
+        }
+
+        // one outscored by all kept is not recorded, seen again it's outscored again.
+        void keep(const SharedItem* candidate) const
+        {
+            const SharedItem& item = *candidate;
+            const double score = scoreOf(item->dom, *scoreKey);
+            if ((heap.size() >= maxMatch && score <= heap.front().first)
+                || item->isExpired(now) || !chain.apply(item)) {
+                ++work.rejected;
+                return;
+            }
+            recorded.insert(item->id);
+            heap.push_back(Scored(score, candidate));
+            std::push_heap(heap.begin(), heap.end(), ScoredGreater());
+            if (heap.size() > maxMatch) {
+                std::pop_heap(heap.begin(), heap.end(), ScoredGreater());
+                heap.pop_back();
+            }
+        }
+
+        static IdSet& localRecorded()
+        {
+            IdSet* res = recordedHolder.get();
+            if (CS_BUNLIKELY(res == NULL)) {
+                res = new IdSet;
+                recordedHolder.reset(res);
+            }
+            return *res;
         }
     };
 };
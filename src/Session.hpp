@@ -5,6 +5,7 @@
 #include <ctime>
 #include <boost/unordered_map.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/atomic.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/random/mersenne_twister.hpp>
 #include "stage/random.hpp"
@@ -68,11 +69,17 @@ protected:
 
     mutable boost::shared_mutex mutex;
 
+    boost::atomic<std::size_t> sessionNum;
+
 public:
+    SessionManager():
+        sessionNum(0)
+    {}
+
     const std::string& ensure(identy_t identy, Value& filters, std::time_t expireTill)
     {
         {
-            ReadLock lock(mutex);
+            ReadLock lock(mutex, LockProfile::site_session_lookup);
             TokenMap::iterator tokenIt = tokens.find(identy);
             if (tokenIt != tokens.end()) {
                 return tokenIt->second;
@@ -85,16 +92,18 @@ public:
 
         {
             Session sess(identy, filters, expireTill);
-            WriteLock lock(mutex);
+            WriteLock lock(mutex, LockProfile::site_session_create);
             std::string token = createToken();
             tokens.insert(std::make_pair(identy, token));
-            return sessions.insert(std::make_pair(token, sess)).first->first;
+            const std::string& res = sessions.insert(std::make_pair(token, sess)).first->first;
+            sessionNum.store(sessions.size(), boost::memory_order_relaxed);
+            return res;
         }
     }
 
     const Session& auth(const std::string& token) const
     {
-        ReadLock lock(mutex);
+        ReadLock lock(mutex, LockProfile::site_session_auth);
         SessionMap::const_iterator it = sessions.find(token);
         if (it != sessions.end()) {
             if (std::time(NULL) < it->second.expire) {
@@ -109,6 +118,11 @@ public:
         return _instance;
     }
 
+    std::size_t size() const
+    {
+        return sessionNum.load(boost::memory_order_relaxed);
+    }
+
 protected:
     std::string createToken() const
     {
@@ -0,0 +1,217 @@
+#pragma once
+
+#include "predef.hpp"
+#include <string>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/functional/hash.hpp>
+#include "Item.hpp"
+#include "Farm.hpp"
+#include "Trie.hpp"
+#include "Memory.hpp"
+
+namespace taboo {
+
+class KeysDictTag {};
+
+// keys each item is attached to, joined by '\0'.
+typedef boost::unordered_map<id_t, std::string, boost::hash<id_t>, std::equal_to<id_t>,
+    ArenaAllocator<std::pair<const id_t, std::string>, KeysDictTag> > KeysDict;
+
+// sizes of a shard as of its last write, readable without locking it.
+class ShardStat
+{
+public:
+    boost::atomic<uint64_t> items, funnels, postings, keys, trieNodes, trieCapacity;
+    boost::atomic<uint64_t> documentBytes, keyBytes;    // on heap, of items and keysDict strings
+
+    ShardStat():
+        items(0), funnels(0), postings(0), keys(0), trieNodes(0), trieCapacity(0),
+        documentBytes(0), keyBytes(0)
+    {}
+};
+
+// one partition of index: the items whose id hashes to it, and the prefixes they're attached to.
+// shards share nothing, each is guarded by its own lock.
+class Shard
+{
+public:
+    const std::size_t no;
+
+    ItemDict itemDict;
+    FunnelDict funnelDict;
+
+    Farm farm;
+
+    Trie trie;
+
+    // reverse of trie and funnels, so that an item can be detached from all of its keys,
+    // and removed once it has none left.
+    KeysDict keysDict;
+
+    std::size_t keyBytes;   // capacity of strings in keysDict
+
+    mutable boost::shared_mutex accessMutex;
+
+    ShardStat stat;
+
+    explicit Shard(std::size_t _no):
+        no(_no),
+        farm(itemDict, funnelDict),
+        keyBytes(0)
+    {}
+
+    // NOTE: writers below must hold write-lock.
+    void publish()
+    {
+        stat.items.store(itemDict.size(), boost::memory_order_relaxed);
+        stat.funnels.store(funnelDict.size(), boost::memory_order_relaxed);
+        stat.postings.store(farm.postings(), boost::memory_order_relaxed);
+        stat.keys.store(trie.keys(), boost::memory_order_relaxed);
+        stat.trieNodes.store(trie.nodes(), boost::memory_order_relaxed);
+        stat.trieCapacity.store(trie.capacity(), boost::memory_order_relaxed);
+        stat.documentBytes.store(farm.documentBytes(), boost::memory_order_relaxed);
+        stat.keyBytes.store(keyBytes, boost::memory_order_relaxed);
+    }
+
+    void index(id_t id, const std::string& key)
+    {
+        std::string& keys = keysDict[id];
+        if (find(keys, key) == std::string::npos) {
+            keyBytes -= keys.capacity();
+            keys.append(key);
+            keys.push_back('\0');
+            keyBytes += keys.capacity();
+        }
+    }
+
+    // false if @key isn't indexed for item @id.
+    bool unindex(id_t id, const std::string& key)
+    {
+        KeysDict::iterator it = keysDict.find(id);
+        if (it == keysDict.end()) {
+            return false;
+        }
+        std::size_t pos = find(it->second, key);
+        if (pos == std::string::npos) {
+            return false;
+        }
+        keyBytes -= it->second.capacity();
+        it->second.erase(pos, key.length() + 1);
+        if (it->second.empty()) {
+            keysDict.erase(it);
+        } else {
+            keyBytes += it->second.capacity();
+        }
+        return true;
+    }
+
+    bool isIndexed(id_t id) const
+    {
+        return keysDict.find(id) != keysDict.end();
+    }
+
+    KeyList keysOf(id_t id) const
+    {
+        KeyList keys;
+        KeysDict::const_iterator it = keysDict.find(id);
+        if (it != keysDict.end()) {
+            for (std::size_t pos = 0; pos < it->second.length(); ) {
+                std::size_t end = it->second.find('\0', pos);
+                keys.push_back(it->second.substr(pos, end - pos));
+                pos = end + 1;
+            }
+        }
+        return keys;
+    }
+
+    // drops items and funnels, so that a snapshot is restored in place of them.
+    // trie is replaced as it's loaded, keysDict as it's rebuilt by reindex().
+    void clear()
+    {
+        itemDict.clear();
+        funnelDict.clear();
+    }
+
+    // rebuilds keysDict and counters from trie and funnels, once they're restored.
+    void reindex()
+    {
+        keysDict.clear();
+        ReindexCallback cb(*this);
+        trie.forEach(cb);
+        keyBytes = 0;
+        for (KeysDict::const_iterator it = keysDict.begin(); it != keysDict.end(); ++it) {
+            keyBytes += it->second.capacity();
+        }
+        farm.recount();
+        publish();
+    }
+
+private:
+    class ReindexCallback
+    {
+    private:
+        Shard& shard;
+
+    public:
+        explicit ReindexCallback(Shard& _shard):
+            shard(_shard)
+        {}
+
+        void operator()(const std::string& key, id_t funnelId) const
+        {
+            const Funnel& funnel = shard.farm.funnel(funnelId);
+            for (Funnel::const_iterator it = funnel.begin(); it != funnel.end(); ++it) {
+                std::string& keys = shard.keysDict[it->first];
+                keys.append(key);
+                keys.push_back('\0');
+            }
+        }
+    };
+
+    static std::size_t find(const std::string& keys, const std::string& key)
+    {
+        for (std::size_t pos = 0; pos < keys.length(); pos = keys.find('\0', pos) + 1) {
+            if (keys.compare(pos, key.length(), key) == 0 && keys[pos + key.length()] == '\0') {
+                return pos;
+            }
+        }
+        return std::string::npos;
+    }
+};
+
+typedef std::vector<Shard*> ShardList;
+
+// ShardStat summed over shards.
+class ShardTotals
+{
+public:
+    uint64_t items, funnels, postings, keys, trieNodes, trieCapacity;
+    uint64_t documentBytes, keyBytes;
+
+    ShardTotals():
+        items(0), funnels(0), postings(0), keys(0), trieNodes(0), trieCapacity(0),
+        documentBytes(0), keyBytes(0)
+    {}
+
+    static ShardTotals read(const ShardList& shards)
+    {
+        ShardTotals res;
+        for (ShardList::const_iterator it = shards.begin(); it != shards.end(); ++it) {
+            const ShardStat& stat = (*it)->stat;
+            res.items += stat.items.load(boost::memory_order_relaxed);
+            res.funnels += stat.funnels.load(boost::memory_order_relaxed);
+            res.postings += stat.postings.load(boost::memory_order_relaxed);
+            res.keys += stat.keys.load(boost::memory_order_relaxed);
+            res.trieNodes += stat.trieNodes.load(boost::memory_order_relaxed);
+            res.trieCapacity += stat.trieCapacity.load(boost::memory_order_relaxed);
+            res.documentBytes += stat.documentBytes.load(boost::memory_order_relaxed);
+            res.keyBytes += stat.keyBytes.load(boost::memory_order_relaxed);
+        }
+        return res;
+    }
+};
+
+}
@@ -0,0 +1,137 @@
+
+#include "SlowLog.hpp"
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <boost/bind.hpp>
+#include <glog/logging.h>
+#include "Latency.hpp"
+
+namespace taboo
+{
+
+namespace
+{
+
+// control characters of a query are written as '\xHH', so that one can't start a forged line.
+void writeEscaped(std::ostream& out, const char* data, std::size_t length)
+{
+    for (const char* end = data + length; data != end; ++data) {
+        const unsigned char c = *data;
+        if (c < 0x20 || c == 0x7f || c == '\\') {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\x%02x", c);
+            out << escaped;
+        } else {
+            out << *data;
+        }
+    }
+}
+
+}
+
+SlowLog* SlowLog::_instance = NULL;
+
+bool SlowLog::initialize()
+{
+    const Config* config = Config::instance();
+    if (config->slowQueryMicros == 0 && config->slowQueryIterations == 0) {
+        return true;
+    }
+    std::ofstream out(config->slowQueryLog.c_str(), std::ios::app);
+    if (!out) {
+        LOG(ERROR) << "failed on open slow query log " << config->slowQueryLog;
+        return false;
+    }
+    _instance = new SlowLog(config);
+    _instance->writer = new boost::thread(boost::bind(&SlowLog::writeLoop, _instance));
+    return true;
+}
+
+SlowLog::SlowLog(const Config* config):
+    tickThreshold(Latency::fromMicros(config->slowQueryMicros)),
+    iterationThreshold(config->slowQueryIterations),
+    rate(config->slowQueryRate),
+    path(config->slowQueryLog.string()),
+    queue(queue_size),
+    second(0),
+    taken(0),
+    logged(0),
+    dropped(0),
+    writer(NULL)
+{}
+
+void SlowLog::push(Query& query, uint64_t ticks, const QueryWork& work)
+{
+    if (!admit()) {
+        dropped.fetch_add(1, boost::memory_order_relaxed);
+        return;
+    }
+    Entry* entry = new Entry(ticks, work, query.fingerprint());
+    if (!queue.bounded_push(entry)) {
+        delete entry;
+        dropped.fetch_add(1, boost::memory_order_relaxed);
+    }
+}
+
+// a window is restarted by whoever sees the clock move first,
+// racing workers may let a few more in, which doesn't matter.
+bool SlowLog::admit()
+{
+    std::time_t now = std::time(NULL);
+    if (second.load(boost::memory_order_relaxed) != now) {
+        second.store(now, boost::memory_order_relaxed);
+        taken.store(0, boost::memory_order_relaxed);
+    }
+    return taken.fetch_add(1, boost::memory_order_relaxed) < rate;
+}
+
+void SlowLog::writeLoop()
+{
+    std::ofstream out(path.c_str(), std::ios::app);
+    while (true) {
+        Entry* entry = NULL;
+        std::size_t num = 0;
+        while (queue.pop(entry)) {
+            out << format(*entry);
+            delete entry;
+            ++num;
+        }
+        if (num) {
+            out.flush();
+            logged.fetch_add(num, boost::memory_order_relaxed);
+        } else {
+            boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+        }
+    }
+}
+
+std::string SlowLog::format(const Entry& entry) const
+{
+    static const char* const names[Query::fingerprint_parts] = {"prefix", "filters", "excludes", "fields", "num"};
+    char time[32];
+    tm local;
+    std::strftime(time, sizeof(time), "%Y-%m-%d %H:%M:%S", localtime_r(&entry.time, &local));
+
+    std::ostringstream out;
+    out << time
+        << " micros=" << static_cast<uint64_t>(Latency::toMicros(entry.ticks))
+        << " keys=" << entry.work.keys
+        << " funnels=" << entry.work.funnels
+        << " candidates=" << entry.work.candidates
+        << " rejected=" << entry.work.rejected
+        << " items=" << entry.work.items
+        << " bytes=" << entry.work.bytes;
+    Query::Span parts[Query::fingerprint_parts];
+    Query::splitFingerprint(entry.query, parts);
+    for (std::size_t i = 0; i < Query::fingerprint_parts; ++i) {
+        if (parts[i].second) {
+            out << ' ' << names[i] << '=';
+            writeEscaped(out, parts[i].first, parts[i].second);
+        }
+    }
+    out << '\n';
+    return out.str();
+}
+
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "predef.hpp"
+#include <string>
+#include <ctime>
+#include <boost/atomic.hpp>
+#include <boost/lockfree/queue.hpp>
+#include <boost/thread/thread.hpp>
+#include "Config.hpp"
+#include "Query.hpp"
+
+namespace taboo
+{
+
+// logs queries taking longer than @slow-query-micros or iterating more than @slow-query-iterations
+// funnels into @slow-query-log, with the work they did and their normalized form.
+// query workers only copy an entry into a lock-free queue, a background thread formats and writes them;
+// at most @slow-query-rate entries are logged per second, the rest (and those finding queue full)
+// are counted as dropped.
+class SlowLog
+{
+private:
+    enum { queue_size = 4096 };
+
+    class Entry
+    {
+    public:
+        std::time_t time;
+        uint64_t ticks;
+        QueryWork work;
+        std::string query;  // fingerprint of query
+
+        Entry(uint64_t _ticks, const QueryWork& _work, const std::string& _query):
+            time(std::time(NULL)), ticks(_ticks), work(_work), query(_query)
+        {}
+    };
+
+    static SlowLog* _instance;
+
+    const uint64_t tickThreshold;     // 0 disables
+    const uint64_t iterationThreshold;
+    const uint32_t rate;
+    const std::string path;
+
+    boost::lockfree::queue<Entry*> queue;
+
+    boost::atomic<std::time_t> second;  // of the current rate window
+    boost::atomic<uint32_t> taken;      // in the current rate window
+    boost::atomic<uint64_t> logged, dropped;
+
+    boost::thread* writer;
+
+public:
+    static SlowLog* instance()
+    {
+        return _instance;
+    }
+
+    // not created if both thresholds are 0.
+    static bool initialize();
+
+    // NOTE: called by query workers, for every query.
+    void check(Query& query, uint64_t ticks, const QueryWork& work)
+    {
+        if ((tickThreshold && ticks >= tickThreshold)
+            || (iterationThreshold && work.funnels >= iterationThreshold)) {
+            push(query, ticks, work);
+        }
+    }
+
+    uint64_t numLogged() const
+    {
+        return logged.load(boost::memory_order_relaxed);
+    }
+
+    uint64_t numDropped() const
+    {
+        return dropped.load(boost::memory_order_relaxed);
+    }
+
+private:
+    explicit SlowLog(const Config* config);
+
+    void push(Query& query, uint64_t ticks, const QueryWork& work);
+
+    // true if a slot is left in this second.
+    bool admit();
+
+    void writeLoop();
+
+    std::string format(const Entry& entry) const;
+};
+
+}
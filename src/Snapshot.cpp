@@ -0,0 +1,752 @@
+
+#include "Snapshot.hpp"
+extern "C" {
+#   include <fcntl.h>
+#   include <unistd.h>
+#   include <errno.h>
+#   include <sys/wait.h>
+}
+#include <cstdio>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/chrono.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <glog/logging.h>
+#include "ResultCache.hpp"
+
+namespace taboo
+{
+
+namespace
+{
+
+const uint32_t snapshot_magic = 0x4e534254;     // "TBSN"
+const uint32_t snapshot_version = 4;
+
+// items and funnels of a shard are each split into this many independently loadable segments.
+const uint32_t snapshot_segments = 64;
+
+// followed by a ShardEntry for each shard, then segment tables of all shards.
+// tries of the snapshot are the files named after @generation, so the header is the manifest.
+class SnapshotHeader
+{
+public:
+    uint32_t magic, version;
+    lsn_t lsn;
+    uint64_t generation;
+    uint32_t shardNum, itemSegments, funnelSegments;
+};
+
+class ShardEntry
+{
+public:
+    uint64_t trieNodes, itemNum, funnelNum;
+};
+
+typedef std::vector<ShardEntry> ShardTable;
+
+// byte range of a segment in @items-file, and num of items/funnels in it.
+class SegmentEntry
+{
+public:
+    uint64_t offset, length, count;
+};
+
+// shard-major: item segments then funnel segments of shard 0, then of shard 1, ...
+typedef std::vector<SegmentEntry> SegmentTable;
+
+typedef boost::chrono::steady_clock Clock;
+
+inline int64_t millisSince(Clock::time_point start)
+{
+    return boost::chrono::duration_cast<boost::chrono::milliseconds>(Clock::now() - start).count();
+}
+
+template<typename T>
+inline bool write(FILE* fp, const T& value)
+{
+    return std::fwrite(&value, sizeof(value), 1, fp) == 1;
+}
+
+template<typename T>
+inline void put(std::string& out, const T& value)
+{
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template<typename T>
+inline bool get(const char*& cursor, const char* end, T& value)
+{
+    if (static_cast<std::size_t>(end - cursor) < sizeof(value)) {
+        return false;
+    }
+    std::memcpy(&value, cursor, sizeof(value));
+    cursor += sizeof(value);
+    return true;
+}
+
+bool readAt(int fd, void* buffer, std::size_t length, uint64_t offset)
+{
+    char* cursor = static_cast<char*>(buffer);
+    while (length) {
+        ssize_t got = pread(fd, cursor, length, offset);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        } else if (got <= 0) {
+            return false;
+        }
+        cursor += got;
+        length -= got;
+        offset += got;
+    }
+    return true;
+}
+
+const std::size_t generation_digits = 20;
+
+// '@trie-file.<generation>' for shard 0, '@trie-file.<shard>.<generation>' for the others.
+// a snapshot never writes over tries of the one in place, renaming @items-file switches to it.
+inline std::string trieFileOf(const Config* config, std::size_t shard, uint64_t generation)
+{
+    char suffix[48];
+    if (shard) {
+        std::snprintf(suffix, sizeof(suffix), ".%u.%020llu", static_cast<unsigned>(shard),
+            static_cast<unsigned long long>(generation));
+    } else {
+        std::snprintf(suffix, sizeof(suffix), ".%020llu", static_cast<unsigned long long>(generation));
+    }
+    return config->trieFile.string() + suffix;
+}
+
+bool readHeader(const Config* config, SnapshotHeader& header)
+{
+    int fd = ::open(config->itemsFile.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+    bool ok = readAt(fd, &header, sizeof(header), 0) && header.magic == snapshot_magic
+        && header.version == snapshot_version;
+    ::close(fd);
+    return ok;
+}
+
+// generation of the snapshot in place, 0 if there's none.
+inline uint64_t generationOf(const Config* config)
+{
+    SnapshotHeader header;
+    return readHeader(config, header) ? header.generation : 0;
+}
+
+std::vector<std::string> filesOf(const Config* config, uint64_t generation)
+{
+    std::vector<std::string> res;
+    for (std::size_t i = 0; i < config->indexShards; ++i) {
+        res.push_back(trieFileOf(config, i, generation) + ".sbl");
+        res.push_back(trieFileOf(config, i, generation));
+    }
+    res.push_back(config->itemsFile.string());
+    return res;
+}
+
+// removes tries of generations other than @generation, left by replaced or unfinished snapshots.
+void removeStaleTries(const Config* config, uint64_t generation)
+{
+    namespace fs = boost::filesystem;
+    fs::path dir = config->trieFile.parent_path();
+    if (dir.empty()) {
+        dir = ".";
+    }
+    std::vector<std::string> current;
+    for (std::size_t i = 0; i < config->indexShards; ++i) {
+        current.push_back(fs::path(trieFileOf(config, i, generation)).filename().string());
+    }
+    std::vector<fs::path> stale;
+    boost::system::error_code ec;
+    for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+        const std::string name = it->path().filename().string();
+        for (std::vector<std::string>::const_iterator pos = current.begin(); pos != current.end(); ++pos) {
+            const std::size_t length = pos->length();
+            if (name.length() < length || name.compare(0, length - generation_digits, *pos, 0,
+                    length - generation_digits) != 0
+                || name.find_first_not_of("0123456789", length - generation_digits) < length
+                || (name.length() != length && name.compare(length, std::string::npos, ".sbl") != 0)) {
+                continue;
+            }
+            if (name.compare(0, length, *pos) != 0) {
+                stale.push_back(it->path());
+            }
+            break;
+        }
+    }
+    for (std::vector<fs::path>::const_iterator it = stale.begin(); it != stale.end(); ++it) {
+        if (!fs::remove(*it, ec)) {
+            LOG(WARNING) << "failed on removing stale trie " << *it << ": " << ec.message();
+        }
+    }
+}
+
+// locks all shards, shared or exclusively.
+class ShardsLock
+{
+private:
+    const ShardList& shards;
+    const bool shared;
+    const uint64_t start;
+    uint64_t locked;
+
+public:
+    ShardsLock(const ShardList& _shards, bool _shared):
+        shards(_shards), shared(_shared), start(Latency::now())
+    {
+        for (ShardList::const_iterator it = shards.begin(); it != shards.end(); ++it) {
+            if (shared) {
+                (*it)->accessMutex.lock_shared();
+            } else {
+                (*it)->accessMutex.lock();
+            }
+        }
+        locked = Latency::now();
+    }
+
+    ~ShardsLock()
+    {
+        for (ShardList::const_reverse_iterator it = shards.rbegin(); it != shards.rend(); ++it) {
+            if (shared) {
+                (*it)->accessMutex.unlock_shared();
+            } else {
+                (*it)->accessMutex.unlock();
+            }
+        }
+        LockProfile::record(shared ? LockProfile::site_snapshot : LockProfile::site_restore,
+            locked - start, Latency::now() - locked);
+    }
+};
+
+inline bool syncFile(const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+    bool ok = fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+}
+
+// appends records of consecutive segments to a file, in 1M chunks.
+class SegmentWriter
+{
+private:
+    FILE* fp;
+    uint64_t offset;
+    SegmentEntry* entry;
+
+public:
+    std::string buffer;
+    bool ok;
+
+    SegmentWriter(FILE* _fp, uint64_t _offset):
+        fp(_fp), offset(_offset), entry(NULL), ok(true)
+    {
+        buffer.reserve(chunk_size * 2);
+    }
+
+    void begin(SegmentEntry& _entry)
+    {
+        flush();
+        entry = &_entry;
+        entry->offset = offset;
+        entry->length = 0;
+        entry->count = 0;
+    }
+
+    // called once a record is appended to @buffer.
+    void commit()
+    {
+        ++entry->count;
+        if (buffer.length() >= chunk_size) {
+            flush();
+        }
+    }
+
+    void flush()
+    {
+        if (buffer.empty()) {
+            return;
+        }
+        ok = ok && std::fwrite(buffer.data(), 1, buffer.length(), fp) == buffer.length();
+        offset += buffer.length();
+        entry->length += buffer.length();
+        buffer.clear();
+    }
+
+private:
+    enum { chunk_size = 1 << 20 };
+};
+
+// decoded but not yet inserted content of @items-file, segments of all shards in a row.
+class RestoreBatch
+{
+public:
+    const std::size_t itemSegments, funnelSegments;
+
+    std::vector<SharedItemList> items;
+    std::vector<std::vector<id_t> > funnelIds;
+    std::vector<std::vector<Funnel> > funnels;
+
+    boost::atomic<std::size_t> cursor;
+    boost::atomic<bool> failed;
+
+    explicit RestoreBatch(const SnapshotHeader& header):
+        itemSegments(header.itemSegments),
+        funnelSegments(header.funnelSegments),
+        items(header.shardNum * header.itemSegments),
+        funnelIds(header.shardNum * header.funnelSegments),
+        funnels(header.shardNum * header.funnelSegments),
+        cursor(0),
+        failed(false)
+    {}
+};
+
+bool decodeItems(const char* cursor, const char* end, uint64_t count, SharedItemList& items)
+{
+    items.reserve(count);
+    for (uint64_t i = 0; i < count; ++i) {
+        SharedItem item = decodeItem(cursor, end);
+        if (!item) {
+            return false;
+        }
+        items.push_back(item);
+    }
+    return cursor == end;
+}
+
+bool decodeFunnels(const char* cursor, const char* end, uint64_t count,
+    std::vector<id_t>& funnelIds, std::vector<Funnel>& funnels)
+{
+    funnelIds.resize(count);
+    funnels.resize(count);
+    for (uint64_t i = 0; i < count; ++i) {
+        uint32_t num;
+        if (!get(cursor, end, funnelIds[i]) || !get(cursor, end, num)) {
+            return false;
+        }
+        Funnel& funnel = funnels[i];
+        funnel.rehash(num);
+        for (uint32_t j = 0; j < num; ++j) {
+            id_t id;
+            if (!get(cursor, end, id)) {
+                return false;
+            }
+            funnel.insert(std::make_pair(id, id));
+        }
+    }
+    return cursor == end;
+}
+
+// decodes segments taken from @batch until all are done.
+void decodeSegments(int fd, const SegmentTable* table, RestoreBatch* batch)
+{
+    const std::size_t itemSegments = batch->itemSegments;
+    const std::size_t perShard = itemSegments + batch->funnelSegments;
+    std::string buffer;
+    for (std::size_t i = batch->cursor++; i < table->size() && !batch->failed; i = batch->cursor++) {
+        const SegmentEntry& entry = (*table)[i];
+        buffer.resize(entry.length);
+        if (entry.length && !readAt(fd, &buffer[0], entry.length, entry.offset)) {
+            batch->failed = true;
+            break;
+        }
+        const char* begin = buffer.data();
+        const char* end = begin + buffer.length();
+        const std::size_t shard = i / perShard, j = i % perShard;
+        const std::size_t k = shard * batch->funnelSegments + j - itemSegments;
+        bool ok = (j < itemSegments)
+            ? decodeItems(begin, end, entry.count, batch->items[shard * itemSegments + j])
+            : decodeFunnels(begin, end, entry.count, batch->funnelIds[k], batch->funnels[k]);
+        if (!ok) {
+            LOG(ERROR) << "bad segment " << i << " in snapshot";
+            batch->failed = true;
+        }
+    }
+}
+
+void insertItems(ItemDict* itemDict, RestoreBatch* batch, std::size_t shard, uint64_t itemNum)
+{
+    itemDict->rehash(itemNum);
+    for (std::size_t i = shard * batch->itemSegments; i < (shard + 1) * batch->itemSegments; ++i) {
+        SharedItemList& items = batch->items[i];
+        for (SharedItemList::const_iterator it = items.begin(); it != items.end(); ++it) {
+            itemDict->insert(std::make_pair((*it)->id, *it));
+        }
+        SharedItemList().swap(items);
+    }
+}
+
+void insertFunnels(FunnelDict* funnelDict, RestoreBatch* batch, std::size_t shard, uint64_t funnelNum)
+{
+    funnelDict->rehash(funnelNum);
+    for (std::size_t i = shard * batch->funnelSegments; i < (shard + 1) * batch->funnelSegments; ++i) {
+        std::vector<id_t>& funnelIds = batch->funnelIds[i];
+        std::vector<Funnel>& funnels = batch->funnels[i];
+        for (std::size_t j = 0; j < funnelIds.size(); ++j) {
+            (*funnelDict)[funnelIds[j]].swap(funnels[j]);
+        }
+        std::vector<Funnel>().swap(funnels);
+    }
+}
+
+void loadTrie(Trie* trie, std::string path, char* ok, int64_t* millis)
+{
+    Clock::time_point start = Clock::now();
+    *ok = trie->load(path);
+    *millis = millisSince(start);
+}
+
+}
+
+Snapshot* Snapshot::_instance = NULL;
+
+bool Snapshot::initialize()
+{
+    const Config* config = Config::instance();
+    Snapshot* snapshot = new Snapshot(config);
+    if (!snapshot->restore()) {
+        return false;
+    }
+    if (config->snapshotInterval > 0) {
+        snapshot->timer = new boost::thread(boost::bind(&Snapshot::timerLoop, snapshot,
+            config->snapshotInterval));
+    }
+    _instance = snapshot;
+    return true;
+}
+
+Snapshot::Status Snapshot::store(bool force)
+{
+    {
+        boost::mutex::scoped_lock lock(pinMutex);
+        if (running || pins) {
+            return status_running;
+        }
+        running = true;
+    }
+    Wal* wal = Wal::instance();
+    if (!force && wal && wal->last() == lastLsn.load()) {
+        running = false;
+        return status_unchanged;
+    }
+
+    std::time_t start = std::time(NULL);
+    lsn_t lsn = 0;
+    pid_t pid;
+    {
+        // held only across rotate() and fork(), which give the child a consistent image.
+        ShardsLock lock(Aside::instance()->shards, true);
+        // memory may hold what's never logged once wal breaks, a snapshot of it is not to be taken.
+        if (wal && !wal->rotate(lsn)) {
+            LOG(ERROR) << "wal is broken, no snapshot is taken";
+            running = false;
+            return status_failed;
+        }
+        pid = fork();
+        if (pid == 0) {
+            _exit(dump(lsn) ? 0 : 1);
+        }
+    }
+    if (pid < 0) {
+        LOG(ERROR) << "failed on forking for snapshot: " << std::strerror(errno);
+        running = false;
+        return status_failed;
+    }
+    LOG(INFO) << "snapshot at lsn " << lsn << " started in process " << pid;
+    boost::thread(boost::bind(&Snapshot::wait, this, pid, lsn, start)).detach();
+    return status_started;
+}
+
+bool Snapshot::pin()
+{
+    boost::mutex::scoped_lock lock(pinMutex);
+    if (running) {
+        return false;
+    }
+    ++pins;
+    return true;
+}
+
+void Snapshot::unpin()
+{
+    boost::mutex::scoped_lock lock(pinMutex);
+    --pins;
+}
+
+std::vector<std::string> Snapshot::files(const Config* config)
+{
+    return filesOf(config, generationOf(config));
+}
+
+std::vector<std::string> Snapshot::stage(const Config* config, uint64_t& generation)
+{
+    generation = generationOf(config) + 1;
+    std::vector<std::string> res = filesOf(config, generation);
+    res.back() += ".tmp";
+    return res;
+}
+
+bool Snapshot::install(const Config* config, uint64_t generation)
+{
+    const std::string itemsFile = config->itemsFile.string(), itemsTmp = itemsFile + ".tmp";
+    int fd = ::open(itemsTmp.c_str(), O_WRONLY);
+    if (fd == -1) {
+        return false;
+    }
+    // a snapshot fetched from leader tells the generation of leader, its tries are named after ours.
+    bool ok = pwrite(fd, &generation, sizeof(generation), offsetof(SnapshotHeader, generation))
+        == static_cast<ssize_t>(sizeof(generation)) && fsync(fd) == 0;
+    ok = (::close(fd) == 0) && ok;
+    if (!ok || std::rename(itemsTmp.c_str(), itemsFile.c_str()) != 0) {
+        return false;
+    }
+    removeStaleTries(config, generation);
+    return true;
+}
+
+lsn_t Snapshot::peek(const Config* config)
+{
+    SnapshotHeader header;
+    return readHeader(config, header) ? header.lsn : 0;
+}
+
+bool Snapshot::reload()
+{
+    return load(true);
+}
+
+bool Snapshot::restore()
+{
+    return !config->restoreOnStart || load(false);
+}
+
+bool Snapshot::load(bool replace)
+{
+    int fd = ::open(config->itemsFile.c_str(), O_RDONLY);
+    if (fd == -1) {
+        LOG(INFO) << "no snapshot to restore from " << config->itemsFile;
+        return !replace;
+    }
+
+    Clock::time_point start = Clock::now();
+    Aside* aside = Aside::instance();
+    ShardsLock lock(aside->shards, false);
+    if (replace) {
+        for (ShardList::const_iterator it = aside->shards.begin(); it != aside->shards.end(); ++it) {
+            (*it)->clear();
+        }
+    }
+
+    SnapshotHeader header;
+    if (!readAt(fd, &header, sizeof(header), 0) || header.magic != snapshot_magic
+        || header.version != snapshot_version) {
+        CS_DIE("bad snapshot header in " << config->itemsFile);
+    }
+    const std::size_t shardNum = aside->shards.size();
+    if (header.shardNum != shardNum) {
+        CS_DIE("snapshot " << config->itemsFile << " has " << header.shardNum
+            << " shards, but index-shards is " << shardNum);
+    }
+    ShardTable shardTable(shardNum);
+    SegmentTable table(shardNum * (header.itemSegments + header.funnelSegments));
+    if (!readAt(fd, &shardTable[0], shardNum * sizeof(ShardEntry), sizeof(header))
+        || (!table.empty() && !readAt(fd, &table[0], table.size() * sizeof(SegmentEntry),
+            sizeof(header) + shardNum * sizeof(ShardEntry)))) {
+        CS_DIE("truncated segment table in snapshot " << config->itemsFile);
+    }
+
+    // tries are single files, load aside while segments are decoded.
+    std::vector<char> trieOk(shardNum, 0);
+    std::vector<int64_t> trieMillis(shardNum, 0);
+    boost::thread_group trieLoaders;
+    for (std::size_t i = 0; i < shardNum; ++i) {
+        trieLoaders.create_thread(boost::bind(&loadTrie, &aside->shards[i]->trie,
+            trieFileOf(config, i, header.generation), &trieOk[i], &trieMillis[i]));
+    }
+
+    Clock::time_point phase = Clock::now();
+    RestoreBatch batch(header);
+    std::size_t threadNum = std::max<std::size_t>(1, std::min<std::size_t>(table.size(),
+        config->restoreThreads ? config->restoreThreads : boost::thread::hardware_concurrency()));
+    boost::thread_group decoders;
+    for (std::size_t i = 0; i < threadNum; ++i) {
+        decoders.create_thread(boost::bind(&decodeSegments, fd, &table, &batch));
+    }
+    decoders.join_all();
+    ::close(fd);
+    if (batch.failed) {
+        CS_DIE("failed on decoding snapshot " << config->itemsFile);
+    }
+    int64_t decodeMillis = millisSince(phase);
+
+    // dicts are not shared, so items and funnels of all shards are inserted at the same time.
+    phase = Clock::now();
+    uint64_t itemNum = 0, funnelNum = 0;
+    boost::thread_group inserters;
+    for (std::size_t i = 0; i < shardNum; ++i) {
+        Shard* shard = aside->shards[i];
+        inserters.create_thread(boost::bind(&insertItems, &shard->itemDict, &batch, i, shardTable[i].itemNum));
+        inserters.create_thread(boost::bind(&insertFunnels, &shard->funnelDict, &batch, i, shardTable[i].funnelNum));
+        itemNum += shardTable[i].itemNum;
+        funnelNum += shardTable[i].funnelNum;
+    }
+    inserters.join_all();
+    int64_t insertMillis = millisSince(phase);
+
+    trieLoaders.join_all();
+    for (std::size_t i = 0; i < shardNum; ++i) {
+        const std::string trieFile = trieFileOf(config, i, header.generation);
+        const Trie& trie = aside->shards[i]->trie;
+        if (!trieOk[i]) {
+            CS_DIE("failed on loading trie from " << trieFile);
+        }
+        if (trie.nodes() != shardTable[i].trieNodes) {
+            CS_DIE("trie in " << trieFile << " does not match snapshot " << config->itemsFile
+                << ": " << trie.nodes() << " nodes, expected " << shardTable[i].trieNodes);
+        }
+    }
+
+    // keys of items are not stored but derived from tries and funnels.
+    phase = Clock::now();
+    boost::thread_group indexers;
+    for (std::size_t i = 0; i < shardNum; ++i) {
+        indexers.create_thread(boost::bind(&Shard::reindex, aside->shards[i]));
+    }
+    indexers.join_all();
+    int64_t reindexMillis = millisSince(phase);
+
+    if (replace && ResultCache::instance()) {
+        ResultCache::instance()->invalidateAll();
+    }
+    lastLsn = header.lsn;
+    LOG(INFO) << "restored " << itemNum << " items and " << funnelNum << " funnels of "
+        << shardNum << " shards at lsn " << header.lsn << " in " << millisSince(start) << "ms: decoded "
+        << table.size() << " segments by " << threadNum << " threads in " << decodeMillis
+        << "ms, inserted in " << insertMillis << "ms, loaded tries in "
+        << *std::max_element(trieMillis.begin(), trieMillis.end()) << "ms, reindexed keys in "
+        << reindexMillis << "ms";
+    return true;
+}
+
+bool Snapshot::dump(lsn_t lsn) const
+{
+    const Aside* aside = Aside::instance();
+    const std::size_t shardNum = aside->shards.size();
+    uint64_t generation;
+    const std::string itemsTmp = stage(config, generation).back();
+
+    // tries of a new generation are no one's yet, they're written in place.
+    for (std::size_t i = 0; i < shardNum; ++i) {
+        const std::string trieFile = trieFileOf(config, i, generation);
+        if (!aside->shards[i]->trie.save(trieFile) || !syncFile(trieFile) || !syncFile(trieFile + ".sbl")) {
+            return false;
+        }
+    }
+
+    FILE* fp = std::fopen(itemsTmp.c_str(), "wb");
+    if (fp == NULL) {
+        return false;
+    }
+
+    SnapshotHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = snapshot_magic;
+    header.version = snapshot_version;
+    header.lsn = lsn;
+    header.generation = generation;
+    header.shardNum = shardNum;
+    header.itemSegments = header.funnelSegments = snapshot_segments;
+
+    const std::size_t perShard = header.itemSegments + header.funnelSegments;
+    ShardTable shardTable(shardNum);
+    SegmentTable table(shardNum * perShard);
+    std::memset(&table[0], 0, table.size() * sizeof(SegmentEntry));
+    const uint64_t dataOffset = sizeof(header) + shardTable.size() * sizeof(ShardEntry)
+        + table.size() * sizeof(SegmentEntry);
+    bool ok = std::fseek(fp, dataOffset, SEEK_SET) == 0;
+
+    // dicts are cut into segments of consecutive entries, in iteration order.
+    SegmentWriter writer(fp, dataOffset);
+    for (std::size_t shardNo = 0; ok && shardNo < shardNum; ++shardNo) {
+        const Shard& shard = *aside->shards[shardNo];
+        ShardEntry& entry = shardTable[shardNo];
+        entry.trieNodes = shard.trie.nodes();
+        entry.itemNum = shard.itemDict.size();
+        entry.funnelNum = shard.funnelDict.size();
+        SegmentEntry* segments = &table[shardNo * perShard];
+
+        uint64_t i = 0;
+        for (ItemDict::const_iterator it = shard.itemDict.begin(); ok && it != shard.itemDict.end(); ++it, ++i) {
+            if (i * header.itemSegments % entry.itemNum < header.itemSegments) {
+                writer.begin(segments[i * header.itemSegments / entry.itemNum]);
+            }
+            encodeItem(*it->second, writer.buffer);
+            writer.commit();
+            ok = writer.ok;
+        }
+        i = 0;
+        for (FunnelDict::const_iterator it = shard.funnelDict.begin();
+            ok && it != shard.funnelDict.end(); ++it, ++i) {
+            if (i * header.funnelSegments % entry.funnelNum < header.funnelSegments) {
+                writer.begin(segments[header.itemSegments + i * header.funnelSegments / entry.funnelNum]);
+            }
+            put(writer.buffer, it->first);
+            put(writer.buffer, static_cast<uint32_t>(it->second.size()));
+            for (Funnel::const_iterator pos = it->second.begin(); pos != it->second.end(); ++pos) {
+                put(writer.buffer, pos->first);
+            }
+            writer.commit();
+            ok = writer.ok;
+        }
+    }
+    writer.flush();
+    ok = ok && writer.ok;
+
+    ok = ok && std::fseek(fp, 0, SEEK_SET) == 0 && write(fp, header)
+        && std::fwrite(&shardTable[0], sizeof(ShardEntry), shardTable.size(), fp) == shardTable.size()
+        && std::fwrite(&table[0], sizeof(SegmentEntry), table.size(), fp) == table.size();
+    ok = ok && std::fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    ok = (std::fclose(fp) == 0) && ok;
+    return ok && install(config, generation);
+}
+
+void Snapshot::wait(pid_t pid, lsn_t lsn, std::time_t start)
+{
+    int status = 0;
+    pid_t res;
+    while ((res = waitpid(pid, &status, 0)) < 0 && errno == EINTR) {}
+
+    if (res == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        lastLsn = lsn;
+        if (Wal::instance()) {
+            Wal::instance()->purge(lsn);
+        }
+        LOG(INFO) << "snapshot at lsn " << lsn << " stored in " << (std::time(NULL) - start) << " seconds";
+    } else {
+        LOG(ERROR) << "snapshot at lsn " << lsn << " failed, status of process " << pid << " is " << status;
+    }
+    running = false;
+}
+
+void Snapshot::timerLoop(std::time_t interval)
+{
+    while (true) {
+        boost::this_thread::sleep(boost::posix_time::seconds(interval));
+        if (store(false) == status_failed) {
+            LOG(ERROR) << "failed on storing snapshot by timer";
+        }
+    }
+}
+
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "predef.hpp"
+#include <string>
+#include <ctime>
+#include <vector>
+extern "C" {
+#   include <sys/types.h>
+}
+#include <boost/atomic.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include "Config.hpp"
+#include "Aside.hpp"
+#include "Wal.hpp"
+
+namespace taboo
+{
+
+// persists trie/items into @trie-file/@items-file without blocking queries or manage requests.
+// store() forks while holding read-locks of all shards for a moment only: the child owns a copy-on-write
+// image of index at that moment and serializes it, while the parent goes on serving.
+// wal is rotated at the same moment, so the snapshot covers exactly the rotated segments,
+// which are purged once the child exits successfully.
+class Snapshot
+{
+public:
+    enum Status {
+        status_started,
+        status_unchanged,   // no manage operation since the last snapshot
+        status_running,     // another snapshot is in progress
+        status_failed,
+    };
+
+private:
+    static Snapshot* _instance;
+
+    const Config* config;
+
+    boost::atomic<bool> running;
+    boost::atomic<lsn_t> lastLsn;   // lsn covered by the last (restored or stored) snapshot
+
+    boost::mutex pinMutex;
+    std::size_t pins;               // files being read, no snapshot replaces them meanwhile
+
+    boost::thread* timer;
+
+public:
+    static Snapshot* instance()
+    {
+        return _instance;
+    }
+
+    // restores index with @restore-on-start, then stores every @snapshot-interval seconds.
+    static bool initialize();
+
+    Status store(bool force);
+
+    lsn_t lsn() const
+    {
+        return lastLsn.load();
+    }
+
+    // keeps files of the last snapshot from being replaced until unpin(), false if one is being stored.
+    bool pin();
+
+    void unpin();
+
+    // replaces index with the snapshot in place, once a follower has fetched the one of leader.
+    // queries wait until it's done.
+    bool reload();
+
+    // trie files of all shards then @items-file of the snapshot in place.
+    static std::vector<std::string> files(const Config* config);
+
+    // files to write a snapshot replacing the one in place into, as files() lists them, but
+    // @items-file is '.tmp' of it. tries are named after a new @generation, install() switches to them.
+    static std::vector<std::string> stage(const Config* config, uint64_t& generation);
+
+    // renames @items-file staged for @generation into place, which is atomic, then removes tries
+    // of other generations. @items-file tells which tries are its own, a crash leaves either snapshot.
+    static bool install(const Config* config, uint64_t generation);
+
+    // lsn of snapshot in @items-file, without restoring it, 0 if there's none.
+    static lsn_t peek(const Config* config);
+
+private:
+    explicit Snapshot(const Config* _config):
+        config(_config), running(false), lastLsn(0), pins(0), timer(NULL)
+    {}
+
+    bool restore();
+
+    // restores snapshot in place, into empty shards or, with @replace, in place of what's in them.
+    bool load(bool replace);
+
+    // runs in the forked child.
+    bool dump(lsn_t lsn) const;
+
+    void wait(pid_t pid, lsn_t lsn, std::time_t start);
+
+    void timerLoop(std::time_t interval);
+};
+
+}
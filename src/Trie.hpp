@@ -4,10 +4,17 @@
 #include "predef.hpp"
 #include <string>
 #include <list>
+#include <vector>
+#include <algorithm>
+#include "Memory.hpp"
 #define USE_FAST_LOAD
+#define CEDAR_REALLOC(p, size) taboo::HugePages::realloc(p, size)
+#define CEDAR_FREE(p) taboo::HugePages::free(p)
 #   include "cedar/cedar.h"
 #undef USE_FAST_LOAD
+#include "Config.hpp"
 #include "Item.hpp"
+#include "PrefixFilter.hpp"
 
 namespace taboo
 {
@@ -29,9 +36,22 @@ private:
 
     id_t funnelIdCursor;
 
+    std::size_t keyNum;
+
+    PrefixFilter filter;
+
+    const std::size_t prefetchBatch;
+
 public:
+    // @prefix-filter-size is shared by tries of all shards.
     Trie():
-        funnelIdCursor(0)
+        funnelIdCursor(0),
+        keyNum(0),
+        filter(Config::instance()->prefixFilterSize / Config::instance()->indexShards,
+            Config::instance()->prefixFilterHashes,
+            Config::instance()->prefixMinLen, Config::instance()->prefixMaxLen),
+        prefetchBatch(std::max<std::size_t>(1, std::min<std::size_t>(
+            Config::instance()->triePrefetchBatch, max_prefetch_batch)))
     {}
 
     template<typename Callback>
@@ -42,8 +62,10 @@ public:
             std::size_t nodePos = 0, keyPos = 0;
             id_t funnelId = da.traverse(it->data(), nodePos, keyPos, it->length());
             if (funnelId == no_path || funnelId == no_value) {
+                filter.add(*it);
                 funnelId = newFunnelId();
                 da.update(it->data(), it->length(), funnelId);
+                ++keyNum;
                 CS_DUMP(da.exactMatchSearch<id_t>(it->c_str(), it->length()));
                 attached = true;
             }
@@ -54,42 +76,117 @@ public:
         return attached;
     }
 
-    // 解除 keys => item 的关联，但不删除 item
-    bool detach(const KeyList& keys, id_t id)
+    // removes key, its funnel should be empty already.
+    bool remove(const std::string& key)
     {
+        if (da.erase(key.data(), key.length()) == 0) {
+            filter.remove(key);
+            --keyNum;
+            return true;
+        }
         return false;
     }
 
-    // 解除 keys => item 的关联，并删除 item
-    template<typename Callback>
-    bool erase(const KeyList& keys, id_t id, Callback& cb)
+    // false means there is no key starts with @prefix for sure.
+    // NOTE: lock free.
+    bool mayContain(const std::string& prefix) const
     {
-        // 找到位置
-        // 找出新的 value
-        // 更新value  或者直接删除
-        return false;
+        return filter.mayContain(prefix);
     }
 
+    // funnel ids are collected in batches, @cb.prefetch() is issued for each id
+    // once it's collected, then @cb.locate() for each and @cb() for each once the batch is full,
+    // so that memory accesses of a batch overlap instead of missing cache one by one.
+    // what locate() returns (of type Callback::Hint) is passed to @cb() with the id.
     template<typename Callback>
     void traverse(const std::string& key, Callback& cb) const
     {
         std::size_t nodePos = 0, keyPos = 0;
-        id_t funnelId = da.traverse(key.data(), nodePos, keyPos, key.length());
-        if (funnelId != no_path) {
-            if (funnelId != no_value) {
-                if (!cb(funnelId)) {
-                    return;
-                }
+        id_t exact = da.traverse(key.data(), nodePos, keyPos, key.length());
+        if (exact == no_path) {
+            return;
+        }
+        Pipeline<Callback> pipeline(cb, prefetchBatch);
+        if (exact != no_value) {
+            if (!pipeline.push(exact)) {
+                return;
             }
-            std::size_t root = nodePos;
-            funnelId = da.begin(nodePos, keyPos);
-            while (funnelId != no_path) {
-                if (!cb(funnelId)) {
+        }
+        std::size_t root = nodePos;
+        for (id_t funnelId = da.begin(nodePos, keyPos); funnelId != no_path;
+            funnelId = da.next(nodePos, keyPos, root)) {
+            if (funnelId != exact) {    // funnel of @key itself is yielded again.
+                if (!pipeline.push(funnelId)) {
                     return;
                 }
-                funnelId = da.next(nodePos, keyPos, root);
             }
         }
+        pipeline.flush();
+    }
+
+    // writes double array into @path (and @path.sbl).
+    bool save(const std::string& path) const
+    {
+        return da.save(path.c_str()) == 0;
+    }
+
+    // loads double array saved by save() in place of what's in it, then rebuilds prefix filter
+    // and funnel id cursor.
+    bool load(const std::string& path)
+    {
+        if (da.open(path.c_str()) != 0) {
+            return false;
+        }
+        filter.clear();
+        funnelIdCursor = 0;
+        keyNum = 0;
+        LoadCallback cb(*this);
+        forEach(cb);
+        return true;
+    }
+
+    // calls @cb(key, funnelId) for every key.
+    template<typename Callback>
+    void forEach(Callback& cb) const
+    {
+        std::vector<char> key(Config::instance()->prefixMaxLen + 1);
+        std::size_t nodePos = 0, keyPos = 0;
+        for (id_t funnelId = da.begin(nodePos, keyPos); funnelId != no_path;
+            funnelId = da.next(nodePos, keyPos)) {
+            if (key.size() <= keyPos) {
+                key.resize(keyPos + 1);
+            }
+            da.suffix(&key[0], keyPos, nodePos);
+            cb(std::string(&key[0], keyPos), funnelId);
+        }
+    }
+
+    // number of double array nodes, to check a loaded trie against its snapshot.
+    std::size_t nodes() const
+    {
+        return da.size();
+    }
+
+    // nodes allocated.
+    std::size_t capacity() const
+    {
+        return da.capacity();
+    }
+
+    std::size_t nodeSize() const
+    {
+        return da.unit_size();
+    }
+
+    // bytes of sibling info and blocks cedar keeps along @capacity nodes, to speed up updates.
+    static std::size_t infoBytes(std::size_t capacity)
+    {
+        return capacity * sizeof(DA::ninfo) + (capacity >> 8) * sizeof(DA::block);
+    }
+
+    std::size_t keys() const
+    {
+        return keyNum;
     }
 
     id_t operator[](const std::string& key) const
@@ -99,6 +196,64 @@ public:
     }
 
 protected:
+    enum { max_prefetch_batch = 64 };
+
+    template<typename Callback>
+    class Pipeline
+    {
+    private:
+        Callback& cb;
+        const std::size_t capacity;
+        std::size_t num;
+        id_t ids[max_prefetch_batch];
+        typename Callback::Hint hints[max_prefetch_batch];
+
+    public:
+        Pipeline(Callback& _cb, std::size_t _capacity):
+            cb(_cb), capacity(_capacity), num(0)
+        {}
+
+        bool push(id_t funnelId)
+        {
+            cb.prefetch(funnelId);
+            ids[num++] = funnelId;
+            return num < capacity || flush();
+        }
+
+        bool flush()
+        {
+            std::size_t total = num;
+            num = 0;
+            for (std::size_t i = 0; i < total; ++i) {
+                hints[i] = cb.locate(ids[i]);
+            }
+            for (std::size_t i = 0; i < total; ++i) {
+                if (!cb(ids[i], hints[i])) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    };
+
+    class LoadCallback
+    {
+    private:
+        Trie& trie;
+
+    public:
+        explicit LoadCallback(Trie& _trie):
+            trie(_trie)
+        {}
+
+        void operator()(const std::string& key, id_t funnelId) const
+        {
+            trie.filter.add(key);
+            ++trie.keyNum;
+            trie.funnelIdCursor = std::max(trie.funnelIdCursor, funnelId);
+        }
+    };
+
     id_t newFunnelId()
     {
         return ++funnelIdCursor;
@@ -0,0 +1,621 @@
+
+#include "Wal.hpp"
+extern "C" {
+#   include <fcntl.h>
+#   include <unistd.h>
+#   include <errno.h>
+#   include <sys/types.h>
+#   include <sys/stat.h>
+}
+#include <cstdio>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <boost/crc.hpp>
+#include <boost/bind.hpp>
+#include <boost/chrono.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/filesystem/operations.hpp>
+#include "Keeper.hpp"
+
+namespace taboo
+{
+
+namespace
+{
+
+template<typename IntType>
+inline void put(std::string& out, IntType value)
+{
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+inline void put(std::string& out, const std::string& str)
+{
+    put<uint32_t>(out, str.length());
+    out += str;
+}
+
+class Reader
+{
+private:
+    const char* cursor;
+    const char* const end;
+
+public:
+    Reader(const char* data, std::size_t length):
+        cursor(data), end(data + length)
+    {}
+
+    template<typename IntType>
+    bool get(IntType& value)
+    {
+        if (static_cast<std::size_t>(end - cursor) < sizeof(value)) {
+            return false;
+        }
+        std::memcpy(&value, cursor, sizeof(value));
+        cursor += sizeof(value);
+        return true;
+    }
+
+    bool get(std::string& str)
+    {
+        uint32_t length;
+        if (!get(length) || static_cast<std::size_t>(end - cursor) < length) {
+            return false;
+        }
+        str.assign(cursor, length);
+        cursor += length;
+        return true;
+    }
+};
+
+inline uint32_t crc(const char* data, std::size_t length)
+{
+    boost::crc_32_type crc32;
+    crc32.process_bytes(data, length);
+    return crc32.checksum();
+}
+
+const std::size_t record_header_size = sizeof(uint32_t) + sizeof(uint32_t);
+
+// lsn of the first record in @path, 0 if there's none.
+lsn_t firstLsn(const boost::filesystem::path& path)
+{
+    lsn_t lsn = 0;
+    FILE* fp = std::fopen(path.c_str(), "rb");
+    if (fp == NULL) {
+        return lsn;
+    }
+    uint32_t header[2];
+    if (std::fread(header, sizeof(header), 1, fp) != 1 || std::fread(&lsn, sizeof(lsn), 1, fp) != 1) {
+        lsn = 0;
+    }
+    std::fclose(fp);
+    return lsn;
+}
+
+}
+
+WalRecord::WalRecord(Op _op, const KeyList& _keys, const SharedItem& _item, bool _upsert):
+    lsn(0), op(_op), upsert(_upsert), keys(_keys), item(dumpItem(*_item))
+{}
+
+void WalRecord::encode(std::string& out) const
+{
+    std::string body;
+    body.reserve(32 + item.length() + keys.size() * 16);
+    put(body, lsn);
+    put(body, op);
+    put<uint8_t>(body, upsert);
+    put<uint32_t>(body, keys.size());
+    for (KeyList::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+        put(body, *it);
+    }
+    put(body, item);
+
+    put<uint32_t>(out, body.length());
+    put<uint32_t>(out, crc(body.data(), body.length()));
+    out += body;
+}
+
+bool WalRecord::decode(const char* data, std::size_t length)
+{
+    Reader reader(data, length);
+    uint8_t _upsert;
+    uint32_t keyNum;
+    if (!reader.get(lsn) || !reader.get(op) || !reader.get(_upsert) || !reader.get(keyNum)) {
+        return false;
+    }
+    upsert = _upsert;
+    keys.clear();
+    for (uint32_t i = 0; i < keyNum; ++i) {
+        keys.push_back(std::string());
+        if (!reader.get(keys.back())) {
+            return false;
+        }
+    }
+    return reader.get(item);
+}
+
+Wal* Wal::_instance = NULL;
+
+bool Wal::initialize(lsn_t since)
+{
+    const Config* config = Config::instance();
+    if (!config->walEnable) {
+        return true;
+    }
+    Wal* wal = new Wal(config);
+    wal->lastLsn = wal->flushedLsn = std::max(wal->replay(since), since);
+    if (!wal->open()) {
+        CS_DIE("failed on opening wal-file " << wal->file << ": " << std::strerror(errno));
+    }
+    if (wal->syncMode == sync_interval) {
+        wal->syncer = new boost::thread(boost::bind(&Wal::syncLoop, wal, config->walSyncInterval));
+    }
+    _instance = wal;
+    return true;
+}
+
+Wal::SyncMode Wal::parseSyncMode(const std::string& mode)
+{
+    if (mode == "interval") {
+        return sync_interval;
+    } else if (mode == "never") {
+        return sync_never;
+    }
+    return sync_always;
+}
+
+Wal::Wal(const Config* config):
+    file(config->walFile), syncMode(parseSyncMode(config->walSync)), fd(-1),
+    lastLsn(0), flushedLsn(0), flushing(false), broken(false), syncer(NULL)
+{}
+
+lsn_t Wal::replay(lsn_t since)
+{
+    boost::chrono::steady_clock::time_point start = boost::chrono::steady_clock::now();
+    lsn_t last = 0;
+    std::size_t replayed = 0;
+    SegmentMap all = segments();
+    for (SegmentMap::const_iterator it = all.begin(); it != all.end(); ++it) {
+        if (since < it->first) {
+            last = std::max(last, replay(it->second, since, false, replayed));
+        }
+    }
+    last = std::max(last, replay(file, since, true, replayed));
+    LOG(INFO) << "replayed " << replayed << " records after lsn " << since
+        << " from wal-file " << file << " and " << all.size() << " segments in "
+        << boost::chrono::duration_cast<boost::chrono::milliseconds>(
+            boost::chrono::steady_clock::now() - start).count()
+        << "ms, last lsn is " << last;
+    return last;
+}
+
+lsn_t Wal::replay(const boost::filesystem::path& path, lsn_t since, bool truncateTail, std::size_t& replayed)
+{
+    lsn_t last = 0;
+    FILE* fp = std::fopen(path.c_str(), "rb");
+    if (fp == NULL) {
+        return last;
+    }
+    std::size_t good = 0;
+    std::vector<char> body;
+    WalRecord record;
+    while (true) {
+        uint32_t header[2];
+        if (std::fread(header, sizeof(header), 1, fp) != 1) {
+            break;
+        }
+        // a length beyond any record is a torn or corrupt header, not something to allocate.
+        if (header[0] == 0 || WalReader::max_record_size < header[0]) {
+            break;
+        }
+        body.resize(header[0]);
+        if (std::fread(&body[0], header[0], 1, fp) != 1
+            || crc(&body[0], header[0]) != header[1] || !record.decode(&body[0], header[0])) {
+            break;
+        }
+        good += record_header_size + header[0];
+        last = record.lsn;
+        if (since < record.lsn) {
+            Keeper::instance()->replay(record);
+            ++replayed;
+        }
+    }
+    std::fseek(fp, 0, SEEK_END);
+    long size = std::ftell(fp);
+    std::fclose(fp);
+    if (static_cast<long>(good) < size) {
+        LOG(WARNING) << "wal-file " << path << " has a torn tail of " << (size - good) << " bytes"
+            << (truncateTail ? ", truncated" : "");
+        if (truncateTail && truncate(path.c_str(), good) != 0) {
+            CS_DIE("failed on truncating wal-file " << path << ": " << std::strerror(errno));
+        }
+    }
+    return last;
+}
+
+Wal::SegmentMap Wal::segments() const
+{
+    SegmentMap res;
+    boost::filesystem::path dir = file.parent_path();
+    if (dir.empty()) {
+        dir = ".";
+    }
+    boost::system::error_code ec;
+    std::string prefix = file.filename().string() + ".";
+    for (boost::filesystem::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+        std::string name = it->path().filename().string();
+        if (name.length() > prefix.length() && name.compare(0, prefix.length(), prefix) == 0) {
+            try {
+                res[boost::lexical_cast<lsn_t>(name.substr(prefix.length()))] = it->path();
+            } catch (const boost::bad_lexical_cast&) {
+            }
+        }
+    }
+    return res;
+}
+
+bool Wal::rotate(lsn_t& lsn)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    while (flushing) {
+        flushed.wait(lock);
+    }
+    if (broken) {
+        return false;
+    }
+    std::string batch;
+    batch.swap(pending);
+    flushing = true;
+    lock.unlock();
+    bool ok = write(batch, true);
+    lock.lock();
+    flushing = false;
+    if (ok) {
+        flushedLsn = lastLsn;
+    }
+    flushed.notify_all();
+    if (!ok) {
+        return false;
+    }
+
+    lsn = lastLsn;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size == 0) {
+        return true;    // nothing since last rotation
+    }
+    char suffix[32];
+    std::snprintf(suffix, sizeof(suffix), ".%020llu", static_cast<unsigned long long>(lastLsn));
+    ::close(fd);
+    if (std::rename(file.c_str(), (file.string() + suffix).c_str()) != 0) {
+        LOG(ERROR) << "failed on rotating wal-file " << file << ": " << std::strerror(errno);
+    }
+    if (!open()) {
+        LOG(ERROR) << "failed on opening wal-file " << file << ": " << std::strerror(errno);
+        breakDown();
+        return false;
+    }
+    return true;
+}
+
+void Wal::purge(lsn_t lsn)
+{
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        if (!holds.empty()) {
+            lsn = std::min(lsn, *holds.begin());
+        }
+    }
+    SegmentMap all = segments();
+    for (SegmentMap::const_iterator it = all.begin(); it != all.end() && it->first <= lsn; ++it) {
+        boost::system::error_code ec;
+        if (!boost::filesystem::remove(it->second, ec)) {
+            LOG(WARNING) << "failed on removing wal segment " << it->second << ": " << ec.message();
+        }
+    }
+}
+
+bool Wal::covers(lsn_t lsn)
+{
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        if (lastLsn <= lsn) {
+            return true;
+        }
+    }
+    // segments are purged oldest first, the first one after @lsn (or the live log) tells.
+    SegmentMap all = segments();
+    SegmentMap::const_iterator it = all.upper_bound(lsn);
+    lsn_t first = firstLsn(it == all.end() ? file : it->second);
+    return first && first <= lsn + 1;
+}
+
+void Wal::skipTo(lsn_t lsn)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    while (flushing) {
+        flushed.wait(lock);
+    }
+    if (lastLsn < lsn && pending.empty()) {
+        lastLsn = flushedLsn = lsn;
+    }
+}
+
+void Wal::retain(lsn_t lsn)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    holds.insert(lsn);
+}
+
+void Wal::release(lsn_t lsn)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    std::multiset<lsn_t>::iterator it = holds.find(lsn);
+    if (it != holds.end()) {
+        holds.erase(it);
+    }
+}
+
+lsn_t Wal::waitWritten(lsn_t lsn, long millis)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    if (flushedLsn <= lsn) {
+        flushed.timed_wait(lock, boost::posix_time::milliseconds(millis));
+    }
+    return flushedLsn;
+}
+
+bool Wal::open()
+{
+    fd = ::open(file.c_str(), O_WRONLY | O_APPEND | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP);
+    return fd != -1;
+}
+
+lsn_t Wal::append(WalRecord& record)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    if (CS_BUNLIKELY(broken)) {
+        return 0;
+    }
+    if (record.lsn) {
+        lastLsn = record.lsn;
+    } else {
+        record.lsn = ++lastLsn;
+    }
+    record.encode(pending);
+    return record.lsn;
+}
+
+bool Wal::commit(lsn_t lsn)
+{
+    if (lsn == 0 || syncMode == sync_interval) {
+        return !isBroken();
+    }
+    return flush(lsn, syncMode == sync_always);
+}
+
+bool Wal::flush(lsn_t lsn, bool sync)
+{
+    boost::mutex::scoped_lock lock(mutex);
+    while (flushedLsn < lsn) {
+        if (broken) {
+            return false;
+        }
+        if (flushing) {     // someone is flushing, maybe for us too.
+            flushed.wait(lock);
+            continue;
+        }
+        flushing = true;
+        std::string batch;
+        batch.swap(pending);
+        lsn_t batchLsn = lastLsn;
+        lock.unlock();
+
+        bool ok = write(batch, sync);
+
+        lock.lock();
+        flushing = false;
+        if (ok) {
+            flushedLsn = batchLsn;
+        }
+        flushed.notify_all();
+    }
+    return !broken;
+}
+
+bool Wal::write(const std::string& batch, bool sync)
+{
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (CS_BLIKELY(writeAll(batch) && (!sync || fdatasync(fd) == 0))) {
+        return true;
+    }
+    LOG(ERROR) << "failed on writing wal-file " << file << ", it's broken, manage operations fail from now on: "
+        << std::strerror(errno);
+    // a torn record would end replay there, cut it off even though nothing is appended after it.
+    if (size >= 0 && ftruncate(fd, size) != 0) {
+        LOG(ERROR) << "failed on truncating wal-file " << file << ": " << std::strerror(errno);
+    }
+    boost::mutex::scoped_lock lock(mutex);
+    breakDown();
+    return false;
+}
+
+void Wal::breakDown()
+{
+    broken = true;
+    pending.clear();
+    flushed.notify_all();
+}
+
+void Wal::syncLoop(std::time_t interval)
+{
+    while (!isBroken()) {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(interval));
+        flush(last(), true);
+    }
+}
+
+bool Wal::writeAll(const std::string& data)
+{
+    const char* cursor = data.data();
+    std::size_t remain = data.length();
+    while (remain) {
+        ssize_t written = ::write(fd, cursor, remain);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        cursor += written;
+        remain -= written;
+    }
+    return true;
+}
+
+WalReader::WalReader(Wal& _wal, lsn_t _after):
+    wal(_wal), fd(-1), liveFd(-1), live(false), inode(0), consumed(0), after(_after), broken(false)
+{
+    // live log is opened before segments are listed: if it's rotated in between, it's listed
+    // as a segment too, and records read twice are skipped by lsn.
+    liveFd = openLive(inode);
+    Wal::SegmentMap all = wal.segments();
+    for (Wal::SegmentMap::const_iterator it = all.upper_bound(after); it != all.end(); ++it) {
+        segments.push_back(it->second);
+    }
+    advance();
+}
+
+WalReader::~WalReader()
+{
+    if (fd != -1) {
+        ::close(fd);
+    }
+    if (liveFd != -1) {
+        ::close(liveFd);
+    }
+}
+
+bool WalReader::next(std::string& out, lsn_t& lsn, long millis)
+{
+    bool waited = false;
+    while (!broken) {
+        if (extract(out, lsn, wal.lastFlushed())) {
+            if (lsn <= after) {
+                continue;
+            }
+            after = lsn;
+            return true;
+        }
+        if (fill() > 0) {
+            continue;
+        }
+        if (!live) {
+            advance();
+            continue;
+        }
+        // rotated: the old log is complete once renamed, drains it then turns to the new one.
+        ino_t current = 0;
+        int newFd = openLive(current);
+        if (newFd != -1 && current != inode) {
+            if (fill() > 0 || consumed < buffer.length()) {     // records held back by a stale limit too
+                ::close(newFd);
+                continue;
+            }
+            ::close(fd);
+            fd = newFd;
+            inode = current;
+            buffer.clear();
+            consumed = 0;
+            continue;
+        }
+        if (newFd != -1) {
+            ::close(newFd);
+        }
+        if (waited) {
+            break;
+        }
+        wal.waitWritten(after, millis);
+        waited = true;
+    }
+    return false;
+}
+
+bool WalReader::extract(std::string& out, lsn_t& lsn, lsn_t limit)
+{
+    std::size_t remain = buffer.length() - consumed;
+    uint32_t header[2];
+    if (remain < sizeof(header) + sizeof(lsn)) {
+        return false;
+    }
+    std::memcpy(header, buffer.data() + consumed, sizeof(header));
+    if (CS_BUNLIKELY(header[0] < sizeof(lsn) || max_record_size < header[0])) {
+        LOG(ERROR) << "bad record in wal-file " << wal.file << " after lsn " << after;
+        broken = true;
+        return false;
+    }
+    if (remain < sizeof(header) + header[0]) {
+        return false;   // not written completely yet
+    }
+    std::memcpy(&lsn, buffer.data() + consumed + sizeof(header), sizeof(lsn));
+    if (limit < lsn) {
+        return false;   // written but not flushed, may be cut off yet
+    }
+    out.append(buffer, consumed, sizeof(header) + header[0]);
+    consumed += sizeof(header) + header[0];
+    return true;
+}
+
+ssize_t WalReader::fill()
+{
+    if (consumed) {
+        buffer.erase(0, consumed);
+        consumed = 0;
+    }
+    std::size_t length = buffer.length();
+    buffer.resize(length + read_size);
+    ssize_t got;
+    while ((got = ::read(fd, &buffer[length], read_size)) < 0 && errno == EINTR) {}
+    buffer.resize(length + std::max<ssize_t>(got, 0));
+    if (got < 0) {
+        LOG(ERROR) << "failed on reading wal-file " << wal.file << ": " << std::strerror(errno);
+        broken = true;
+    }
+    return got;
+}
+
+void WalReader::advance()
+{
+    if (fd != -1) {
+        ::close(fd);
+    }
+    buffer.clear();
+    consumed = 0;
+    if (segments.empty()) {
+        fd = liveFd;
+        liveFd = -1;
+        live = true;
+    } else {
+        fd = ::open(segments.front().c_str(), O_RDONLY);
+        segments.pop_front();
+    }
+    if (fd == -1) {
+        LOG(ERROR) << "failed on opening wal-file for shipping: " << std::strerror(errno);
+        broken = true;
+    }
+}
+
+int WalReader::openLive(ino_t& ino) const
+{
+    int res = ::open(wal.file.c_str(), O_RDONLY);
+    struct stat st;
+    if (res != -1 && fstat(res, &st) == 0) {
+        ino = st.st_ino;
+    }
+    return res;
+}
+
+}
@@ -0,0 +1,231 @@
+#pragma once
+
+#include "predef.hpp"
+#include <string>
+#include <map>
+#include <set>
+#include <list>
+#include <vector>
+extern "C" {
+#   include <sys/types.h>
+}
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/filesystem/path.hpp>
+#include "Config.hpp"
+#include "Item.hpp"
+#include "Trie.hpp"
+
+namespace taboo
+{
+
+typedef uint64_t lsn_t;     // log sequence number
+
+// one manage operation, as it's logged.
+class WalRecord
+{
+public:
+    enum Op {
+        op_attach       = 1,
+        op_update_item  = 2,
+        op_detach       = 3,
+        op_patch        = 4,
+    };
+
+    lsn_t lsn;
+    uint8_t op;
+    bool upsert;
+    KeyList keys;
+    std::string item;   // item in JSON
+
+    WalRecord():
+        lsn(0), op(0), upsert(false)
+    {}
+
+    WalRecord(Op _op, const KeyList& _keys, const SharedItem& _item, bool _upsert = false);
+
+    // appends [length, crc, lsn, op, payload] to @out.
+    void encode(std::string& out) const;
+
+    // @data points to [lsn, op, payload], crc checked already.
+    bool decode(const char* data, std::size_t length);
+};
+
+typedef std::vector<WalRecord> WalRecordList;
+
+// write-ahead log of manage operations.
+// records are appended while write-lock of the shard is held, so log order is apply order
+// (operations on different shards touch nothing in common, their order doesn't matter);
+// commit() is called after the lock is released: concurrent committers are
+// grouped, the first one writes and syncs everything pending for all of them.
+// when a snapshot starts the log is rotated into segment '@wal-file.<last lsn>',
+// segments covered by a completed snapshot are purged, but those retained for followers.
+// once a write or sync fails the log is broken: what's pending is dropped, the log is cut back to
+// its last complete record, and every commit and append after fails, until restarted.
+class Wal
+{
+public:
+    enum SyncMode {
+        sync_always,    // fdatasync before commit() returns
+        sync_interval,  // fdatasync by a background thread every @wal-sync-interval ms
+        sync_never,     // write before commit() returns, left to OS to sync
+    };
+
+private:
+    static Wal* _instance;
+
+    const boost::filesystem::path file;
+    const SyncMode syncMode;
+    int fd;
+
+    boost::mutex mutex;
+    boost::condition_variable flushed;
+    std::string pending;
+    lsn_t lastLsn, flushedLsn;
+    bool flushing;
+    bool broken;
+
+    std::multiset<lsn_t> holds;     // positions of followers, segments after them are kept
+
+    boost::thread* syncer;
+
+public:
+    static Wal* instance()
+    {
+        return _instance;
+    }
+
+    // replays log after @since (the lsn covered by snapshot) into Keeper, then opens it for appending.
+    static bool initialize(lsn_t since);
+
+    // NOTE: must be called with write-lock of the shard held.
+    // a record shipped from leader keeps its lsn, so a follower's log numbers as the leader's.
+    // returns 0 if log is broken, the record is not logged then.
+    lsn_t append(WalRecord& record);
+
+    // blocks until @lsn is as durable as @wal-sync demands, false if log is broken.
+    bool commit(lsn_t lsn);
+
+    bool isBroken()
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        return broken;
+    }
+
+    lsn_t last()
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        return lastLsn;
+    }
+
+    // the last lsn written (and synced if demanded), what's after is not to be shipped.
+    lsn_t lastFlushed()
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        return flushedLsn;
+    }
+
+    // closes current log as a segment and starts a new one, @lsn is set to the last lsn.
+    // false if log is broken, or breaks on flushing what's pending.
+    // NOTE: must be called with read-locks of all shards held, so nothing is being appended.
+    bool rotate(lsn_t& lsn);
+
+    // removes segments whose records are all covered by a snapshot at @lsn.
+    void purge(lsn_t lsn);
+
+    // true if every record after @lsn is still in segments or the live log, so it can be shipped.
+    bool covers(lsn_t lsn);
+
+    // moves last lsn up to @lsn, once index is replaced by a snapshot at @lsn fetched from leader.
+    void skipTo(lsn_t lsn);
+
+    // keeps records after @lsn from purge(), until release(@lsn).
+    void retain(lsn_t lsn);
+
+    void release(lsn_t lsn);
+
+    // blocks until something after @lsn is written, or @millis passed, returns lsn written.
+    lsn_t waitWritten(lsn_t lsn, long millis);
+
+    static SyncMode parseSyncMode(const std::string& mode);
+
+private:
+    friend class WalReader;
+
+    typedef std::map<lsn_t, boost::filesystem::path> SegmentMap;
+
+    Wal(const Config* config);
+
+    // replays segments then current log, returns lsn of the last good record.
+    lsn_t replay(lsn_t since);
+
+    // truncates torn tail of current log with @truncateTail.
+    lsn_t replay(const boost::filesystem::path& path, lsn_t since, bool truncateTail, std::size_t& replayed);
+
+    SegmentMap segments() const;
+
+    bool open();
+
+    bool flush(lsn_t lsn, bool sync);
+
+    // writes @batch and syncs it if @sync, on failure breaks log and cuts it back to its size before.
+    // NOTE: must be called with @flushing set by the caller, not holding @mutex.
+    bool write(const std::string& batch, bool sync);
+
+    // NOTE: must be called with @mutex held.
+    void breakDown();
+
+    void syncLoop(std::time_t interval);
+
+    bool writeAll(const std::string& data);
+};
+
+// reads records of log after a lsn, from segments then the live log, following appends and
+// rotations, so that they can be shipped to followers as they are.
+class WalReader
+{
+public:
+    enum {
+        read_size = 1 << 16,
+        max_record_size = 64 << 20,    // a length beyond it is a corrupt header
+    };
+
+private:
+    Wal& wal;
+    std::list<boost::filesystem::path> segments;    // to read after the current one
+    int fd, liveFd;
+    bool live;
+    ino_t inode;    // of live log
+    std::string buffer;
+    std::size_t consumed;
+    lsn_t after;
+    bool broken;
+
+public:
+    WalReader(Wal& _wal, lsn_t _after);
+
+    ~WalReader();
+
+    // appends the next record (framed as in log) to @out, waits up to @millis for it.
+    // false if there's none yet, or log isBroken().
+    bool next(std::string& out, lsn_t& lsn, long millis);
+
+    bool isBroken() const
+    {
+        return broken;
+    }
+
+private:
+    // records after @limit are left in buffer.
+    bool extract(std::string& out, lsn_t& lsn, lsn_t limit);
+
+    ssize_t fill();
+
+    // turns to the next segment, or live log after all segments.
+    void advance();
+
+    int openLive(ino_t& ino) const;
+};
+
+}
@@ -1,8 +1,10 @@
 
 #pragma once
 
+#include <ctime>
+#include <cstdlib>
 #include "BaseHandler.hpp"
-#include "../Keeper.hpp"
+#include "../Ingester.hpp"
 
 namespace taboo {
 namespace manager {
@@ -21,6 +23,7 @@ protected:
         err_already_exists  = ECA::ECC<3>::value,
         err_attach_keys     = ECA::ECC<4>::value,
         err_attach_item     = ECA::ECC<5>::value,
+        err_ingest_busy     = ECA::ECC<6>::value,
     };
 
     static const uint32_t maxParamNum = 10;
@@ -32,7 +35,11 @@ protected:
     {
         SharedResult res(new Result);
         do {
-            KeyList keys = getKeys();
+            KeyList keys;
+            if (!getKeys(keys)) {
+                res->code = err_bad_param;
+                break;
+            }
             if (keys.empty()) {
                 res->code = err_no_keys;
                 break;
@@ -49,9 +56,24 @@ protected:
                 break;
             }
 
+            // ttl=0 clears expiry of an upserted item.
+            ParamMap::const_iterator itTtl = params.find(config->keyMUTtl);
+            if (itTtl != params.end()) {
+                uint32_t ttl;
+                if (!parseTtl(itTtl->second, ttl)) {
+                    res->code = err_bad_param;
+                    break;
+                }
+                taboo::expireItem(*item, ttl ? static_cast<uint32_t>(std::time(NULL)) + ttl : 0);
+            }
+
             ParamMap::const_iterator itUpsert = params.find(config->keyMUUpsert);
             bool upsert = itUpsert == params.end() || itUpsert->second.empty() || itUpsert->second[0] != '0';
-            if (!Keeper::instance()->attach(keys, item, upsert)) {
+            Ingester::Result result = Ingester::ingest(Mutation(WalRecord::op_attach, keys, item, upsert), getAck());
+            if (result == Ingester::result_busy) {
+                res->code = err_ingest_busy;
+                break;
+            } else if (result == Ingester::result_unchanged) {
                 res->code = err_already_exists;
                 break;
             }
@@ -62,6 +84,16 @@ protected:
         return res;
     }
 
+    virtual Latency::Metric metric() const
+    {
+        return Latency::metric_manage_attach;
+    }
+
+    virtual bool writes() const
+    {
+        return true;
+    }
+
     virtual ec_t checkParams() const
     {
         return (!(config->checkSign && sign.empty())
@@ -71,22 +103,13 @@ protected:
                err_ok : err_bad_param;
     }
 
-    KeyList getKeys() const
+    static bool parseTtl(const std::string& str, uint32_t& ttl)
     {
-        KeyList keys;
-        ParamMap::const_iterator it = params.find(config->keyMUPrefixes);
-        if (it != params.end()) {
-            Dom prefixes;
-            prefixes.Parse(it->second.c_str());
-            if (prefixes.IsArray()) {
-                for (Dom::ValueIterator i = prefixes.Begin(); i != prefixes.End(); ++i) {
-                    keys.push_back(std::string(i->GetString(), i->GetStringLength()));
-                }
-            } else if (prefixes.IsArray()) {
-                keys.push_back(std::string(prefixes.GetString(), prefixes.GetStringLength()));
-            }
+        if (str.empty() || str.length() > 9 || str.find_first_not_of("0123456789") != std::string::npos) {
+            return false;
         }
-        return keys;
+        ttl = std::strtoul(str.c_str(), NULL, 10);
+        return true;
     }
 
 protected:
@@ -98,6 +121,7 @@ protected:
         fillReply(err_already_exists, "all keys already exist or item already exists");
         fillReply(err_attach_keys, "failed on attaching prefixes");
         fillReply(err_attach_item, "failed on attaching item");
+        fillReply(err_ingest_busy, "too many pending manage operations, retry later");
     }
 };
 
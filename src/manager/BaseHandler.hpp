@@ -12,6 +12,7 @@
 #include "../Aside.hpp"
 #include "../Item.hpp"
 #include "../Signer.hpp"
+#include "../Replication.hpp"
 
 namespace taboo  {
 namespace manager {
@@ -33,6 +34,7 @@ protected:
         err_too_many_params     = ECA::ECC<3>::value,
         err_bad_param           = ECA::ECC<4>::value,
         err_bad_sign            = ECA::ECC<5>::value,
+        err_read_only           = ECA::ECC<6>::value,
     };
 
     std::string sign;
@@ -58,6 +60,7 @@ public:
         fillReply(err_bad_request, "bad request");
         fillReply(err_bad_sign, "bad sign");
         fillReply(err_bad_param, "bad param");
+        fillReply(err_read_only, "follower of a leader is read-only");
     }
 
     virtual ~BaseHandler() {}
@@ -77,8 +80,17 @@ protected:
         return true;
     }
 
+    // handlers writing index are rejected by followers.
+    virtual bool writes() const
+    {
+        return false;
+    }
+
     virtual ec_t validate()
     {
+        if (writes() && Follower::instance()) {
+            return err_read_only;
+        }
         ec_t code = checkParams();
         return (code == err_ok) ? checkSign() : code;
     }
@@ -92,6 +104,36 @@ protected:
 
     virtual SharedResult deal() const = 0;
 
+    // false if prefixes is an array with anything but strings in it.
+    bool getKeys(KeyList& keys) const
+    {
+        keys.clear();
+        ParamMap::const_iterator it = params.find(config->keyMUPrefixes);
+        if (it != params.end()) {
+            Dom prefixes;
+            prefixes.Parse(it->second.c_str());
+            if (prefixes.IsArray()) {
+                for (Dom::ValueIterator i = prefixes.Begin(); i != prefixes.End(); ++i) {
+                    if (!i->IsString()) {
+                        keys.clear();
+                        return false;
+                    }
+                    keys.push_back(std::string(i->GetString(), i->GetStringLength()));
+                }
+            } else if (prefixes.IsString()) {
+                keys.push_back(std::string(prefixes.GetString(), prefixes.GetStringLength()));
+            }
+        }
+        return true;
+    }
+
+    // whether to reply after the operation is applied, by param 'ack' or @ingest-ack.
+    bool getAck() const
+    {
+        ParamMap::const_iterator it = params.find("ack");
+        return it == params.end() ? config->ingestAck : (!it->second.empty() && it->second[0] != '0');
+    }
+
     ec_t checkSign() const
     {
         if (!config->checkSign) {
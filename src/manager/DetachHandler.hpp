@@ -1,31 +1,92 @@
-
 #pragma once
 
 #include "BaseHandler.hpp"
+#include "../Ingester.hpp"
 
 namespace taboo {
 namespace manager {
 
+// detaches an item from @prefixes, the item is removed once it's attached to none.
+// '/manage/erase', or no @prefixes, detaches it from all prefixes it's attached to.
 class DetachHandler:
     public BaseHandler,
-    public taboo::HandlerCreator<DetachHandler>
+    public taboo::HandlerCreator<DetachHandler>,
+    private ManagerECAlloctor<5>
 {
     friend class taboo::Router;
+    using ManagerECAlloctor<5>::ECA;
 protected:
     enum {
-        err_detach = 203001,
-        err_detach_keys = 203002,
-        err_detach_item = 203003,
+        err_create_item     = ECA::ECC<1>::value,
+        err_detach          = ECA::ECC<2>::value,
+        err_ingest_busy     = ECA::ECC<3>::value,
     };
+
+    static const std::string uriErase;
+
+    static const SharedReply okReply;
+
 public:
     virtual SharedResult deal() const
     {
-        SharedResult res(new Result(err_detach));
+        SharedResult res(new Result);
+        do {
+            ParamMap::const_iterator itItem = params.find(config->keyMUItem);
+            SharedItem item = taboo::makeItem(itItem->second.c_str());
+            if (!item) {
+                res->code = err_create_item;
+                break;
+            }
+
+            // only id of the item matters, the rest is not logged.
+            // bad prefixes are rejected, not taken as none, which would detach the item from all keys.
+            KeyList keys;
+            if (uri != uriErase && !getKeys(keys)) {
+                res->code = err_bad_param;
+                break;
+            }
+            Ingester::Result result = Ingester::ingest(
+                Mutation(WalRecord::op_detach, keys, taboo::makeItem(item->id)), getAck());
+            if (result == Ingester::result_busy) {
+                res->code = err_ingest_busy;
+                break;
+            } else if (result == Ingester::result_unchanged) {
+                res->code = err_detach;
+                break;
+            }
+            res->code = err_ok;
+            res->reply = okReply;
+
+        } while (false);
         return res;
     }
 
+    virtual Latency::Metric metric() const
+    {
+        return uri == uriErase ? Latency::metric_manage_erase : Latency::metric_manage_detach;
+    }
+
+    virtual bool writes() const
+    {
+        return true;
+    }
+
+    virtual ec_t checkParams() const
+    {
+        return (!(config->checkSign && sign.empty())
+           && params.find(config->keyMUKey) != params.end()
+           && params.find(config->keyMUItem) != params.end()) ?
+               err_ok : err_bad_param;
+    }
+
 protected:
-    static void initReplys() {}
+    static void initReplys()
+    {
+        const_cast<SharedReply&>(okReply) = genReply(err_ok, "", mem_mode_persist);
+        fillReply(err_create_item, "failed on creating item");
+        fillReply(err_detach, "item does not exist or is not attached to any of the prefixes");
+        fillReply(err_ingest_busy, "too many pending manage operations, retry later");
+    }
 };
 
 }
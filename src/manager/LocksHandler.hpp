@@ -0,0 +1,41 @@
+#pragma once
+
+#include "BaseHandler.hpp"
+#include "../Lock.hpp"
+
+namespace taboo {
+namespace manager {
+
+// switches lock profiling on or off, and/or clears what it has recorded.
+class LocksHandler:
+    public BaseHandler, public taboo::HandlerCreator<LocksHandler>
+{
+    friend class taboo::Router;
+protected:
+    static const SharedReply okReply;
+
+protected:
+    virtual SharedResult deal() const
+    {
+        ParamMap::const_iterator it = params.find("enable");
+        if (it != params.end() && !it->second.empty()) {
+            LockProfile::enable(it->second[0] != '0');
+        }
+        it = params.find("reset");
+        if (it != params.end() && !it->second.empty() && it->second[0] != '0') {
+            LockProfile::reset();
+        }
+        SharedResult res(new Result(err_ok));
+        res->reply = okReply;
+        return res;
+    }
+
+protected:
+    static void initReplys()
+    {
+        const_cast<SharedReply&>(okReply) = genReply(err_ok, "", mem_mode_persist);
+    }
+};
+
+}
+}
@@ -0,0 +1,183 @@
+#pragma once
+
+#include "../predef.hpp"
+#include <sstream>
+#include <ctime>
+#include "BaseHandler.hpp"
+#include "../Expiry.hpp"
+#include "../Session.hpp"
+#include "../Latency.hpp"
+#include "../Counters.hpp"
+#include "../SlowLog.hpp"
+#include "../Footprint.hpp"
+#include "../QueryCapture.hpp"
+
+namespace taboo {
+namespace manager {
+
+// the same numbers as StatusHandler, in Prometheus text exposition format, so that they can be scraped.
+// latency histograms are reported with fixed bucket bounds, folded from the finer ones kept in memory.
+class MetricsHandler:
+    public BaseHandler, public taboo::HandlerCreator<MetricsHandler>
+{
+    friend class taboo::Router;
+protected:
+    static const char* const contentType;
+
+public:
+    virtual SharedResult deal() const
+    {
+        std::ostringstream out;
+        out.precision(9);
+        writeQueries(out);
+        writeManage(out);
+        writeIndex(out);
+        writeConnections(out);
+        writeLatency(out);
+
+        SharedResult res(new Result(err_ok));
+        res->reply.reset(new Reply(out.str(), mem_mode_must_copy));
+        res->reply->contentType = contentType;
+        return res;
+    }
+
+    virtual Latency::Metric metric() const
+    {
+        return Latency::metric_manage_metrics;
+    }
+
+protected:
+    void writeQueries(std::ostream& out) const
+    {
+        counter(out, "taboo_queries_total", "Queries answered.",
+            Counters::sum(Counters::counter_queries));
+        counter(out, "taboo_query_cache_hits_total", "Queries answered by result cache.",
+            Counters::sum(Counters::counter_cache_hits));
+        counter(out, "taboo_query_empty_results_total", "Queries seeking index that matched nothing.",
+            Counters::sum(Counters::counter_empty_results));
+        counter(out, "taboo_query_reply_bytes_total", "Bytes of query replies.",
+            Counters::sum(Counters::counter_reply_bytes));
+
+        SlowLog* slowLog = SlowLog::instance();
+        if (slowLog) {
+            header(out, "taboo_slow_queries_total", "Slow queries, logged or dropped by rate limit.", "counter");
+            out << "taboo_slow_queries_total{state=\"logged\"} " << slowLog->numLogged() << '\n'
+                << "taboo_slow_queries_total{state=\"dropped\"} " << slowLog->numDropped() << '\n';
+        }
+
+        QueryCapture* capture = QueryCapture::instance();
+        if (capture) {
+            header(out, "taboo_captured_queries_total", "Sampled queries, captured or dropped on full queue.",
+                "counter");
+            out << "taboo_captured_queries_total{state=\"captured\"} " << capture->numCaptured() << '\n'
+                << "taboo_captured_queries_total{state=\"dropped\"} " << capture->numDropped() << '\n';
+        }
+    }
+
+    void writeManage(std::ostream& out) const
+    {
+        header(out, "taboo_manage_ops_total", "Manage operations applied to index.", "counter");
+        out << "taboo_manage_ops_total{op=\"attach\"} " << Counters::sum(Counters::counter_attach) << '\n'
+            << "taboo_manage_ops_total{op=\"update_item\"} " << Counters::sum(Counters::counter_update_item) << '\n'
+            << "taboo_manage_ops_total{op=\"detach\"} " << Counters::sum(Counters::counter_detach) << '\n'
+            << "taboo_manage_ops_total{op=\"patch\"} " << Counters::sum(Counters::counter_patch) << '\n';
+
+        header(out, "taboo_lock_wait_seconds_total", "Time waited for shard and session locks.", "counter");
+        out << "taboo_lock_wait_seconds_total{mode=\"read\"} "
+            << seconds(Counters::sum(Counters::counter_read_lock_wait)) << '\n'
+            << "taboo_lock_wait_seconds_total{mode=\"write\"} "
+            << seconds(Counters::sum(Counters::counter_write_lock_wait)) << '\n';
+
+        Expiry* expiry = Expiry::instance();
+        if (expiry) {
+            gauge(out, "taboo_expiry_scheduled", "Items scheduled to expire.", expiry->pending());
+            counter(out, "taboo_expired_total", "Items removed on expiry.", expiry->expired());
+        }
+    }
+
+    void writeIndex(std::ostream& out) const
+    {
+        const ShardList& shards = Aside::instance()->shards;
+        const ShardTotals totals = ShardTotals::read(shards);
+        const std::size_t nodeSize = shards.front()->trie.nodeSize();
+        gauge(out, "taboo_items", "Items in index.", totals.items);
+        gauge(out, "taboo_funnels", "Funnels in index.", totals.funnels);
+        gauge(out, "taboo_postings", "Items attached to funnels, counted once per funnel.", totals.postings);
+        gauge(out, "taboo_trie_keys", "Prefixes in tries.", totals.keys);
+        gauge(out, "taboo_trie_bytes", "Bytes of trie nodes in use.", totals.trieNodes * nodeSize);
+        gauge(out, "taboo_trie_capacity_bytes", "Bytes of trie nodes allocated.", totals.trieCapacity * nodeSize);
+
+        Footprint footprint = Footprint::read(shards);
+        header(out, "taboo_index_bytes", "Bytes of index per structure.", "gauge");
+        for (int i = 0; i < Footprint::part_num; ++i) {
+            out << "taboo_index_bytes{part=\"" << Footprint::nameOf(static_cast<Footprint::Part>(i)) << "\"} "
+                << footprint.bytes[i] << '\n';
+        }
+    }
+
+    void writeConnections(std::ostream& out) const
+    {
+        gauge(out, "taboo_uptime_seconds", "Seconds since started.",
+            std::time(NULL) - Aside::instance()->startTime);
+        gauge(out, "taboo_sessions", "Sessions of access tokens alive.", SessionManager::instance()->size());
+        header(out, "taboo_connections", "Connections open.", "gauge");
+        out << "taboo_connections{kind=\"http\"} " << Counters::opened(Counters::connection_http) << '\n'
+            << "taboo_connections{kind=\"ws\"} " << Counters::opened(Counters::connection_ws) << '\n';
+    }
+
+    void writeLatency(std::ostream& out) const
+    {
+        if (!Latency::isEnabled()) {
+            return;
+        }
+        static const double bounds[] = {    // in microseconds
+            1, 5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000,
+            250000, 500000, 1000000, 2500000, 10000000,
+        };
+        header(out, "taboo_latency_seconds", "Latency of query stages and manage endpoints.", "histogram");
+        for (int i = 0; i < Latency::metric_num; ++i) {
+            Latency::Metric metric = static_cast<Latency::Metric>(i);
+            Histogram histogram;
+            Latency::merge(metric, histogram);
+            const char* name = Latency::nameOf(metric);
+            for (std::size_t j = 0; j < sizeof(bounds) / sizeof(bounds[0]); ++j) {
+                out << "taboo_latency_seconds_bucket{metric=\"" << name << "\",le=\"" << bounds[j] / 1000000
+                    << "\"} " << histogram.countUpTo(Latency::fromMicros(bounds[j])) << '\n';
+            }
+            uint64_t total = histogram.total();
+            out << "taboo_latency_seconds_bucket{metric=\"" << name << "\",le=\"+Inf\"} " << total << '\n'
+                << "taboo_latency_seconds_sum{metric=\"" << name << "\"} " << seconds(histogram.sum) << '\n'
+                << "taboo_latency_seconds_count{metric=\"" << name << "\"} " << total << '\n';
+        }
+    }
+
+    static void header(std::ostream& out, const char* name, const char* help, const char* type)
+    {
+        out << "# HELP " << name << ' ' << help << '\n'
+            << "# TYPE " << name << ' ' << type << '\n';
+    }
+
+    template <typename Number>
+    static void counter(std::ostream& out, const char* name, const char* help, Number value)
+    {
+        header(out, name, help, "counter");
+        out << name << ' ' << value << '\n';
+    }
+
+    template <typename Number>
+    static void gauge(std::ostream& out, const char* name, const char* help, Number value)
+    {
+        header(out, name, help, "gauge");
+        out << name << ' ' << value << '\n';
+    }
+
+    static double seconds(uint64_t ticks)
+    {
+        return Latency::toMicros(ticks) / 1000000;
+    }
+
+    static void initReplys() {}
+};
+
+}
+}
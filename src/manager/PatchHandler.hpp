@@ -0,0 +1,152 @@
+#pragma once
+
+#include <boost/lexical_cast.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include "BaseHandler.hpp"
+#include "../Ingester.hpp"
+
+namespace taboo {
+namespace manager {
+
+// updates fields of items by JSON merge patches, without touching their prefixes:
+// @item is a patch naming the item by its id (a null field removes it),
+// or an array of such patches, queued together and replied once all are applied.
+class PatchHandler:
+    public BaseHandler,
+    public taboo::HandlerCreator<PatchHandler>,
+    private ManagerECAlloctor<6>
+{
+    friend class taboo::Router;
+    using ManagerECAlloctor<6>::ECA;
+protected:
+    enum {
+        err_bad_patch       = ECA::ECC<1>::value,
+        err_no_item         = ECA::ECC<2>::value,
+        err_ingest_busy     = ECA::ECC<3>::value,
+    };
+
+    static const SharedReply okReply;
+
+public:
+    virtual SharedResult deal() const
+    {
+        SharedResult res(new Result);
+        do {
+            ParamMap::const_iterator itItem = params.find(config->keyMUItem);
+            Dom dom;
+            dom.Parse(itItem->second.c_str());
+            if (dom.HasParseError() || !(dom.IsObject() || dom.IsArray())) {
+                res->code = err_bad_patch;
+                break;
+            }
+
+            if (dom.IsObject()) {
+                SharedItem patch = makePatch(dom);
+                if (!patch) {
+                    res->code = err_bad_patch;
+                    break;
+                }
+                Ingester::Result result = Ingester::ingest(
+                    Mutation(WalRecord::op_patch, KeyList(), patch), getAck());
+                if (result == Ingester::result_busy) {
+                    res->code = err_ingest_busy;
+                    break;
+                } else if (result == Ingester::result_unchanged) {
+                    res->code = err_no_item;
+                    break;
+                }
+                res->code = err_ok;
+                res->reply = okReply;
+                break;
+            }
+
+            // queued as single patches are, so that writers of the shards batch them and a full queue
+            // pushes back; an array is always waited for, its reply counts what's patched.
+            // on busy some patches may be applied already, the array can be retried as patches are idempotent.
+            boost::ptr_vector<Mutation> mutations;
+            MutationList batch;
+            for (Dom::ValueIterator it = dom.Begin(); it != dom.End(); ++it) {
+                SharedItem patch = makePatch(*it);
+                if (!patch) {
+                    break;
+                }
+                mutations.push_back(new Mutation(WalRecord::op_patch, KeyList(), patch));
+                batch.push_back(&mutations.back());
+            }
+            if (batch.size() != dom.Size()) {
+                res->code = err_bad_patch;
+                break;
+            }
+            if (Ingester::ingest(batch) == Ingester::result_busy) {
+                res->code = err_ingest_busy;
+                break;
+            }
+            std::size_t patched = 0;
+            for (MutationList::const_iterator it = batch.begin(); it != batch.end(); ++it) {
+                patched += (*it)->result;
+            }
+            res->code = err_ok;
+            res->reply = genPatchedReply(patched);
+        } while (false);
+        return res;
+    }
+
+    virtual Latency::Metric metric() const
+    {
+        return Latency::metric_manage_patch;
+    }
+
+    virtual bool writes() const
+    {
+        return true;
+    }
+
+    virtual ec_t checkParams() const
+    {
+        return (!(config->checkSign && sign.empty())
+           && params.find(config->keyMUKey) != params.end()
+           && params.find(config->keyMUItem) != params.end()) ?
+               err_ok : err_bad_param;
+    }
+
+protected:
+    static SharedItem makePatch(const Value& value)
+    {
+        SharedItem res;
+        if (value.IsObject()) {
+            Value::ConstMemberIterator it = value.FindMember(Aside::instance()->keyId);
+            if (it != value.MemberEnd() && it->value.IsUint()) {
+                res.reset(new Item(it->value.GetUint()));
+                res->dom.CopyFrom(value, res->dom.GetAllocator());
+            }
+        }
+        return res;
+    }
+
+    SharedReply genPatchedReply(std::size_t patched) const
+    {
+        SharedReply reply(new Reply(mem_mode_must_copy));
+        std::string& content = reply->content;
+        content += "{\"";
+        content += config->keyMDErrCode;
+        content += "\":";
+        content += boost::lexical_cast<std::string>(err_ok);
+        content += ",\"";
+        content += config->keyMDPayload;
+        content += "\":{\"patched\":";
+        content += boost::lexical_cast<std::string>(patched);
+        content += "}}";
+        return reply;
+    }
+
+    static void initReplys()
+    {
+        const_cast<SharedReply&>(okReply) = genReply(err_ok, "", mem_mode_persist);
+        fillReply(err_bad_patch, "patch must be an object with id of the item, or an array of them");
+        fillReply(err_no_item, "item does not exist");
+        fillReply(err_ingest_busy, "too many pending manage operations, retry later");
+    }
+};
+
+}
+}
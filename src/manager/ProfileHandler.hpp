@@ -0,0 +1,82 @@
+#pragma once
+
+#include <boost/lexical_cast.hpp>
+#include "BaseHandler.hpp"
+#include "../Profiler.hpp"
+
+namespace taboo {
+namespace manager {
+
+// profiles cpu of the whole process for some seconds, replies folded stacks for flame graphs:
+//   curl 'host:port/manage/profile?seconds=30' > taboo.folded && flamegraph.pl taboo.folded > taboo.svg
+// one worker of manage port is kept busy meanwhile.
+class ProfileHandler:
+    public BaseHandler,
+    public taboo::HandlerCreator<ProfileHandler>,
+    private ManagerECAlloctor<7>
+{
+    friend class taboo::Router;
+    using ManagerECAlloctor<7>::ECA;
+protected:
+    enum {
+        err_profile_running = ECA::ECC<1>::value,
+        err_profile_failed  = ECA::ECC<2>::value,
+    };
+
+    static const char* const contentType;
+
+protected:
+    virtual SharedResult deal() const
+    {
+        SharedResult res(new Result);
+        uint32_t seconds = 10, hz = Profiler::default_hz;
+        if (!getNum("seconds", seconds) || !getNum("hz", hz)
+            || seconds < 1 || seconds > Profiler::max_seconds || hz < 1 || hz > Profiler::max_hz) {
+            res->code = err_bad_param;
+            return res;
+        }
+        ParamMap::const_iterator it = params.find("threads");
+        bool byThread = it != params.end() && !it->second.empty() && it->second[0] != '0';
+
+        std::string folded;
+        switch (Profiler::profile(seconds, hz, byThread, folded)) {
+        case Profiler::status_ok:
+            res->code = err_ok;
+            res->reply.reset(new Reply(folded, mem_mode_must_copy));
+            res->reply->contentType = contentType;
+            break;
+        case Profiler::status_running:
+            res->code = err_profile_running;
+            break;
+        default:
+            res->code = err_profile_failed;
+            break;
+        }
+        return res;
+    }
+
+    // false if param @name is there but not a number.
+    bool getNum(const std::string& name, uint32_t& num) const
+    {
+        ParamMap::const_iterator it = params.find(name);
+        if (it == params.end()) {
+            return true;
+        }
+        try {
+            num = boost::lexical_cast<uint32_t>(it->second);
+        } catch (const boost::bad_lexical_cast&) {
+            return false;
+        }
+        return true;
+    }
+
+protected:
+    static void initReplys()
+    {
+        fillReply(err_profile_running, "another profile is in progress");
+        fillReply(err_profile_failed, "failed on starting profiler");
+    }
+};
+
+}
+}
@@ -1,23 +1,338 @@
-
 #pragma once
 
+#include "../predef.hpp"
+#include <cstring>
+#include "rapidjson/writer.h"
+#include "rapidjson/stringbuffer.h"
 #include "BaseHandler.hpp"
+#include "../Memory.hpp"
+#include "../Footprint.hpp"
+#include "../Replication.hpp"
+#include "../Expiry.hpp"
+#include "../Session.hpp"
+#include "../Latency.hpp"
+#include "../SlowLog.hpp"
+#include "../QueryCapture.hpp"
+#include "../Lock.hpp"
 
 namespace taboo {
 namespace manager {
 
+// reports counters kept up to date by writers, nothing is scanned or locked,
+// so that it can be polled frequently.
 class StatusHandler:
     public BaseHandler, public taboo::HandlerCreator<StatusHandler>
 {
     friend class taboo::Router;
+protected:
+    typedef rapidjson::Writer<rapidjson::StringBuffer> JsonWriter;
+
 public:
     virtual SharedResult deal() const
     {
-        SharedResult res;
+        rapidjson::StringBuffer buffer;
+        JsonWriter writer(buffer);
+        writer.StartObject();
+
+        key(writer, config->keyMDErrCode);
+        writer.Uint(err_ok);
+
+        key(writer, config->keyMDPayload);
+        writer.StartObject();
+        key(writer, "uptime");
+        writer.Int64(std::time(NULL) - Aside::instance()->startTime);
+        key(writer, "sessions");
+        writer.Uint64(SessionManager::instance()->size());
+        writeIndex(writer);
+        writeMemory(writer);
+        writeReplication(writer);
+        writeExpiry(writer);
+        writeSlowLog(writer);
+        writeCapture(writer);
+        writeLatency(writer);
+        writeLocks(writer);
+        writer.EndObject();
+
+        writer.EndObject();
+
+        SharedResult res(new Result(err_ok));
+        res->reply.reset(new Reply(std::string(buffer.GetString(), buffer.GetSize()), mem_mode_must_copy));
         return res;
     }
 
+    virtual Latency::Metric metric() const
+    {
+        return Latency::metric_manage_status;
+    }
+
 protected:
+    void writeIndex(JsonWriter& writer) const
+    {
+        const ShardList& shards = Aside::instance()->shards;
+        const ShardTotals totals = ShardTotals::read(shards);
+        const std::size_t nodeSize = shards.front()->trie.nodeSize();
+        key(writer, "index");
+        writer.StartObject();
+        key(writer, "shards");
+        writer.Uint64(shards.size());
+        key(writer, "items");
+        writer.Uint64(totals.items);
+        key(writer, "funnels");
+        writer.Uint64(totals.funnels);
+        key(writer, "postings");
+        writer.Uint64(totals.postings);
+        key(writer, "trie");
+        writer.StartObject();
+        key(writer, "keys");
+        writer.Uint64(totals.keys);
+        key(writer, "size");
+        writer.Uint64(totals.trieNodes);
+        key(writer, "capacity");
+        writer.Uint64(totals.trieCapacity);
+        key(writer, "totalBytes");
+        writer.Uint64(totals.trieNodes * nodeSize);
+        key(writer, "capacityBytes");
+        writer.Uint64(totals.trieCapacity * nodeSize);
+        writer.EndObject();
+        writer.EndObject();
+    }
+
+    void writeMemory(JsonWriter& writer) const
+    {
+        HugePages::Stat stat = HugePages::stat();
+        MallocStat mallocStat = MallocStat::read();
+        key(writer, "memory");
+        writer.StartObject();
+        if (mallocStat.available) {
+            key(writer, "jemalloc");
+            writer.StartObject();
+            key(writer, "allocated");
+            writer.Uint64(mallocStat.allocated);
+            key(writer, "active");
+            writer.Uint64(mallocStat.active);
+            key(writer, "resident");
+            writer.Uint64(mallocStat.resident);
+            key(writer, "mapped");
+            writer.Uint64(mallocStat.mapped);
+            writer.EndObject();
+        }
+        key(writer, "hugePages");
+        writer.StartObject();
+        key(writer, "enabled");
+        writer.Bool(HugePages::isEnabled());
+        key(writer, "hugetlbBytes");
+        writer.Uint64(stat.hugetlbBytes);
+        key(writer, "transparentBytes");
+        writer.Uint64(stat.transparentBytes);
+        key(writer, "heapBytes");
+        writer.Uint64(stat.heapBytes);
+        key(writer, "lockedBytes");
+        writer.Uint64(stat.lockedBytes);
+        key(writer, "hugetlbFailures");
+        writer.Uint64(stat.hugetlbFailures);
+        key(writer, "lockFailures");
+        writer.Uint64(stat.lockFailures);
+        writer.EndObject();
+        writeFootprint(writer);
+        writer.EndObject();
+    }
+
+    // bytes of index per structure, and per item.
+    void writeFootprint(JsonWriter& writer) const
+    {
+        Footprint footprint = Footprint::read(Aside::instance()->shards);
+        key(writer, "index");
+        writer.StartObject();
+        key(writer, "bytes");
+        writer.Uint64(footprint.total());
+        key(writer, "bytesPerItem");
+        writer.Double(footprint.items ? static_cast<double>(footprint.total()) / footprint.items : 0);
+        key(writer, "parts");
+        writer.StartObject();
+        for (int i = 0; i < Footprint::part_num; ++i) {
+            key(writer, Footprint::nameOf(static_cast<Footprint::Part>(i)));
+            writer.Uint64(footprint.bytes[i]);
+        }
+        writer.EndObject();
+        writer.EndObject();
+    }
+
+    void writeReplication(JsonWriter& writer) const
+    {
+        const Follower* follower = Follower::instance();
+        const Shipper* shipper = Shipper::instance();
+        if (follower == NULL && shipper == NULL) {
+            return;
+        }
+        key(writer, "replication");
+        writer.StartObject();
+        if (follower) {
+            lsn_t applied = follower->appliedLsn(), last = follower->leaderLastLsn();
+            key(writer, "leader");
+            key(writer, follower->address());
+            key(writer, "connected");
+            writer.Bool(follower->isConnected());
+            key(writer, "appliedLsn");
+            writer.Uint64(applied);
+            key(writer, "leaderLsn");
+            writer.Uint64(last);
+            key(writer, "lagRecords");
+            writer.Uint64(applied < last ? last - applied : 0);
+            key(writer, "lagMillis");
+            writer.Int64(follower->lagMillis());
+        }
+        if (shipper) {
+            lsn_t last = Wal::instance()->last();
+            Shipper::PeerList peers = shipper->followers();
+            key(writer, "lsn");
+            writer.Uint64(last);
+            key(writer, "followers");
+            writer.StartArray();
+            for (Shipper::PeerList::const_iterator it = peers.begin(); it != peers.end(); ++it) {
+                writer.StartObject();
+                key(writer, "address");
+                key(writer, it->first);
+                key(writer, "ackedLsn");
+                writer.Uint64(it->second);
+                key(writer, "lagRecords");
+                writer.Uint64(it->second < last ? last - it->second : 0);
+                writer.EndObject();
+            }
+            writer.EndArray();
+        }
+        writer.EndObject();
+    }
+
+    void writeExpiry(JsonWriter& writer) const
+    {
+        Expiry* expiry = Expiry::instance();
+        if (expiry == NULL) {
+            return;
+        }
+        key(writer, "expiry");
+        writer.StartObject();
+        key(writer, "scheduled");
+        writer.Uint64(expiry->pending());
+        key(writer, "expired");
+        writer.Uint64(expiry->expired());
+        writer.EndObject();
+    }
+
+    void writeSlowLog(JsonWriter& writer) const
+    {
+        SlowLog* slowLog = SlowLog::instance();
+        if (slowLog == NULL) {
+            return;
+        }
+        key(writer, "slowQueries");
+        writer.StartObject();
+        key(writer, "logged");
+        writer.Uint64(slowLog->numLogged());
+        key(writer, "dropped");
+        writer.Uint64(slowLog->numDropped());
+        writer.EndObject();
+    }
+
+    void writeCapture(JsonWriter& writer) const
+    {
+        QueryCapture* capture = QueryCapture::instance();
+        if (capture == NULL) {
+            return;
+        }
+        key(writer, "capturedQueries");
+        writer.StartObject();
+        key(writer, "captured");
+        writer.Uint64(capture->numCaptured());
+        key(writer, "dropped");
+        writer.Uint64(capture->numDropped());
+        writer.EndObject();
+    }
+
+    // percentiles in microseconds.
+    void writeLatency(JsonWriter& writer) const
+    {
+        if (!Latency::isEnabled()) {
+            return;
+        }
+        key(writer, "latency");
+        writer.StartObject();
+        for (int i = 0; i < Latency::metric_num; ++i) {
+            Latency::Metric metric = static_cast<Latency::Metric>(i);
+            Histogram histogram;
+            Latency::merge(metric, histogram);
+            key(writer, Latency::nameOf(metric));
+            writer.StartObject();
+            key(writer, "count");
+            writer.Uint64(histogram.total());
+            key(writer, "p50");
+            writer.Double(Latency::toMicros(histogram.quantile(0.5)));
+            key(writer, "p90");
+            writer.Double(Latency::toMicros(histogram.quantile(0.9)));
+            key(writer, "p99");
+            writer.Double(Latency::toMicros(histogram.quantile(0.99)));
+            key(writer, "p999");
+            writer.Double(Latency::toMicros(histogram.quantile(0.999)));
+            writer.EndObject();
+        }
+        writer.EndObject();
+    }
+
+    // grouped by lock, then call site; times in microseconds.
+    void writeLocks(JsonWriter& writer) const
+    {
+        if (!LockProfile::isEnabled()) {
+            return;
+        }
+        key(writer, "locks");
+        writer.StartObject();
+        const char* lock = NULL;
+        for (int i = 0; i < LockProfile::site_num; ++i) {
+            LockProfile::Site site = static_cast<LockProfile::Site>(i);
+            Histogram waits, holds;
+            LockProfile::merge(site, waits, holds);
+            if (lock == NULL || std::strcmp(lock, LockProfile::lockOf(site)) != 0) {
+                if (lock) {
+                    writer.EndObject();
+                }
+                lock = LockProfile::lockOf(site);
+                key(writer, lock);
+                writer.StartObject();
+            }
+            key(writer, LockProfile::nameOf(site));
+            writer.StartObject();
+            key(writer, "count");
+            writer.Uint64(waits.total());
+            key(writer, "wait");
+            writeTimes(writer, waits);
+            key(writer, "hold");
+            writeTimes(writer, holds);
+            writer.EndObject();
+        }
+        if (lock) {
+            writer.EndObject();
+        }
+        writer.EndObject();
+    }
+
+    static void writeTimes(JsonWriter& writer, const Histogram& histogram)
+    {
+        writer.StartObject();
+        key(writer, "total");
+        writer.Double(Latency::toMicros(histogram.sum));
+        key(writer, "p50");
+        writer.Double(Latency::toMicros(histogram.quantile(0.5)));
+        key(writer, "p99");
+        writer.Double(Latency::toMicros(histogram.quantile(0.99)));
+        key(writer, "p999");
+        writer.Double(Latency::toMicros(histogram.quantile(0.999)));
+        writer.EndObject();
+    }
+
+    static void key(JsonWriter& writer, const std::string& name)
+    {
+        writer.String(name.data(), name.length());
+    }
+
     static void initReplys() {}
 };
 
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "BaseHandler.hpp"
+#include "../Snapshot.hpp"
+
+namespace taboo {
+namespace manager {
+
+// starts a background snapshot, replies as soon as it's started.
+class StoreHandler:
+    public BaseHandler,
+    public taboo::HandlerCreator<StoreHandler>,
+    private ManagerECAlloctor<4>
+{
+    friend class taboo::Router;
+    using ManagerECAlloctor<4>::ECA;
+protected:
+    enum {
+        err_store_running   = ECA::ECC<1>::value,
+        err_store_failed    = ECA::ECC<2>::value,
+    };
+
+    static const SharedReply okReply;
+
+protected:
+    virtual SharedResult deal() const
+    {
+        SharedResult res(new Result);
+        ParamMap::const_iterator it = params.find("force");
+        bool force = it != params.end() && !it->second.empty() && it->second[0] != '0';
+        switch (Snapshot::instance()->store(force)) {
+        case Snapshot::status_started:
+        case Snapshot::status_unchanged:
+            res->code = err_ok;
+            res->reply = okReply;
+            break;
+        case Snapshot::status_running:
+            res->code = err_store_running;
+            break;
+        default:
+            res->code = err_store_failed;
+            break;
+        }
+        return res;
+    }
+
+    virtual Latency::Metric metric() const
+    {
+        return Latency::metric_manage_store;
+    }
+
+protected:
+    static void initReplys()
+    {
+        const_cast<SharedReply&>(okReply) = genReply(err_ok, "", mem_mode_persist);
+        fillReply(err_store_running, "another snapshot is in progress");
+        fillReply(err_store_failed, "failed on starting snapshot");
+    }
+};
+
+}
+}
@@ -45,6 +45,11 @@ protected:
         return res;
     }
 
+    virtual Latency::Metric metric() const
+    {
+        return Latency::metric_manage_token;
+    }
+
     virtual bool _reviewParam(const std::string& key, const std::string& value)
     {
         if (key == config->keyMUFilters) {
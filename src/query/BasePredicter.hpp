@@ -2,11 +2,19 @@
 #pragma once
 
 #include "../predef.hpp"
+#include <vector>
+#include <algorithm>
+#include <boost/ptr_container/ptr_vector.hpp>
 #include "rapidjson/writer.h"
 #include "rapidjson/stringbuffer.h"
 #include "../BaseHandler.hpp"
 #include "../Query.hpp"
 #include "../Seeker.hpp"
+#include "../ResultCache.hpp"
+#include "../Cluster.hpp"
+#include "../Counters.hpp"
+#include "../SlowLog.hpp"
+#include "../QueryCapture.hpp"
 
 namespace taboo {
 
@@ -33,10 +41,12 @@ protected:
         err_bad_param               = ECA::ECC<4>::value,
         err_no_query                = ECA::ECC<5>::value,
         err_bad_query               = ECA::ECC<6>::value,
+        err_no_backend              = ECA::ECC<7>::value,
     };
 
     static const SharedReply errNoQueryReply;
     static const SharedReply errBadQueryReply;
+    static const SharedReply errNoBackendReply;
 
     const std::string emptyResult;
 
@@ -44,22 +54,103 @@ protected:
 
     mutable Query query;
 
+    mutable QueryWork work;
+
+    mutable bool cacheHit;
+
 public:
-    BasePredicter() {}
+    BasePredicter():
+        cacheHit(false)
+    {}
 
-    std::string predict() const
+    // @data is the query already rebuilt, forwarded as is in cluster mode.
+    std::string predict(const std::string& data) const
     {
-        const SharedItemList& items = seeker.seek(query);
-        return formReply(items, err_ok);
+        uint64_t start = Latency::now();
+        work.reset();
+        cacheHit = false;
+        Counters::add(Counters::counter_queries);
+        std::string reply = _predict(data);
+        Counters::add(Counters::counter_reply_bytes, reply.length());
+        SlowLog* slowLog = SlowLog::instance();
+        QueryCapture* capture = QueryCapture::instance();
+        if (slowLog || capture) {
+            const uint64_t ticks = Latency::now() - start;
+            work.bytes = reply.length();
+            if (slowLog) {
+                slowLog->check(query, ticks, work);
+            }
+            if (capture) {
+                capture->sample(query, ticks, work, cacheHit);
+            }
+        }
+        return reply;
+    }
+
+    virtual Latency::Metric metric() const
+    {
+        return Latency::metric_query;
     }
 
     virtual ~BasePredicter() {};
 
 protected:
+    std::string _predict(const std::string& data) const
+    {
+        if (Cluster::instance()) {
+            return gather(data);
+        }
+        ResultCache* const cache = ResultCache::instance();
+        if (cache == NULL) {
+            return formReply(seek(), err_ok);
+        }
+
+        // generation must be taken before seeking, so that a concurrent write
+        // can only make the stored reply look stale, never look fresh.
+        const std::string& key = query.fingerprint();
+        PrefixGenerations::gen_t gen = cache->generation(query.prefix);
+        std::string reply;
+        if (cache->fetch(key, gen, reply)) {
+            Counters::add(Counters::counter_cache_hits);
+            cacheHit = true;
+        } else {
+            const SharedItemList& items = seek();
+            reply = formReply(items, err_ok, false);
+            cache->store(key, gen, earliestDeadline(items), reply);
+        }
+        if (query.echoData) {
+            spliceEchoData(reply);
+        }
+        return reply;
+    }
+
+    const SharedItemList& seek() const
+    {
+        const SharedItemList& items = seeker.seek(query);
+        work = seeker.work();
+        if (items.empty()) {
+            Counters::add(Counters::counter_empty_results);
+        }
+        return items;
+    }
+
+    // a cached reply goes stale with the first of its items to expire, Seeker would hide it then.
+    static uint32_t earliestDeadline(const SharedItemList& items)
+    {
+        uint32_t res = 0;
+        for (SharedItemList::const_iterator it = items.begin(); it != items.end(); ++it) {
+            if ((*it)->deadline && (!res || (*it)->deadline < res)) {
+                res = (*it)->deadline;
+            }
+        }
+        return res;
+    }
+
     typedef rapidjson::Writer<rapidjson::StringBuffer> JsonWriter;
 
-    std::string formReply(const SharedItemList& items, ec_t errCode) const
+    std::string formReply(const SharedItemList& items, ec_t errCode, bool withEchoData = true) const
     {
+        Latency::Timer timer(Latency::metric_form_reply);
         const Aside* const aside = Aside::instance();
         // todo: provide pre-allocted buffer to rapidjson::StringBuffer.
         rapidjson::StringBuffer buffer(0, config->querySendBuffer);
@@ -73,8 +164,9 @@ protected:
         writer.StartArray();
         query.fieldsAll ? addItems(writer, items) : addItems(writer, items, query.fields);
         writer.EndArray();
+        work.items = items.size();
 
-        if (query.echoData) {
+        if (withEchoData && query.echoData) {
             aside->keyQEchoData.Accept(writer);
             query.echoData->Accept(writer);
         }
@@ -84,6 +176,167 @@ protected:
         return buffer.GetString();
     }
 
+    typedef std::vector<const Value*> ValueList;
+
+    // backends have filtered, projected and limited the items, they're merged the way Seeker
+    // merges shards. not cached: the router sees no writes to invalidate the cache.
+    std::string gather(const std::string& data) const
+    {
+        const Aside* const aside = Aside::instance();
+        // backends must reply what's merged by, even if the query projects it away.
+        const bool scoreAdded = aside->keyScore.GetStringLength() && !query.fieldsAll
+            && query.fields.find(&aside->keyScore) == query.fields.end();
+        Cluster::ReplyList replies;
+        Cluster::instance()->scatter(scoreAdded ? withScore(data) : data, replies);
+
+        boost::ptr_vector<Dom> doms;
+        std::vector<ValueList> parts;
+        for (Cluster::ReplyList::const_iterator it = replies.begin(); it != replies.end(); ++it) {
+            if (it->empty()) {
+                continue;
+            }
+            doms.push_back(new Dom);
+            Dom& dom = doms.back();
+            dom.Parse(it->c_str());
+            if (dom.HasParseError() || !dom.IsObject()) {
+                continue;
+            }
+            Dom::ConstMemberIterator code = dom.FindMember(aside->keyQDErrCode);
+            Dom::ConstMemberIterator payload = dom.FindMember(aside->keyQDPayload);
+            if (code == dom.MemberEnd() || !code->value.IsInt() || code->value.GetInt() != err_ok
+                || payload == dom.MemberEnd() || !payload->value.IsArray()) {
+                continue;
+            }
+            parts.push_back(ValueList());
+            for (Value::ConstValueIterator item = payload->value.Begin(); item != payload->value.End(); ++item) {
+                parts.back().push_back(&*item);
+            }
+        }
+        if (parts.empty()) {
+            return errNoBackendReply->content;
+        }
+        if (parts.size() < replies.size()) {
+            LOG_EVERY_N(WARNING, 100) << "only " << parts.size() << " of " << replies.size()
+                << " backends replied";
+        }
+
+        ValueList items;
+        merge(parts, items);
+
+        rapidjson::StringBuffer buffer(0, config->querySendBuffer);
+        JsonWriter writer(buffer);
+        writer.StartObject();
+        aside->keyQDErrCode.Accept(writer);
+        writer.Uint(err_ok);
+        aside->keyQDPayload.Accept(writer);
+        writer.StartArray();
+        for (ValueList::const_iterator it = items.begin(); it != items.end(); ++it) {
+            if (!scoreAdded || !(*it)->IsObject()) {
+                (*it)->Accept(writer);
+                continue;
+            }
+            writer.StartObject();
+            for (Value::ConstMemberIterator member = (*it)->MemberBegin(); member != (*it)->MemberEnd(); ++member) {
+                if (member->name != aside->keyScore) {
+                    member->name.Accept(writer);
+                    member->value.Accept(writer);
+                }
+            }
+            writer.EndObject();
+        }
+        writer.EndArray();
+        if (query.echoData) {
+            aside->keyQEchoData.Accept(writer);
+            query.echoData->Accept(writer);
+        }
+        writer.EndObject();
+        return buffer.GetString();
+    }
+
+    // @data with fields of query plus the score field.
+    std::string withScore(const std::string& data) const
+    {
+        const Aside* const aside = Aside::instance();
+        Dom dom;
+        dom.Parse(data.c_str());    // rebuilt from it already, it's good
+        Dom::AllocatorType& allocator = dom.GetAllocator();
+        Value fields(rapidjson::kArrayType);
+        for (ValuePtrSet::const_iterator it = query.fields.begin(); it != query.fields.end(); ++it) {
+            Value field((*it)->GetString(), (*it)->GetStringLength(), allocator);
+            fields.PushBack(field, allocator);
+        }
+        Value score(aside->keyScore.GetString(), aside->keyScore.GetStringLength(), allocator);
+        fields.PushBack(score, allocator);
+        Dom::MemberIterator it = dom.FindMember(aside->keyQUFields);
+        if (it != dom.MemberEnd()) {
+            it->value = fields;
+        } else {
+            Value name(aside->keyQUFields.GetString(), aside->keyQUFields.GetStringLength(), allocator);
+            dom.AddMember(name, fields, allocator);
+        }
+        rapidjson::StringBuffer buffer;
+        JsonWriter writer(buffer);
+        dom.Accept(writer);
+        return std::string(buffer.GetString(), buffer.GetSize());
+    }
+
+    void merge(const std::vector<ValueList>& parts, ValueList& items) const
+    {
+        const Value& keyScore = Aside::instance()->keyScore;
+        if (keyScore.GetStringLength()) {
+            for (std::vector<ValueList>::const_iterator it = parts.begin(); it != parts.end(); ++it) {
+                items.insert(items.end(), it->begin(), it->end());
+            }
+            std::size_t top = std::min(query.num, items.size());
+            std::partial_sort(items.begin(), items.begin() + top, items.end(), ScoreGreater(keyScore));
+            items.resize(top);
+            return;
+        }
+        for (std::size_t rank = 0; items.size() < query.num; ++rank) {
+            bool more = false;
+            for (std::size_t i = 0; i < parts.size() && items.size() < query.num; ++i) {
+                if (rank < parts[i].size()) {
+                    items.push_back(parts[i][rank]);
+                    more = true;
+                }
+            }
+            if (!more) {
+                break;
+            }
+        }
+    }
+
+    class ScoreGreater
+    {
+    private:
+        const Value& key;
+
+    public:
+        explicit ScoreGreater(const Value& _key):
+            key(_key)
+        {}
+
+        bool operator()(const Value* lhs, const Value* rhs) const
+        {
+            return scoreOf(*lhs, key) > scoreOf(*rhs, key);
+        }
+    };
+
+    // turns `{...}` into `{...,"echoData":...}`.
+    void spliceEchoData(std::string& reply) const
+    {
+        rapidjson::StringBuffer buffer;
+        JsonWriter writer(buffer);
+        writer.StartObject();
+        Aside::instance()->keyQEchoData.Accept(writer);
+        query.echoData->Accept(writer);
+        writer.EndObject();
+
+        reply.resize(reply.length() - 1);
+        reply += ',';
+        reply.append(buffer.GetString() + 1, buffer.GetSize() - 1);
+    }
+
     void addItems(JsonWriter& writer, const SharedItemList& items, const ValuePtrSet& fields) const
     {
         for (SharedItemList::const_iterator item = items.begin(); item != items.end(); ++item) {
@@ -113,6 +366,8 @@ protected:
             genReply(err_no_query, "no '" + Config::instance()->keyQUPayload + "' specified");
         const_cast<SharedReply&>(errBadQueryReply) =
             genReply(err_bad_query, "bad '" + Config::instance()->keyQUPayload + "' specified");
+        const_cast<SharedReply&>(errNoBackendReply) =
+            genReply(err_no_backend, "no backend replied");
     }
 };
 
@@ -31,7 +31,7 @@ public:
             CS_SAY("bad query");
             return errBadQueryReply;
         }
-        return SharedReply(new Reply(predict(), mem_mode_must_copy));
+        return SharedReply(new Reply(predict(it->second), mem_mode_must_copy));
     }
 
 protected:
@@ -38,7 +38,7 @@ public:
             CS_SAY("bad query");
             return errBadQueryReply;
         }
-        return SharedReply(new Reply(predict(), mem_mode_must_copy));
+        return SharedReply(new Reply(predict(message->get_payload()), mem_mode_must_copy));
     }
 
     void setMessage(Server::message_ptr _message)
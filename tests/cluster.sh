@@ -0,0 +1,49 @@
+#!/bin/bash
+
+# runs two backends and a router in front of them, all on localhost,
+# backend N owns items whose id is N modulo 2, then queries through the router.
+# usage: cluster.sh [path of taboo]
+
+bin=${1:-./taboo}
+conf=$(dirname "$0")/../etc/taboo.conf
+dir=$(mktemp -d /tmp/taboo-cluster.XXXXXX)
+host=127.0.0.1
+declare -a pids
+
+# name manage-port query-port [extra config line]
+start() {
+	mkdir -p "${dir}/$1"
+	sed -e "s|^manage-port.*|manage-port = $2|" -e "s|^query-port.*|query-port = $3|" \
+		-e "s|^pid-file.*|pid-file = ${dir}/$1.pid|" -e "s|/var/lib/taboo|${dir}/$1|" \
+		"${conf}" > "${dir}/$1.conf"
+	echo "$4" >> "${dir}/$1.conf"
+	"${bin}" -c "${dir}/$1.conf" > "${dir}/$1.log" 2>&1 &
+	pids+=($!)
+}
+
+start backend0 2079 2080
+start backend1 3079 3080
+start router 1079 1080 "cluster-backends = ${host}:2079, ${host}:3079"
+trap 'kill ${pids[@]} 2>/dev/null' EXIT
+sleep 1
+
+attach() {
+	port=$(( $1 % 2 == 0 ? 2079 : 3079 ))
+	curl -sg "http://${host}:${port}/manage/attach?key=username&sign=signature&prefixes=$2&item={\"id\":$1,\"name\":\"$3\",\"we_account_id\":$4}"
+	echo
+}
+
+attach 10086 '["hejinyu","hjy"]' hejinyu 100100209
+attach 10087 '["hejinyu","hjy"]' hejinyu2 100100209
+attach 10088 '["hejinyu","hjy"]' hejinyu3 200100209
+attach 10089 '["hejiangyou","hjy"]' hejiangyou 100100209
+attach 10090 '["dajiangyou","djy"]' dajiangyou 100100209
+
+for query in '{"prefix":"heji","num":5}' '{"prefix":"hjy","num":2}' \
+	'{"prefix":"hjy","num":5,"filters":{"we_account_id":100100209}}'; do
+	echo "${query}"
+	curl -sg "http://${host}:1079/query/predict?data=${query}"
+	echo
+done
+
+echo "logs are in ${dir}"
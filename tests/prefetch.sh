@@ -0,0 +1,27 @@
+#!/bin/bash
+
+# cache misses per query of a running taboo.
+# to compare, run it once against taboo started with `--trie-prefetch-batch 1`
+# (prefetching disabled) and once with the default, on the same data set.
+# start taboo with `--query-cache-entries 0`, or replies come from query cache.
+# usage: prefetch.sh [queries] [prefix]
+
+host=127.0.0.1
+queries=${1:-100000}
+prefix=${2:-hjy}
+url='http://'${host}':1079/query/predict?data={"prefix":"'${prefix}'","num":50}'
+outfile=/dev/shm/taboo.perf.csv
+
+pid=$(pidof taboo)
+if [ -z "${pid}" ]; then
+	echo "taboo is not running"
+	exit 1
+fi
+
+perf stat -x, -e cache-references,cache-misses,LLC-load-misses -p ${pid} -o "${outfile}" \
+	-- ab -q -c 10 -n ${queries} "${url}" > /dev/null
+
+awk -F, -v queries=${queries} '
+	$3 ~ /cache|LLC/ && $1 ~ /^[0-9]+$/ {
+		printf("%-20s %14d %12.2f/query\n", $3, $1, $1 / queries)
+	}' "${outfile}"
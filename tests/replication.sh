@@ -0,0 +1,44 @@
+#!/bin/bash
+
+# runs a leader and a follower of it on localhost, attaches items to the leader,
+# then queries the follower and shows replication status of both.
+# usage: replication.sh [path of taboo]
+
+bin=${1:-./taboo}
+conf=$(dirname "$0")/../etc/taboo.conf
+dir=$(mktemp -d /tmp/taboo-replication.XXXXXX)
+host=127.0.0.1
+declare -a pids
+
+# name manage-port query-port [extra config lines]
+start() {
+	mkdir -p "${dir}/$1"
+	sed -e "s|^manage-port.*|manage-port = $2|" -e "s|^query-port.*|query-port = $3|" \
+		-e "s|^pid-file.*|pid-file = ${dir}/$1.pid|" -e "s|/var/lib/taboo|${dir}/$1|" \
+		-e "s|^replication-port.*||" "${conf}" > "${dir}/$1.conf"
+	echo -e "$4" >> "${dir}/$1.conf"
+	"${bin}" -c "${dir}/$1.conf" > "${dir}/$1.log" 2>&1 &
+	pids+=($!)
+}
+
+start leader 2079 2080 "replication-port = 2078"
+sleep 1
+start follower 3079 3080 "replicate-from = ${host}:2078"
+trap 'kill ${pids[@]} 2>/dev/null' EXIT
+sleep 1
+
+curl -sg "http://${host}:2079/manage/attach?key=username&sign=signature&prefixes=[\"hejinyu\",\"hjy\"]&item={\"id\":10086,\"name\":\"hejinyu\"}"
+echo
+echo 'attach on follower is rejected:'
+curl -sg "http://${host}:3079/manage/attach?key=username&sign=signature&prefixes=[\"hejinyu\",\"hjy\"]&item={\"id\":10087,\"name\":\"hejinyu\"}"
+echo
+sleep 1
+
+curl -sg "http://${host}:3079/query/predict?data={\"prefix\":\"hjy\",\"num\":5}"
+echo
+curl -s "http://${host}:2079/manage/status"
+echo
+curl -s "http://${host}:3079/manage/status"
+echo
+
+echo "logs are in ${dir}"
@@ -11,7 +11,17 @@ declare -a urls=(
 'http://127.0.0.1:1079/query/predict?data={"prefix":"hejia","num":5,"filters":{"we_account_id":100100209}}'
 'http://127.0.0.1:1079/query/predict?data={"prefix":"hjy","num":5,"filters":{"we_account_id":100100209}}'
 'http://127.0.0.1:1079/query/predict?data={"prefix":"何","num":10,"filters":{"we_account_id":100100209}}'
+'http://127.0.0.1:1079/manage/attach?key=username&sign=signature&prefixes=["hejinyu","hjy"]&item={"id":10092,"name":"何今雨","we_account_id":100100209}&ttl=1'
+'http://127.0.0.1:1079/manage/patch?key=username&sign=signature&item={"id":10086,"name":"何金玉2","we_account_id":null}'
+'http://127.0.0.1:1079/manage/patch?key=username&sign=signature&item=[{"id":10087,"score":3},{"id":10088,"score":5}]'
+'http://127.0.0.1:1079/manage/detach?key=username&sign=signature&prefixes=["hjy"]&item={"id":10090}'
+'http://127.0.0.1:1079/manage/erase?key=username&sign=signature&item={"id":10091}'
+'http://127.0.0.1:1079/query/predict?data={"prefix":"hjy","num":10,"filters":{"we_account_id":100100209}}'
+'http://127.0.0.1:1079/query/predict?data={"prefix":"djy","num":10}'
 'http://127.0.0.1:1079/manage/get_access_token?tid=17951&filters={"we_account_id":100100209}'
+'http://127.0.0.1:1079/manage/locks?enable=1'
+'http://127.0.0.1:1079/manage/metrics'
+'http://127.0.0.1:1079/manage/profile?seconds=1'
 )
 
 for url in ${urls[@]};